@@ -67,9 +67,363 @@ module Hnswlib
     end
   end
 
+  # CosineSpace is a class that calculates cosine distance for search index.
+  # Vectors are normalized to unit length when they are stored, so the distance is calculated with the dot product.
+  # Zero vectors are stored as they are. This class is used internally.
+  #
+  # @example
+  #   require 'hnswlib'
+  #
+  #   n_features = 3
+  #   space = Hnswlib::CosineSpace.new(n_features)
+  #
+  #   a = [1, 2, 3]
+  #   b = [4, 5, 6]
+  #   space.distance(a, b)
+  #   # => 0.025368...
+  class CosineSpace
+    # Create a new CosineSpace.
+    #
+    # @param dim [Integer] The number of dimensions (features).
+    def initialize(dim)
+      @dim = dim
+    end
+
+    # Calculate the cosine distance between items:
+    # d = 1.0 - sum(Ai * Bi) / (||A|| * ||B||)
+    #
+    # @param arr_a [Array<Float>] The vector of item A.
+    # @param arr_b [Array<Float>] The vector of item B.
+    # @return [Float]
+    def distance(arr_a, arr_b); end
+  end
+
+  # L2SpaceFp16 is a class that calculates squared Euclidean distance for search index storing vectors in IEEE 754 half precision (fp16) format.
+  # It halves the memory footprint of vectors compared to float32, at the cost of precision.
+  # This class is used internally.
+  #
+  # @example
+  #   require 'hnswlib'
+  #
+  #   n_features = 3
+  #   space = Hnswlib::L2SpaceFp16.new(n_features)
+  #
+  #   a = [1, 2, 3]
+  #   b = [4, 5, 6]
+  #   space.distance(a, b)
+  #   # => 27.0
+  class L2SpaceFp16
+    # Create a new L2SpaceFp16.
+    #
+    # @param dim [Integer] The number of dimensions (features).
+    def initialize(dim)
+      @dim = dim
+    end
+
+    # Calculate the squared Euclidean distance between items after converting them to the storage format:
+    # d = sum((Ai - Bi)^2)
+    #
+    # @param arr_a [Array<Float>] The vector of item A.
+    # @param arr_b [Array<Float>] The vector of item B.
+    # @return [Float]
+    def distance(arr_a, arr_b); end
+  end
+
+  # InnerProductSpaceFp16 is a class that calculates dot product for search index storing vectors in IEEE 754 half precision (fp16) format.
+  # It halves the memory footprint of vectors compared to float32, at the cost of precision.
+  # This class is used internally.
+  #
+  # @example
+  #   require 'hnswlib'
+  #
+  #   n_features = 3
+  #   space = Hnswlib::InnerProductSpaceFp16.new(n_features)
+  #
+  #   a = [1, 2, 3]
+  #   b = [4, 5, 6]
+  #   space.distance(a, b)
+  #   # => -31.0
+  class InnerProductSpaceFp16
+    # Create a new InnerProductSpaceFp16.
+    #
+    # @param dim [Integer] The number of dimensions (features).
+    def initialize(dim)
+      @dim = dim
+    end
+
+    # Calculate the dot product between items after converting them to the storage format:
+    # d = 1.0 - sum(Ai * Bi)
+    #
+    # @param arr_a [Array<Float>] The vector of item A.
+    # @param arr_b [Array<Float>] The vector of item B.
+    # @return [Float]
+    def distance(arr_a, arr_b); end
+  end
+
+  # CosineSpaceFp16 is a class that calculates cosine distance for search index storing vectors in IEEE 754 half precision (fp16) format.
+  # Vectors are normalized to unit length before they are converted to the storage format.
+  # This class is used internally.
+  class CosineSpaceFp16
+    # Create a new CosineSpaceFp16.
+    #
+    # @param dim [Integer] The number of dimensions (features).
+    def initialize(dim)
+      @dim = dim
+    end
+
+    # Calculate the cosine distance between items after converting them to the storage format:
+    # d = 1.0 - sum(Ai * Bi) / (||A|| * ||B||)
+    #
+    # @param arr_a [Array<Float>] The vector of item A.
+    # @param arr_b [Array<Float>] The vector of item B.
+    # @return [Float]
+    def distance(arr_a, arr_b); end
+  end
+
+  # L2SpaceBf16 is a class that calculates squared Euclidean distance for search index storing vectors in bfloat16 (bf16) format.
+  # It halves the memory footprint of vectors compared to float32, at the cost of precision.
+  # This class is used internally.
+  #
+  # @example
+  #   require 'hnswlib'
+  #
+  #   n_features = 3
+  #   space = Hnswlib::L2SpaceBf16.new(n_features)
+  #
+  #   a = [1, 2, 3]
+  #   b = [4, 5, 6]
+  #   space.distance(a, b)
+  #   # => 27.0
+  class L2SpaceBf16
+    # Create a new L2SpaceBf16.
+    #
+    # @param dim [Integer] The number of dimensions (features).
+    def initialize(dim)
+      @dim = dim
+    end
+
+    # Calculate the squared Euclidean distance between items after converting them to the storage format:
+    # d = sum((Ai - Bi)^2)
+    #
+    # @param arr_a [Array<Float>] The vector of item A.
+    # @param arr_b [Array<Float>] The vector of item B.
+    # @return [Float]
+    def distance(arr_a, arr_b); end
+  end
+
+  # InnerProductSpaceBf16 is a class that calculates dot product for search index storing vectors in bfloat16 (bf16) format.
+  # It halves the memory footprint of vectors compared to float32, at the cost of precision.
+  # This class is used internally.
+  #
+  # @example
+  #   require 'hnswlib'
+  #
+  #   n_features = 3
+  #   space = Hnswlib::InnerProductSpaceBf16.new(n_features)
+  #
+  #   a = [1, 2, 3]
+  #   b = [4, 5, 6]
+  #   space.distance(a, b)
+  #   # => -31.0
+  class InnerProductSpaceBf16
+    # Create a new InnerProductSpaceBf16.
+    #
+    # @param dim [Integer] The number of dimensions (features).
+    def initialize(dim)
+      @dim = dim
+    end
+
+    # Calculate the dot product between items after converting them to the storage format:
+    # d = 1.0 - sum(Ai * Bi)
+    #
+    # @param arr_a [Array<Float>] The vector of item A.
+    # @param arr_b [Array<Float>] The vector of item B.
+    # @return [Float]
+    def distance(arr_a, arr_b); end
+  end
+
+  # CosineSpaceBf16 is a class that calculates cosine distance for search index storing vectors in bfloat16 (bf16) format.
+  # Vectors are normalized to unit length before they are converted to the storage format.
+  # This class is used internally.
+  class CosineSpaceBf16
+    # Create a new CosineSpaceBf16.
+    #
+    # @param dim [Integer] The number of dimensions (features).
+    def initialize(dim)
+      @dim = dim
+    end
+
+    # Calculate the cosine distance between items after converting them to the storage format:
+    # d = 1.0 - sum(Ai * Bi) / (||A|| * ||B||)
+    #
+    # @param arr_a [Array<Float>] The vector of item A.
+    # @param arr_b [Array<Float>] The vector of item B.
+    # @return [Float]
+    def distance(arr_a, arr_b); end
+  end
+
+  # HammingSpace is a class that calculates Hamming distance between binary codes for search index.
+  # The dimensionality is the number of bits, and the vectors are stored as packed bits
+  # where the elements greater than zero are set bits. This class is used internally.
+  #
+  # @example
+  #   require 'hnswlib'
+  #
+  #   n_bits = 4
+  #   space = Hnswlib::HammingSpace.new(n_bits)
+  #
+  #   a = [1, 0, 1, 1]
+  #   b = [0, 0, 1, 0]
+  #   space.distance(a, b)
+  #   # => 2.0
+  class HammingSpace
+    # Create a new HammingSpace.
+    #
+    # @param dim [Integer] The number of bits.
+    def initialize(dim)
+      @dim = dim
+    end
+
+    # Calculate the number of differing bits between items.
+    #
+    # @param arr_a [Array<Float>] The vector of item A.
+    # @param arr_b [Array<Float>] The vector of item B.
+    # @return [Float]
+    def distance(arr_a, arr_b); end
+  end
+
+  # L2SpaceSQ8 is a class that calculates squared Euclidean distance for search index storing each element
+  # of vectors as an 8-bit code. The range of each dimension is learned from sample vectors, and the distance
+  # is calculated between the reconstructed vectors. It reduces the memory footprint of vectors to a quarter.
+  # This class is used internally.
+  #
+  # @example
+  #   require 'hnswlib'
+  #
+  #   n_features = 3
+  #   space = Hnswlib::L2SpaceSQ8.new(n_features)
+  #   space.train([[0, 0, 0], [1, 2, 3]])
+  #
+  #   a = [0, 0, 0]
+  #   b = [1, 2, 3]
+  #   space.distance(a, b)
+  #   # => 14.0
+  class L2SpaceSQ8
+    # Create a new L2SpaceSQ8.
+    #
+    # @param dim [Integer] The number of dimensions (features).
+    def initialize(dim)
+      @dim = dim
+    end
+
+    # Learn the range of each dimension from sample vectors.
+    # Values out of the range are clamped to the nearest end of the range when encoded.
+    # The space has to be trained before items are added to the search index using it, and cannot be trained again.
+    #
+    # @param mat [Array<Array>, String, Numo::SFloat] The sample vectors, which must be at least two.
+    # @return [L2SpaceSQ8]
+    def train(mat); end
+
+    # Return whether the range of each dimension has been learned.
+    #
+    # @return [Boolean]
+    def trained?; end
+
+    # Calculate the squared Euclidean distance between items after quantizing them:
+    # d = sum((Ai - Bi)^2)
+    #
+    # @param arr_a [Array<Float>] The vector of item A.
+    # @param arr_b [Array<Float>] The vector of item B.
+    # @return [Float]
+    def distance(arr_a, arr_b); end
+  end
+
+  # L2SpacePQ is a class that calculates squared Euclidean distance for search index storing vectors
+  # with product quantization. Vectors are split into sub-vectors, and each sub-vector is stored as the index
+  # of the nearest of 256 centroids learned by k-means, so that a vector takes one byte per sub-vector.
+  # The distance from a query is calculated with a lookup table of the distances from the query sub-vectors
+  # to the centroids, which is prepared once per query. This class is used internally.
+  #
+  # @example
+  #   require 'hnswlib'
+  #
+  #   n_features = 4
+  #   n_subvectors = 2
+  #   space = Hnswlib::L2SpacePQ.new(n_features, n_subvectors)
+  #   space.train([[0, 0, 1, 1], [1, 1, 0, 0]])
+  #
+  #   a = [0, 0, 1, 1]
+  #   b = [1, 1, 0, 0]
+  #   space.distance(a, b)
+  #   # => 4.0
+  class L2SpacePQ
+    # Create a new L2SpacePQ.
+    #
+    # @param dim [Integer] The number of dimensions (features).
+    # @param n_subvectors [Integer] The number of sub-vectors, which must divide the number of dimensions.
+    def initialize(dim, n_subvectors)
+      @dim = dim
+      @n_subvectors = n_subvectors
+    end
+
+    # Learn the centroids of each sub-vector from sample vectors with k-means.
+    # At most 8192 vectors randomly chosen from the samples are used. If there are 256 samples or fewer,
+    # the samples are used as the centroids as they are, so that at least 256 samples should be given.
+    # The space has to be trained before items are added to the search index using it, and cannot be trained again.
+    #
+    # @param mat [Array<Array>, String, Numo::SFloat] The sample vectors, which must be at least two.
+    # @return [L2SpacePQ]
+    def train(mat); end
+
+    # Return whether the centroids have been learned.
+    #
+    # @return [Boolean]
+    def trained?; end
+
+    # Calculate the squared Euclidean distance between the query A and the item B after quantizing B:
+    # d = sum((Ai - Bi)^2)
+    #
+    # @param arr_a [Array<Float>] The vector of query A.
+    # @param arr_b [Array<Float>] The vector of item B.
+    # @return [Float]
+    def distance(arr_a, arr_b); end
+  end
+
+  # LabelFilter is a class that filters search results by a set of labels without calling back into Ruby.
+  #
+  # @example
+  #   require 'hnswlib'
+  #
+  #   filter = Hnswlib::LabelFilter.new([1, 3, 5])
+  #   index.search_knn(query, 10, filter: filter)
+  #
+  #   filter = Hnswlib::LabelFilter.new(Set[2, 4], deny: true)
+  #   index.search_knn(query, 10, filter: filter)
+  class LabelFilter
+    # Create a new LabelFilter.
+    #
+    # @param labels [Array<Integer>, Set<Integer>] The labels of elements to be allowed (or denied).
+    # @param deny [Boolean] The flag to exclude the given labels from search results instead of allowing only them.
+    def initialize(labels, deny: false); end
+
+    # Return the number of distinct labels in the filter.
+    #
+    # @return [Integer]
+    def size; end
+
+    # Return whether the given labels are excluded from search results.
+    #
+    # @return [Boolean]
+    def deny?; end
+  end
+
   # HierarchicalNSW is a class that provides functions for approximate k-NN search.
   # This class is used internally.
   #
+  # Searches and insertions let other threads run. While any of them is running, the methods replacing or
+  # reallocating the index, namely init_index, save_index, load_index, resize_index, reorder!, and set_read_only,
+  # raise RuntimeError.
+  #
   # @example
   #   require 'hnswlib'
   #
@@ -95,6 +449,12 @@ module Hnswlib
     # Create a new HierarchicalNSW.
     #
     # @param space [String] The metric space name of search index ('l2', 'ip', or 'cosine').
+    #   Appending '_fp16' or '_bf16' to the name, such as 'cosine_fp16', stores vectors in 16-bit floating point format.
+    #   'l2_sq8' stores vectors as 8-bit codes quantized with the range of each dimension learned from data.
+    #   'l2_pq<n_subvectors>', such as 'l2_pq16', stores vectors as product quantization codes of the given number of
+    #   sub-vectors, which must divide the number of dimensions.
+    #   'hamming' stores binary codes as packed bits, where the elements greater than zero are set bits,
+    #   and the distance is the number of differing bits.
     # @param dim [Integer] The number of dimensions (features).
     def initialize(space:, dim:); end
 
@@ -105,35 +465,93 @@ module Hnswlib
     # @param ef_construction [Integer] The size of the dynamic list for the nearest neighbors.
     # @param random_seed [Integer] The seed value using to initialize the random generator.
     # @param allow_replace_deleted [Boolean] The flag to replace deleted item when adding new item.
+    # @param rerank [Boolean] The flag to keep the full precision vectors apart from the graph of a compressed space
+    #   such as 'l2_fp16' or 'l2_sq8'. The graph is traversed with the compressed vectors, and then the candidates
+    #   are re-ranked by the exact distances to the full precision vectors.
+    # @param split_layout [Boolean] The flag to store the links of the bottom layer, the vectors, and the labels
+    #   in separate arrays instead of a record per item, so that traversing the graph does not load the vectors
+    #   into cache and vice versa. The layout does not change the format of the saved index.
+    # @param huge_pages [Boolean] The flag to back the bottom layer with 2 MB huge pages, which reduces the TLB misses
+    #   of searching a large index. Explicit huge pages are used if the system reserves them, and otherwise
+    #   transparent huge pages are requested.
     # @return [Nil]
-    def init_index(max_elements:, m: 16, ef_construction: 200, random_seed: 100, allow_replace_deleted: false); end
+    def init_index(max_elements:, m: 16, ef_construction: 200, random_seed: 100, allow_replace_deleted: false, rerank: false,
+                   split_layout: false, huge_pages: false); end
 
     # Add item to be indexed.
     #
-    # @param arr [Array] The vector of item.
+    # @param arr [Array, String, Numo::SFloat] The vector of item.
+    #   A String is read as packed float32 values such as [1.0, 2.0].pack('f*') without conversion.
     # @param idx [Integer] The ID of item.
     # @param replace_deleted [Boolean] The flag to replace a deleted item.
     # @return [Boolean]
     def add_point(arr, idx, replace_deleted: false); end
 
+    # Add multiple items to be indexed in parallel.
+    #
+    # @param mat [Array<Array>, String, Numo::SFloat] The vectors of items.
+    #   A String is read as a row-major matrix of packed float32 values without conversion.
+    # @param labels [Array<Integer>] The IDs of items.
+    # @param num_threads [Integer] The number of threads to add items. If -1 is given, all available processors are used.
+    # @param replace_deleted [Boolean] The flag to replace deleted items.
+    # @return [Boolean]
+    def add_items(mat, labels, num_threads: -1, replace_deleted: false); end
+
     # Search the k closest items.
     #
-    # @param arr [Array] The vector of query item.
+    # @param arr [Array, String, Numo::SFloat] The vector of query item.
+    #   A String is read as packed float32 values such as [1.0, 2.0].pack('f*') without conversion.
     # @param k [Integer] The number of nearest neighbors.
-    # @param filter [Proc] The function that filters elements by its labels.
-    # @return [Array<Array<Integer>, Array<Float>>]
-    def search_knn(arr, k, filter: nil); end
+    # @param filter [Proc, LabelFilter] The function that filters elements by its labels.
+    #   A LabelFilter is evaluated natively, which is much faster than a Proc and lets other threads run during the search.
+    # @param packed [Boolean] The flag to return the labels and distances as packed uint64 and float32 strings,
+    #   which can be unpacked with unpack('Q*') and unpack('f*'), instead of Ruby Arrays.
+    # @param out [Array<String>] The pair of strings to be overwritten with the packed labels and distances.
+    #   Reusing the strings avoids allocating new objects for each query. If given, packed results are returned.
+    # @return [Array<Array<Integer>, Array<Float>>, Array<String>]
+    def search_knn(arr, k, filter: nil, packed: false, out: nil); end
+
+    # Search the k closest items for multiple queries in parallel.
+    # The results are returned as packed binary strings holding an n_queries x k matrix in row-major order,
+    # and the neighbors of each query are sorted from closest to farthest.
+    #
+    # @example
+    #   labels, distances = index.search_knn_batch(queries, 10)
+    #   labels = labels.unpack('Q*').each_slice(10).to_a
+    #   distances = distances.unpack('f*').each_slice(10).to_a
+    #
+    # @param mat [Array<Array>, String, Numo::SFloat] The vectors of query items.
+    #   A String is read as a row-major matrix of packed float32 values without conversion.
+    # @param k [Integer] The number of nearest neighbors.
+    # @param num_threads [Integer] The number of threads to search items. If -1 is given, all available processors are used.
+    # @return [Array<String>] The labels as native-endian uint64 and the distances as native-endian float32.
+    def search_knn_batch(mat, k, num_threads: -1); end
 
     # Save the search index to disk.
+    # If re-ranking is enabled, the full precision vectors are saved to the file with the '.rerank' suffix.
     #
     # @param filename [String] The filename of search index.
-    def save_index(filename); end
+    # @param label_index [Boolean] The flag to save the table of labels and the deleted items to the file with
+    #   the '.labels' suffix, which load_index reads instead of the labels of all items. The index file itself keeps
+    #   the format read by the other versions of hnswlib. If the flag is false, an existing '.labels' file is removed.
+    def save_index(filename, label_index: false); end
 
     # Load a search index from disk.
     #
     # @param filename [String] The filename of search index.
     # @param allow_replace_deleted [Boolean] The flag to replace deleted item when adding new item.
-    def load_index(filename, allow_replace_deleted: false); end
+    # @param rerank [Boolean, Symbol] The flag to load the full precision vectors for re-ranking from the file
+    #   with the '.rerank' suffix. If :mmap is given, the file is memory-mapped instead of being read into memory.
+    # @param split_layout [Boolean] The flag to store the loaded index in the split layout (see #init_index).
+    # @param huge_pages [Boolean] The flag to back the bottom layer of the loaded index with huge pages (see #init_index).
+    # @param mmap [Boolean] The flag to map the bottom layer from the file copy-on-write instead of reading it.
+    #   Loading does not copy the items, and the processes loading the same file share its pages in the page cache.
+    #   It cannot be used with split_layout or huge_pages.
+    # @param label_index [Boolean] The flag to load the labels from the file with the '.labels' suffix,
+    #   which save_index writes with the label_index flag, so that loading does not read the labels of all items.
+    #   If the file is missing or was saved with another index file, the labels of all items are read instead.
+    def load_index(filename, allow_replace_deleted: false, rerank: false, split_layout: false, huge_pages: false, mmap: false,
+                   label_index: false); end
 
     # Return the item vector.
     #
@@ -156,6 +574,26 @@ module Hnswlib
     # @param new_max_item [Integer] The maximum number of items.
     def resize_index(new_max_item); end
 
+    # Renumber the items in the breadth-first order of the graph from the entry point, so that the neighbors of
+    # each item are stored close to it in memory. The search results do not change, and the order is kept when
+    # the index is saved. This method should not be called while other threads use the index.
+    #
+    # @return [Nil]
+    def reorder!; end
+
+    # Set whether the index is read-only. The methods modifying a read-only index raise RuntimeError, and looking up
+    # the items does not take locks. Searches never take locks, but with a read-only index they also never run into
+    # an insertion rewriting the graph, so that concurrent searches on a read-only index are free of data races.
+    #
+    # @param read_only [Boolean] The flag to make the index read-only.
+    # @return [Nil]
+    def set_read_only(read_only); end
+
+    # Return whether the index is read-only.
+    #
+    # @return [Boolean]
+    def read_only?; end
+
     # Set the size of the dynamic list for the nearest neighbors.
     #
     # @param new_ef [Integer] The size of the dynamic list.
@@ -175,6 +613,8 @@ module Hnswlib
   # BruteforceSearch is a class that provides functions for exct k-NN search.
   # This class is useful for evaluating the search accuracy and investigating the optimal hyperparameters of HierarchicalNSW.
   #
+  # Searches let other threads run. While any of them is running, init_index and load_index raise RuntimeError.
+  #
   # @example
   #   require 'hnswlib'
   #
@@ -199,6 +639,12 @@ module Hnswlib
     # Create a new BruteforceSearch.
     #
     # @param space [String] The metric space name of search index ('l2', 'ip', or 'cosine').
+    #   Appending '_fp16' or '_bf16' to the name, such as 'cosine_fp16', stores vectors in 16-bit floating point format.
+    #   'l2_sq8' stores vectors as 8-bit codes quantized with the range of each dimension learned from data.
+    #   'l2_pq<n_subvectors>', such as 'l2_pq16', stores vectors as product quantization codes of the given number of
+    #   sub-vectors, which must divide the number of dimensions.
+    #   'hamming' stores binary codes as packed bits, where the elements greater than zero are set bits,
+    #   and the distance is the number of differing bits.
     def initialize(space:); end
 
     # Initialize search index.
@@ -209,16 +655,19 @@ module Hnswlib
 
     # Add item to be indexed.
     #
-    # @param arr [Array] The vector of item.
+    # @param arr [Array, String, Numo::SFloat] The vector of item.
+    #   A String is read as packed float32 values such as [1.0, 2.0].pack('f*') without conversion.
     # @param idx [Integer] The ID of item.
     # @return [Boolean]
     def add_point(arr, idx); end
 
     # Search the k closest items.
     #
-    # @param arr [Array] The vector of query item.
+    # @param arr [Array, String, Numo::SFloat] The vector of query item.
+    #   A String is read as packed float32 values such as [1.0, 2.0].pack('f*') without conversion.
     # @param k [Integer] The number of nearest neighbors.
-    # @param filter [Proc] The function that filters elements by its labels.
+    # @param filter [Proc, LabelFilter] The function that filters elements by its labels.
+    #   A LabelFilter is evaluated natively, which is much faster than a Proc and lets other threads run during the search.
     # @return [Array<Array<Integer>, Array<Float>>]
     def search_knn(arr, k, filter: nil); end
 
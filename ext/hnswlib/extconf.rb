@@ -6,4 +6,6 @@ $CXXFLAGS << ' -std=c++14'
 $INCFLAGS << " -I$(srcdir)/src"
 $VPATH << "$(srcdir)/src"
 
+have_header('ruby/memory_view.h')
+
 create_makefile('hnswlib/hnswlibext')
@@ -22,6 +22,19 @@ extern "C" void Init_hnswlibext(void) {
   rb_mHnswlib = rb_define_module("Hnswlib");
   RbHnswlibL2Space::define_class(rb_mHnswlib);
   RbHnswlibInnerProductSpace::define_class(rb_mHnswlib);
+  RbHnswlibCosineSpace::define_class(rb_mHnswlib);
+  RbHnswlibHammingSpace::define_class(rb_mHnswlib);
+  rb_cHnswlibL2SpaceFp16 = RbHnswlibHalfSpace<hnswlib::L2SpaceFp16>::define_class(rb_mHnswlib, "L2SpaceFp16");
+  rb_cHnswlibInnerProductSpaceFp16 =
+      RbHnswlibHalfSpace<hnswlib::InnerProductSpaceFp16>::define_class(rb_mHnswlib, "InnerProductSpaceFp16");
+  rb_cHnswlibL2SpaceBf16 = RbHnswlibHalfSpace<hnswlib::L2SpaceBf16>::define_class(rb_mHnswlib, "L2SpaceBf16");
+  rb_cHnswlibInnerProductSpaceBf16 =
+      RbHnswlibHalfSpace<hnswlib::InnerProductSpaceBf16>::define_class(rb_mHnswlib, "InnerProductSpaceBf16");
+  rb_cHnswlibCosineSpaceFp16 = RbHnswlibHalfSpace<hnswlib::CosineSpaceFp16>::define_class(rb_mHnswlib, "CosineSpaceFp16");
+  rb_cHnswlibCosineSpaceBf16 = RbHnswlibHalfSpace<hnswlib::CosineSpaceBf16>::define_class(rb_mHnswlib, "CosineSpaceBf16");
+  RbHnswlibL2SpaceSQ8::define_class(rb_mHnswlib);
+  RbHnswlibL2SpacePQ::define_class(rb_mHnswlib);
+  RbHnswlibLabelFilter::define_class(rb_mHnswlib);
   RbHnswlibHierarchicalNSW::define_class(rb_mHnswlib);
   RbHnswlibBruteforceSearch::define_class(rb_mHnswlib);
 }
@@ -20,16 +20,41 @@
 #define HNSWLIBEXT_HPP 1
 
 #include <ruby.h>
+#include <ruby/thread.h>
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+#include <ruby/memory_view.h>
+#endif
 
 #include <hnswlib.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <mutex>
 #include <new>
+#include <string>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 
 VALUE rb_mHnswlib;
 VALUE rb_cHnswlibL2Space;
 VALUE rb_cHnswlibInnerProductSpace;
+VALUE rb_cHnswlibCosineSpace;
+VALUE rb_cHnswlibHammingSpace;
+VALUE rb_cHnswlibL2SpaceFp16;
+VALUE rb_cHnswlibInnerProductSpaceFp16;
+VALUE rb_cHnswlibL2SpaceBf16;
+VALUE rb_cHnswlibInnerProductSpaceBf16;
+VALUE rb_cHnswlibCosineSpaceFp16;
+VALUE rb_cHnswlibCosineSpaceBf16;
+VALUE rb_cHnswlibL2SpaceSQ8;
+VALUE rb_cHnswlibL2SpacePQ;
+VALUE rb_cHnswlibLabelFilter;
 VALUE rb_cHnswlibHierarchicalNSW;
 VALUE rb_cHnswlibBruteforceSearch;
 
@@ -185,19 +210,1018 @@ const rb_data_type_t RbHnswlibInnerProductSpace::hnsw_ipspace_type = {
 };
 // clang-format on
 
+class RbHnswlibCosineSpace {
+public:
+  static VALUE hnsw_cosinespace_alloc(VALUE self) {
+    hnswlib::CosineSpace* ptr = (hnswlib::CosineSpace*)ruby_xmalloc(sizeof(hnswlib::CosineSpace));
+    new (ptr) hnswlib::CosineSpace(); // dummy call to constructor for GC.
+    return TypedData_Wrap_Struct(self, &hnsw_cosinespace_type, ptr);
+  };
+
+  static void hnsw_cosinespace_free(void* ptr) {
+    ((hnswlib::CosineSpace*)ptr)->~CosineSpace();
+    ruby_xfree(ptr);
+  };
+
+  static size_t hnsw_cosinespace_size(const void* ptr) { return sizeof(*((hnswlib::CosineSpace*)ptr)); };
+
+  static hnswlib::CosineSpace* get_hnsw_cosinespace(VALUE self) {
+    hnswlib::CosineSpace* ptr;
+    TypedData_Get_Struct(self, hnswlib::CosineSpace, &hnsw_cosinespace_type, ptr);
+    return ptr;
+  };
+
+  static VALUE define_class(VALUE outer) {
+    rb_cHnswlibCosineSpace = rb_define_class_under(outer, "CosineSpace", rb_cObject);
+    rb_define_alloc_func(rb_cHnswlibCosineSpace, hnsw_cosinespace_alloc);
+    rb_define_method(rb_cHnswlibCosineSpace, "initialize", RUBY_METHOD_FUNC(_hnsw_cosinespace_init), 1);
+    rb_define_method(rb_cHnswlibCosineSpace, "distance", RUBY_METHOD_FUNC(_hnsw_cosinespace_distance), 2);
+    rb_define_attr(rb_cHnswlibCosineSpace, "dim", 1, 0);
+    return rb_cHnswlibCosineSpace;
+  };
+
+private:
+  static const rb_data_type_t hnsw_cosinespace_type;
+
+  static VALUE _hnsw_cosinespace_init(VALUE self, VALUE dim) {
+    rb_iv_set(self, "@dim", dim);
+    hnswlib::CosineSpace* ptr = get_hnsw_cosinespace(self);
+    new (ptr) hnswlib::CosineSpace(NUM2SIZET(rb_iv_get(self, "@dim")));
+    return Qnil;
+  };
+
+  static VALUE _hnsw_cosinespace_distance(VALUE self, VALUE arr_a, VALUE arr_b) {
+    const size_t dim = NUM2SIZET(rb_iv_get(self, "@dim"));
+    if (!RB_TYPE_P(arr_a, T_ARRAY) || !RB_TYPE_P(arr_b, T_ARRAY)) {
+      rb_raise(rb_eArgError, "Expect input vector to be Ruby Array.");
+      return Qnil;
+    }
+    if (dim != RARRAY_LEN(arr_a) || dim != RARRAY_LEN(arr_b)) {
+      rb_raise(rb_eArgError, "Array size does not match to space dimensionality.");
+      return Qnil;
+    }
+    hnswlib::CosineSpace* space = get_hnsw_cosinespace(self);
+    float* vec = (float*)ruby_xmalloc(dim * sizeof(float));
+    float* vec_a = (float*)ruby_xmalloc(dim * sizeof(float));
+    float* vec_b = (float*)ruby_xmalloc(dim * sizeof(float));
+    for (size_t i = 0; i < dim; i++) vec[i] = (float)NUM2DBL(rb_ary_entry(arr_a, i));
+    space->encode(vec, vec_a);
+    for (size_t i = 0; i < dim; i++) vec[i] = (float)NUM2DBL(rb_ary_entry(arr_b, i));
+    space->encode(vec, vec_b);
+    hnswlib::DISTFUNC<float> dist_func = space->get_dist_func();
+    const float dist = dist_func(vec_a, vec_b, space->get_dist_func_param());
+    ruby_xfree(vec);
+    ruby_xfree(vec_a);
+    ruby_xfree(vec_b);
+    return DBL2NUM((double)dist);
+  };
+};
+
+// clang-format off
+const rb_data_type_t RbHnswlibCosineSpace::hnsw_cosinespace_type = {
+  "RbHnswlibCosineSpace",
+  {
+    NULL,
+    RbHnswlibCosineSpace::hnsw_cosinespace_free,
+    RbHnswlibCosineSpace::hnsw_cosinespace_size
+  },
+  NULL,
+  NULL,
+  RUBY_TYPED_FREE_IMMEDIATELY
+};
+// clang-format on
+
+class RbHnswlibHammingSpace {
+public:
+  static VALUE hnsw_hammingspace_alloc(VALUE self) {
+    hnswlib::HammingSpace* ptr = (hnswlib::HammingSpace*)ruby_xmalloc(sizeof(hnswlib::HammingSpace));
+    new (ptr) hnswlib::HammingSpace(); // dummy call to constructor for GC.
+    return TypedData_Wrap_Struct(self, &hnsw_hammingspace_type, ptr);
+  };
+
+  static void hnsw_hammingspace_free(void* ptr) {
+    ((hnswlib::HammingSpace*)ptr)->~HammingSpace();
+    ruby_xfree(ptr);
+  };
+
+  static size_t hnsw_hammingspace_size(const void* ptr) { return sizeof(*((hnswlib::HammingSpace*)ptr)); };
+
+  static hnswlib::HammingSpace* get_hnsw_hammingspace(VALUE self) {
+    hnswlib::HammingSpace* ptr;
+    TypedData_Get_Struct(self, hnswlib::HammingSpace, &hnsw_hammingspace_type, ptr);
+    return ptr;
+  };
+
+  static VALUE define_class(VALUE outer) {
+    rb_cHnswlibHammingSpace = rb_define_class_under(outer, "HammingSpace", rb_cObject);
+    rb_define_alloc_func(rb_cHnswlibHammingSpace, hnsw_hammingspace_alloc);
+    rb_define_method(rb_cHnswlibHammingSpace, "initialize", RUBY_METHOD_FUNC(_hnsw_hammingspace_init), 1);
+    rb_define_method(rb_cHnswlibHammingSpace, "distance", RUBY_METHOD_FUNC(_hnsw_hammingspace_distance), 2);
+    rb_define_attr(rb_cHnswlibHammingSpace, "dim", 1, 0);
+    return rb_cHnswlibHammingSpace;
+  };
+
+private:
+  static const rb_data_type_t hnsw_hammingspace_type;
+
+  static VALUE _hnsw_hammingspace_init(VALUE self, VALUE dim) {
+    rb_iv_set(self, "@dim", dim);
+    hnswlib::HammingSpace* ptr = get_hnsw_hammingspace(self);
+    new (ptr) hnswlib::HammingSpace(NUM2SIZET(rb_iv_get(self, "@dim")));
+    return Qnil;
+  };
+
+  static VALUE _hnsw_hammingspace_distance(VALUE self, VALUE arr_a, VALUE arr_b) {
+    const size_t dim = NUM2SIZET(rb_iv_get(self, "@dim"));
+    if (!RB_TYPE_P(arr_a, T_ARRAY) || !RB_TYPE_P(arr_b, T_ARRAY)) {
+      rb_raise(rb_eArgError, "Expect input vector to be Ruby Array.");
+      return Qnil;
+    }
+    if (dim != RARRAY_LEN(arr_a) || dim != RARRAY_LEN(arr_b)) {
+      rb_raise(rb_eArgError, "Array size does not match to space dimensionality.");
+      return Qnil;
+    }
+    hnswlib::HammingSpace* space = get_hnsw_hammingspace(self);
+    float* vec = (float*)ruby_xmalloc(dim * sizeof(float));
+    char* vec_a = (char*)ruby_xmalloc(space->get_data_size());
+    char* vec_b = (char*)ruby_xmalloc(space->get_data_size());
+    for (size_t i = 0; i < dim; i++) vec[i] = (float)NUM2DBL(rb_ary_entry(arr_a, i));
+    space->encode(vec, vec_a);
+    for (size_t i = 0; i < dim; i++) vec[i] = (float)NUM2DBL(rb_ary_entry(arr_b, i));
+    space->encode(vec, vec_b);
+    hnswlib::DISTFUNC<float> dist_func = space->get_dist_func();
+    const float dist = dist_func(vec_a, vec_b, space->get_dist_func_param());
+    ruby_xfree(vec);
+    ruby_xfree(vec_a);
+    ruby_xfree(vec_b);
+    return DBL2NUM((double)dist);
+  };
+};
+
+// clang-format off
+const rb_data_type_t RbHnswlibHammingSpace::hnsw_hammingspace_type = {
+  "RbHnswlibHammingSpace",
+  {
+    NULL,
+    RbHnswlibHammingSpace::hnsw_hammingspace_free,
+    RbHnswlibHammingSpace::hnsw_hammingspace_size
+  },
+  NULL,
+  NULL,
+  RUBY_TYPED_FREE_IMMEDIATELY
+};
+// clang-format on
+
+// Wraps the spaces storing vectors in 16-bit floating point formats. Each instantiation is exposed as its own
+// Ruby class, and all of them share the parent data type so that the indices can unwrap them uniformly.
+class RbHnswlibHalfSpaceBase {
+public:
+  static hnswlib::SpaceInterface<float>* get_hnsw_halfspace(VALUE self) {
+    return (hnswlib::SpaceInterface<float>*)rb_check_typeddata(self, &hnsw_halfspace_type);
+  };
+
+  static bool is_halfspace(VALUE self) { return rb_typeddata_is_kind_of(self, &hnsw_halfspace_type) != 0; };
+
+  static const rb_data_type_t hnsw_halfspace_type;
+};
+
+// clang-format off
+const rb_data_type_t RbHnswlibHalfSpaceBase::hnsw_halfspace_type = {
+  "RbHnswlibHalfSpace",
+  {
+    NULL,
+    NULL,
+    NULL
+  },
+  NULL,
+  NULL,
+  RUBY_TYPED_FREE_IMMEDIATELY
+};
+// clang-format on
+
+template <class SpaceT> class RbHnswlibHalfSpace : public RbHnswlibHalfSpaceBase {
+public:
+  static VALUE hnsw_halfspace_alloc(VALUE self) {
+    SpaceT* ptr = (SpaceT*)ruby_xmalloc(sizeof(SpaceT));
+    new (ptr) SpaceT(); // dummy call to constructor for GC.
+    return TypedData_Wrap_Struct(self, &hnsw_halfspace_type_t, static_cast<hnswlib::SpaceInterface<float>*>(ptr));
+  };
+
+  static void hnsw_halfspace_free(void* ptr) {
+    SpaceT* space = static_cast<SpaceT*>((hnswlib::SpaceInterface<float>*)ptr);
+    space->~SpaceT();
+    ruby_xfree(space);
+  };
+
+  static size_t hnsw_halfspace_size(const void* ptr) { return sizeof(SpaceT); };
+
+  static SpaceT* get_hnsw_halfspace_t(VALUE self) {
+    hnswlib::SpaceInterface<float>* ptr;
+    TypedData_Get_Struct(self, hnswlib::SpaceInterface<float>, &hnsw_halfspace_type_t, ptr);
+    return static_cast<SpaceT*>(ptr);
+  };
+
+  static VALUE define_class(VALUE outer, const char* name) {
+    VALUE klass = rb_define_class_under(outer, name, rb_cObject);
+    rb_define_alloc_func(klass, hnsw_halfspace_alloc);
+    rb_define_method(klass, "initialize", RUBY_METHOD_FUNC(_hnsw_halfspace_init), 1);
+    rb_define_method(klass, "distance", RUBY_METHOD_FUNC(_hnsw_halfspace_distance), 2);
+    rb_define_attr(klass, "dim", 1, 0);
+    return klass;
+  };
+
+private:
+  static const rb_data_type_t hnsw_halfspace_type_t;
+
+  static VALUE _hnsw_halfspace_init(VALUE self, VALUE dim) {
+    // The conversion can raise, so it is done before the placeholder space is destroyed.
+    const size_t n_dims = NUM2SIZET(dim);
+    rb_iv_set(self, "@dim", dim);
+    SpaceT* ptr = get_hnsw_halfspace_t(self);
+    ptr->~SpaceT();
+    new (ptr) SpaceT(n_dims);
+    return Qnil;
+  };
+
+  static VALUE _hnsw_halfspace_distance(VALUE self, VALUE arr_a, VALUE arr_b) {
+    const size_t dim = NUM2SIZET(rb_iv_get(self, "@dim"));
+    if (!RB_TYPE_P(arr_a, T_ARRAY) || !RB_TYPE_P(arr_b, T_ARRAY)) {
+      rb_raise(rb_eArgError, "Expect input vector to be Ruby Array.");
+      return Qnil;
+    }
+    if (dim != RARRAY_LEN(arr_a) || dim != RARRAY_LEN(arr_b)) {
+      rb_raise(rb_eArgError, "Array size does not match to space dimensionality.");
+      return Qnil;
+    }
+    SpaceT* space = get_hnsw_halfspace_t(self);
+    float* vec = (float*)ruby_xmalloc(dim * sizeof(float));
+    char* code_a = (char*)ruby_xmalloc(space->get_data_size());
+    char* code_b = (char*)ruby_xmalloc(space->get_data_size());
+    for (size_t i = 0; i < dim; i++) vec[i] = (float)NUM2DBL(rb_ary_entry(arr_a, i));
+    space->encode(vec, code_a);
+    for (size_t i = 0; i < dim; i++) vec[i] = (float)NUM2DBL(rb_ary_entry(arr_b, i));
+    space->encode(vec, code_b);
+    hnswlib::DISTFUNC<float> dist_func = space->get_dist_func();
+    const float dist = dist_func(code_a, code_b, space->get_dist_func_param());
+    ruby_xfree(vec);
+    ruby_xfree(code_a);
+    ruby_xfree(code_b);
+    return DBL2NUM((double)dist);
+  };
+};
+
+// clang-format off
+template <class SpaceT> const rb_data_type_t RbHnswlibHalfSpace<SpaceT>::hnsw_halfspace_type_t = {
+  "RbHnswlibHalfSpace",
+  {
+    NULL,
+    RbHnswlibHalfSpace<SpaceT>::hnsw_halfspace_free,
+    RbHnswlibHalfSpace<SpaceT>::hnsw_halfspace_size
+  },
+  &RbHnswlibHalfSpaceBase::hnsw_halfspace_type,
+  NULL,
+  RUBY_TYPED_FREE_IMMEDIATELY
+};
+// clang-format on
+
+// Runs fn(id) for each id in [start, end) on native threads.
+// The first exception thrown by fn is rethrown after all threads have finished.
+template <class Function> inline void ParallelFor(size_t start, size_t end, size_t num_threads, Function fn) {
+  if (num_threads <= 1) {
+    for (size_t id = start; id < end; id++) fn(id);
+    return;
+  }
+
+  std::vector<std::thread> threads;
+  std::atomic<size_t> current(start);
+  std::exception_ptr last_exception = nullptr;
+  std::mutex last_except_mutex;
+
+  for (size_t n = 0; n < num_threads; n++) {
+    threads.push_back(std::thread([&] {
+      while (true) {
+        const size_t id = current.fetch_add(1);
+        if (id >= end) break;
+        try {
+          fn(id);
+        } catch (...) {
+          std::unique_lock<std::mutex> last_except_lock(last_except_mutex);
+          last_exception = std::current_exception();
+          current = end;
+          break;
+        }
+      }
+    }));
+  }
+
+  for (auto& thread : threads) thread.join();
+
+  if (last_exception) std::rethrow_exception(last_exception);
+}
+
+// Borrows the float32 elements of a packed binary String or of an object exporting its memory through
+// the MemoryView protocol, such as Numo::SFloat, so that they can be read without conversion.
+// The elements stay readable without the GVL until release is called.
+class FloatBufferView {
+public:
+  FloatBufferView() : data_(nullptr), byte_size_(0), n_cols_(0), str_(Qnil), copy_(nullptr), has_view_(false) {}
+
+  // Returns false if the object is neither a String nor a row-major contiguous float32 buffer.
+  bool acquire(VALUE obj) {
+    const char* ptr = nullptr;
+    if (RB_TYPE_P(obj, T_STRING)) {
+      // The frozen string shares the buffer with the given string, and keeps the elements alive
+      // even if the given string is modified by another thread while the GVL is released.
+      str_ = rb_str_new_frozen(obj);
+      ptr = RSTRING_PTR(str_);
+      byte_size_ = (size_t)RSTRING_LEN(str_);
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+    } else if (rb_memory_view_available_p(obj)) {
+      memset(&view_, 0, sizeof(view_));
+      if (!rb_memory_view_get(obj, &view_, RUBY_MEMORY_VIEW_FORMAT | RUBY_MEMORY_VIEW_MULTI_DIMENSIONAL)) return false;
+      has_view_ = true;
+      if (view_.format == NULL || strcmp(view_.format, "f") != 0 || view_.item_size != sizeof(float) || view_.ndim > 2 ||
+          (view_.strides != NULL && !rb_memory_view_is_row_major_contiguous(&view_))) {
+        release();
+        return false;
+      }
+      ptr = (const char*)view_.data;
+      byte_size_ = (size_t)view_.byte_size;
+      n_cols_ = view_.ndim == 2 ? (size_t)view_.shape[1] : 0;
+#endif
+    } else {
+      return false;
+    }
+
+    if ((uintptr_t)ptr % alignof(float) != 0) {
+      copy_ = (float*)ruby_xmalloc(byte_size_);
+      memcpy(copy_, ptr, byte_size_);
+      data_ = copy_;
+    } else {
+      data_ = (const float*)ptr;
+    }
+    return true;
+  }
+
+  void release() {
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+    if (has_view_) rb_memory_view_release(&view_);
+#endif
+    if (copy_) ruby_xfree(copy_);
+    data_ = nullptr;
+    byte_size_ = 0;
+    n_cols_ = 0;
+    str_ = Qnil;
+    copy_ = nullptr;
+    has_view_ = false;
+  }
+
+  const float* data() const { return data_; }
+
+  // Returns true if the buffer holds a vector with the given number of elements.
+  bool is_vector(size_t dim) const { return byte_size_ == dim * sizeof(float) && (n_cols_ == 0 || n_cols_ == dim); }
+
+  // Returns true if the buffer holds a row-major matrix with the given number of columns.
+  bool is_matrix(size_t dim) const {
+    if (dim == 0) return byte_size_ == 0;
+    return byte_size_ % (dim * sizeof(float)) == 0 && (n_cols_ == 0 || n_cols_ == dim);
+  }
+
+  size_t n_rows(size_t dim) const { return dim == 0 ? 0 : byte_size_ / (dim * sizeof(float)); }
+
+private:
+  const float* data_;
+  size_t byte_size_;
+  size_t n_cols_;
+  VALUE str_;
+  float* copy_;
+  bool has_view_;
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+  rb_memory_view_t view_;
+#endif
+};
+
+// Runs a function on an index without the GVL, counting it in the active calls of the index so that the index is not
+// changed under it. rb_thread_call_without_gvl raises the interrupts of Thread#raise and Timeout.timeout after the
+// function returns, so the count is decremented, and the buffers of the call are freed, under rb_ensure.
+class IndexCall {
+public:
+  IndexCall(size_t& active_calls, FloatBufferView& buf) : active_calls_(active_calls), buf_(buf), n_buffers_(0) {}
+
+  // Frees the buffer allocated with ruby_xmalloc when the call ends. A null pointer is ignored.
+  void free_on_exit(void* ptr) {
+    if (ptr != nullptr && n_buffers_ < MAX_BUFFERS) buffers_[n_buffers_++] = ptr;
+  }
+
+  // Runs func(args), with the GVL held if with_gvl is true. If the call is interrupted, discard(args) frees
+  // the results that the caller does not read.
+  void run(void* (*func)(void*), void* args, bool with_gvl = false, void (*discard)(void*) = nullptr) {
+    func_ = func;
+    args_ = args;
+    with_gvl_ = with_gvl;
+    discard_ = discard;
+    finished_ = false;
+    active_calls_++;
+    rb_ensure(call, (VALUE)this, finish, (VALUE)this);
+  }
+
+private:
+  static const size_t MAX_BUFFERS = 4;
+
+  static VALUE call(VALUE self) {
+    IndexCall* c = (IndexCall*)self;
+    if (c->with_gvl_) {
+      c->func_(c->args_);
+    } else {
+      rb_thread_call_without_gvl(c->func_, c->args_, NULL, NULL);
+    }
+    c->finished_ = true;
+    return Qnil;
+  }
+
+  static VALUE finish(VALUE self) {
+    IndexCall* c = (IndexCall*)self;
+    c->active_calls_--;
+    for (size_t i = 0; i < c->n_buffers_; i++) ruby_xfree(c->buffers_[i]);
+    c->n_buffers_ = 0;
+    c->buf_.release();
+    if (!c->finished_ && c->discard_ != nullptr) c->discard_(c->args_);
+    return Qnil;
+  }
+
+  size_t& active_calls_;
+  FloatBufferView& buf_;
+  void* buffers_[MAX_BUFFERS];
+  size_t n_buffers_;
+  void* (*func_)(void*);
+  void* args_;
+  bool with_gvl_;
+  void (*discard_)(void*);
+  bool finished_;
+};
+
+struct TrainSpaceArgs {
+  hnswlib::SpaceInterface<float>* space;
+  VALUE self;
+  VALUE samples;
+  FloatBufferView* buf;
+  size_t dim;
+  size_t n_samples;
+  float* mat;
+  char error[256];
+};
+
+// Set on the space while it is trained, so that it is not trained by two threads at once.
+static ID id_training() { return rb_intern("__training__"); }
+
+static void* train_space_nogvl(void* ptr) {
+  TrainSpaceArgs* args = (TrainSpaceArgs*)ptr;
+  try {
+    args->space->train(args->mat ? args->mat : args->buf->data(), args->n_samples);
+  } catch (const std::exception& e) {
+    snprintf(args->error, sizeof(args->error), "%s", e.what());
+  }
+  return nullptr;
+}
+
+static VALUE train_space_body(VALUE ptr) {
+  TrainSpaceArgs* args = (TrainSpaceArgs*)ptr;
+  if (!NIL_P(args->samples)) {
+    // NUM2DBL can raise halfway through the copy, so the buffer is freed in train_space_ensure.
+    args->mat = (float*)ruby_xmalloc(args->n_samples * args->dim * sizeof(float));
+    for (size_t n = 0; n < args->n_samples; n++) {
+      VALUE arr = rb_ary_entry(args->samples, n);
+      for (size_t i = 0; i < args->dim; i++) args->mat[n * args->dim + i] = (float)NUM2DBL(rb_ary_entry(arr, i));
+    }
+  }
+  rb_thread_call_without_gvl(train_space_nogvl, args, NULL, NULL);
+  return Qnil;
+}
+
+static VALUE train_space_ensure(VALUE ptr) {
+  TrainSpaceArgs* args = (TrainSpaceArgs*)ptr;
+  if (args->mat) ruby_xfree(args->mat);
+  args->mat = nullptr;
+  args->buf->release();
+  rb_ivar_set(args->self, id_training(), Qfalse);
+  return Qnil;
+}
+
+// Learns the parameters of the space from the sample vectors given as Ruby Array, packed float32 String, or Numo::SFloat.
+// The learning, such as k-means of product quantization, runs without the GVL. A trained space may already encode
+// the vectors of an index, or be read by a search running without the GVL, so it cannot be trained again.
+static void train_space(VALUE self, hnswlib::SpaceInterface<float>* space, size_t dim, VALUE _mat) {
+  if (space->is_trained() || RTEST(rb_ivar_get(self, id_training()))) {
+    rb_raise(rb_eRuntimeError, "The space has already been trained.");
+    return;
+  }
+
+  FloatBufferView buf;
+  const bool is_array = RB_TYPE_P(_mat, T_ARRAY);
+  if (!is_array && !buf.acquire(_mat)) {
+    rb_raise(rb_eArgError, "Expect sample matrix to be Ruby Array, packed float32 String, or Numo::SFloat.");
+    return;
+  }
+  if (!is_array && !buf.is_matrix(dim)) {
+    buf.release();
+    rb_raise(rb_eArgError, "Buffer size does not match to space dimensionality.");
+    return;
+  }
+
+  const size_t n_samples = is_array ? RARRAY_LEN(_mat) : buf.n_rows(dim);
+  for (size_t n = 0; is_array && n < n_samples; n++) {
+    VALUE arr = rb_ary_entry(_mat, n);
+    if (!RB_TYPE_P(arr, T_ARRAY)) {
+      rb_raise(rb_eArgError, "Expect each sample vector to be Ruby Array.");
+      return;
+    }
+    if (dim != RARRAY_LEN(arr)) {
+      rb_raise(rb_eArgError, "Array size does not match to space dimensionality.");
+      return;
+    }
+  }
+  // A single sample has no spread, so that every vector would be encoded into the same code.
+  if (n_samples < 2) {
+    buf.release();
+    rb_raise(rb_eArgError, "Expect sample matrix to have at least two vectors.");
+    return;
+  }
+
+  TrainSpaceArgs args = {space, self, is_array ? _mat : Qnil, &buf, dim, n_samples, nullptr, ""};
+  rb_ivar_set(self, id_training(), Qtrue);
+  rb_ensure(train_space_body, (VALUE)&args, train_space_ensure, (VALUE)&args);
+
+  if (args.error[0] != '\0') rb_raise(rb_eRuntimeError, "%s", args.error);
+}
+
+class RbHnswlibL2SpaceSQ8 {
+public:
+  static VALUE hnsw_l2spacesq8_alloc(VALUE self) {
+    hnswlib::L2SpaceSQ8* ptr = (hnswlib::L2SpaceSQ8*)ruby_xmalloc(sizeof(hnswlib::L2SpaceSQ8));
+    new (ptr) hnswlib::L2SpaceSQ8(); // dummy call to constructor for GC.
+    return TypedData_Wrap_Struct(self, &hnsw_l2spacesq8_type, ptr);
+  };
+
+  static void hnsw_l2spacesq8_free(void* ptr) {
+    ((hnswlib::L2SpaceSQ8*)ptr)->~L2SpaceSQ8();
+    ruby_xfree(ptr);
+  };
+
+  static size_t hnsw_l2spacesq8_size(const void* ptr) { return sizeof(*((hnswlib::L2SpaceSQ8*)ptr)); };
+
+  static hnswlib::L2SpaceSQ8* get_hnsw_l2spacesq8(VALUE self) {
+    hnswlib::L2SpaceSQ8* ptr;
+    TypedData_Get_Struct(self, hnswlib::L2SpaceSQ8, &hnsw_l2spacesq8_type, ptr);
+    return ptr;
+  };
+
+  static VALUE define_class(VALUE outer) {
+    rb_cHnswlibL2SpaceSQ8 = rb_define_class_under(outer, "L2SpaceSQ8", rb_cObject);
+    rb_define_alloc_func(rb_cHnswlibL2SpaceSQ8, hnsw_l2spacesq8_alloc);
+    rb_define_method(rb_cHnswlibL2SpaceSQ8, "initialize", RUBY_METHOD_FUNC(_hnsw_l2spacesq8_init), 1);
+    rb_define_method(rb_cHnswlibL2SpaceSQ8, "train", RUBY_METHOD_FUNC(_hnsw_l2spacesq8_train), 1);
+    rb_define_method(rb_cHnswlibL2SpaceSQ8, "trained?", RUBY_METHOD_FUNC(_hnsw_l2spacesq8_trained), 0);
+    rb_define_method(rb_cHnswlibL2SpaceSQ8, "distance", RUBY_METHOD_FUNC(_hnsw_l2spacesq8_distance), 2);
+    rb_define_attr(rb_cHnswlibL2SpaceSQ8, "dim", 1, 0);
+    return rb_cHnswlibL2SpaceSQ8;
+  };
+
+private:
+  static const rb_data_type_t hnsw_l2spacesq8_type;
+
+  static VALUE _hnsw_l2spacesq8_init(VALUE self, VALUE dim) {
+    // The conversion can raise, so it is done before the placeholder space is destroyed.
+    const size_t n_dims = NUM2SIZET(dim);
+    rb_iv_set(self, "@dim", dim);
+    hnswlib::L2SpaceSQ8* ptr = get_hnsw_l2spacesq8(self);
+    ptr->~L2SpaceSQ8();
+    new (ptr) hnswlib::L2SpaceSQ8(n_dims);
+    return Qnil;
+  };
+
+  static VALUE _hnsw_l2spacesq8_train(VALUE self, VALUE _mat) {
+    train_space(self, get_hnsw_l2spacesq8(self), NUM2SIZET(rb_iv_get(self, "@dim")), _mat);
+    return self;
+  };
+
+  static VALUE _hnsw_l2spacesq8_trained(VALUE self) { return get_hnsw_l2spacesq8(self)->is_trained() ? Qtrue : Qfalse; };
+
+  static VALUE _hnsw_l2spacesq8_distance(VALUE self, VALUE arr_a, VALUE arr_b) {
+    const size_t dim = NUM2SIZET(rb_iv_get(self, "@dim"));
+    if (!RB_TYPE_P(arr_a, T_ARRAY) || !RB_TYPE_P(arr_b, T_ARRAY)) {
+      rb_raise(rb_eArgError, "Expect input vector to be Ruby Array.");
+      return Qnil;
+    }
+    if (dim != RARRAY_LEN(arr_a) || dim != RARRAY_LEN(arr_b)) {
+      rb_raise(rb_eArgError, "Array size does not match to space dimensionality.");
+      return Qnil;
+    }
+    hnswlib::L2SpaceSQ8* space = get_hnsw_l2spacesq8(self);
+    if (!space->is_trained()) {
+      rb_raise(rb_eRuntimeError, "The quantization space has not been trained yet.");
+      return Qnil;
+    }
+    float* vec = (float*)ruby_xmalloc(dim * sizeof(float));
+    uint8_t* code_a = (uint8_t*)ruby_xmalloc(dim);
+    uint8_t* code_b = (uint8_t*)ruby_xmalloc(dim);
+    for (size_t i = 0; i < dim; i++) vec[i] = (float)NUM2DBL(rb_ary_entry(arr_a, i));
+    space->encode(vec, code_a);
+    for (size_t i = 0; i < dim; i++) vec[i] = (float)NUM2DBL(rb_ary_entry(arr_b, i));
+    space->encode(vec, code_b);
+    hnswlib::DISTFUNC<float> dist_func = space->get_dist_func();
+    const float dist = dist_func(code_a, code_b, space->get_dist_func_param());
+    ruby_xfree(vec);
+    ruby_xfree(code_a);
+    ruby_xfree(code_b);
+    return DBL2NUM((double)dist);
+  };
+};
+
+// clang-format off
+const rb_data_type_t RbHnswlibL2SpaceSQ8::hnsw_l2spacesq8_type = {
+  "RbHnswlibL2SpaceSQ8",
+  {
+    NULL,
+    RbHnswlibL2SpaceSQ8::hnsw_l2spacesq8_free,
+    RbHnswlibL2SpaceSQ8::hnsw_l2spacesq8_size
+  },
+  NULL,
+  NULL,
+  RUBY_TYPED_FREE_IMMEDIATELY
+};
+// clang-format on
+
+class RbHnswlibL2SpacePQ {
+public:
+  static VALUE hnsw_l2spacepq_alloc(VALUE self) {
+    hnswlib::L2SpacePQ* ptr = (hnswlib::L2SpacePQ*)ruby_xmalloc(sizeof(hnswlib::L2SpacePQ));
+    new (ptr) hnswlib::L2SpacePQ(); // dummy call to constructor for GC.
+    return TypedData_Wrap_Struct(self, &hnsw_l2spacepq_type, ptr);
+  };
+
+  static void hnsw_l2spacepq_free(void* ptr) {
+    ((hnswlib::L2SpacePQ*)ptr)->~L2SpacePQ();
+    ruby_xfree(ptr);
+  };
+
+  static size_t hnsw_l2spacepq_size(const void* ptr) { return sizeof(*((hnswlib::L2SpacePQ*)ptr)); };
+
+  static hnswlib::L2SpacePQ* get_hnsw_l2spacepq(VALUE self) {
+    hnswlib::L2SpacePQ* ptr;
+    TypedData_Get_Struct(self, hnswlib::L2SpacePQ, &hnsw_l2spacepq_type, ptr);
+    return ptr;
+  };
+
+  static VALUE define_class(VALUE outer) {
+    rb_cHnswlibL2SpacePQ = rb_define_class_under(outer, "L2SpacePQ", rb_cObject);
+    rb_define_alloc_func(rb_cHnswlibL2SpacePQ, hnsw_l2spacepq_alloc);
+    rb_define_method(rb_cHnswlibL2SpacePQ, "initialize", RUBY_METHOD_FUNC(_hnsw_l2spacepq_init), 2);
+    rb_define_method(rb_cHnswlibL2SpacePQ, "train", RUBY_METHOD_FUNC(_hnsw_l2spacepq_train), 1);
+    rb_define_method(rb_cHnswlibL2SpacePQ, "trained?", RUBY_METHOD_FUNC(_hnsw_l2spacepq_trained), 0);
+    rb_define_method(rb_cHnswlibL2SpacePQ, "distance", RUBY_METHOD_FUNC(_hnsw_l2spacepq_distance), 2);
+    rb_define_attr(rb_cHnswlibL2SpacePQ, "dim", 1, 0);
+    rb_define_attr(rb_cHnswlibL2SpacePQ, "n_subvectors", 1, 0);
+    return rb_cHnswlibL2SpacePQ;
+  };
+
+private:
+  static const rb_data_type_t hnsw_l2spacepq_type;
+
+  static VALUE _hnsw_l2spacepq_init(VALUE self, VALUE dim, VALUE n_subvectors) {
+    if (!RB_INTEGER_TYPE_P(dim) || !RB_INTEGER_TYPE_P(n_subvectors)) {
+      rb_raise(rb_eTypeError, "expected dim and n_subvectors, Integer");
+      return Qnil;
+    }
+    if (NUM2SIZET(n_subvectors) == 0 || NUM2SIZET(dim) % NUM2SIZET(n_subvectors) != 0) {
+      rb_raise(rb_eArgError, "Expect dim to be divisible by n_subvectors.");
+      return Qnil;
+    }
+    rb_iv_set(self, "@dim", dim);
+    rb_iv_set(self, "@n_subvectors", n_subvectors);
+    hnswlib::L2SpacePQ* ptr = get_hnsw_l2spacepq(self);
+    ptr->~L2SpacePQ();
+    new (ptr) hnswlib::L2SpacePQ(NUM2SIZET(dim), NUM2SIZET(n_subvectors));
+    return Qnil;
+  };
+
+  static VALUE _hnsw_l2spacepq_train(VALUE self, VALUE _mat) {
+    train_space(self, get_hnsw_l2spacepq(self), NUM2SIZET(rb_iv_get(self, "@dim")), _mat);
+    return self;
+  };
+
+  static VALUE _hnsw_l2spacepq_trained(VALUE self) { return get_hnsw_l2spacepq(self)->is_trained() ? Qtrue : Qfalse; };
+
+  static VALUE _hnsw_l2spacepq_distance(VALUE self, VALUE arr_a, VALUE arr_b) {
+    const size_t dim = NUM2SIZET(rb_iv_get(self, "@dim"));
+    if (!RB_TYPE_P(arr_a, T_ARRAY) || !RB_TYPE_P(arr_b, T_ARRAY)) {
+      rb_raise(rb_eArgError, "Expect input vector to be Ruby Array.");
+      return Qnil;
+    }
+    if (dim != RARRAY_LEN(arr_a) || dim != RARRAY_LEN(arr_b)) {
+      rb_raise(rb_eArgError, "Array size does not match to space dimensionality.");
+      return Qnil;
+    }
+    hnswlib::L2SpacePQ* space = get_hnsw_l2spacepq(self);
+    if (!space->is_trained()) {
+      rb_raise(rb_eRuntimeError, "The quantization space has not been trained yet.");
+      return Qnil;
+    }
+    // The first vector is treated as a query, and the second one is quantized.
+    float* vec = (float*)ruby_xmalloc(dim * sizeof(float));
+    float* lut = (float*)ruby_xmalloc(space->get_query_size());
+    uint8_t* code = (uint8_t*)ruby_xmalloc(space->get_data_size());
+    for (size_t i = 0; i < dim; i++) vec[i] = (float)NUM2DBL(rb_ary_entry(arr_a, i));
+    space->encode_query(vec, lut);
+    for (size_t i = 0; i < dim; i++) vec[i] = (float)NUM2DBL(rb_ary_entry(arr_b, i));
+    space->encode(vec, code);
+    hnswlib::DISTFUNC<float> dist_func = space->get_query_dist_func();
+    const float dist = dist_func(lut, code, space->get_dist_func_param());
+    ruby_xfree(vec);
+    ruby_xfree(lut);
+    ruby_xfree(code);
+    return DBL2NUM((double)dist);
+  };
+};
+
+// clang-format off
+const rb_data_type_t RbHnswlibL2SpacePQ::hnsw_l2spacepq_type = {
+  "RbHnswlibL2SpacePQ",
+  {
+    NULL,
+    RbHnswlibL2SpacePQ::hnsw_l2spacepq_free,
+    RbHnswlibL2SpacePQ::hnsw_l2spacepq_size
+  },
+  NULL,
+  NULL,
+  RUBY_TYPED_FREE_IMMEDIATELY
+};
+// clang-format on
+
+// Returns the hnswlib space wrapped by the given space object.
+static hnswlib::SpaceInterface<float>* get_hnsw_space(VALUE space) {
+  if (rb_obj_is_instance_of(space, rb_cHnswlibL2Space)) return RbHnswlibL2Space::get_hnsw_l2space(space);
+  if (rb_obj_is_instance_of(space, rb_cHnswlibInnerProductSpace)) return RbHnswlibInnerProductSpace::get_hnsw_ipspace(space);
+  if (rb_obj_is_instance_of(space, rb_cHnswlibCosineSpace)) return RbHnswlibCosineSpace::get_hnsw_cosinespace(space);
+  if (rb_obj_is_instance_of(space, rb_cHnswlibHammingSpace)) return RbHnswlibHammingSpace::get_hnsw_hammingspace(space);
+  if (rb_obj_is_instance_of(space, rb_cHnswlibL2SpaceSQ8)) return RbHnswlibL2SpaceSQ8::get_hnsw_l2spacesq8(space);
+  if (rb_obj_is_instance_of(space, rb_cHnswlibL2SpacePQ)) return RbHnswlibL2SpacePQ::get_hnsw_l2spacepq(space);
+  return RbHnswlibHalfSpaceBase::get_hnsw_halfspace(space);
+}
+
+// Creates the space object for the given space name, such as 'l2', 'cosine', 'ip_fp16', 'l2_pq16', or 'hamming'.
+// Returns Qnil for unknown names.
+static VALUE create_space(VALUE name, VALUE dim) {
+  const std::string space_name(StringValueCStr(name));
+  if (space_name == "hamming") return rb_funcall(rb_cHnswlibHammingSpace, rb_intern("new"), 1, dim);
+  const size_t sep = space_name.find('_');
+  const std::string metric = space_name.substr(0, sep);
+  const std::string format = sep == std::string::npos ? "" : space_name.substr(sep + 1);
+  if (metric != "l2" && metric != "ip" && metric != "cosine") return Qnil;
+  if ((format == "sq8" || format.compare(0, 2, "pq") == 0) && metric != "l2") return Qnil;
+
+  const char* class_name;
+  if (format.empty()) {
+    class_name = metric == "l2" ? "L2Space" : metric == "ip" ? "InnerProductSpace" : "CosineSpace";
+  } else if (format == "fp16") {
+    class_name = metric == "l2" ? "L2SpaceFp16" : metric == "ip" ? "InnerProductSpaceFp16" : "CosineSpaceFp16";
+  } else if (format == "bf16") {
+    class_name = metric == "l2" ? "L2SpaceBf16" : metric == "ip" ? "InnerProductSpaceBf16" : "CosineSpaceBf16";
+  } else if (format == "sq8") {
+    class_name = "L2SpaceSQ8";
+  } else if (format.size() > 2 && format.compare(0, 2, "pq") == 0 &&
+             format.find_first_not_of("0123456789", 2) == std::string::npos) {
+    // The number following 'pq' is the number of sub-vectors.
+    VALUE n_subvectors = rb_cstr2inum(format.c_str() + 2, 10);
+    if (NUM2SIZET(n_subvectors) == 0 || NUM2SIZET(dim) % NUM2SIZET(n_subvectors) != 0) return Qnil;
+    return rb_funcall(rb_cHnswlibL2SpacePQ, rb_intern("new"), 2, dim, n_subvectors);
+  } else {
+    return Qnil;
+  }
+  return rb_funcall(rb_const_get(rb_mHnswlib, rb_intern(class_name)), rb_intern("new"), 1, dim);
+}
+
+// Converts the float vectors into the storage format of the space. Returns nullptr, without converting,
+// if the space stores the float vectors as they are. The returned buffer must be freed with ruby_xfree.
+static char* encode_vectors(hnswlib::SpaceInterface<float>* space, const float* mat, size_t n_vectors, size_t dim) {
+  if (!space->is_encoded()) return nullptr;
+  const size_t data_size = space->get_data_size();
+  char* codes = (char*)ruby_xmalloc(n_vectors * data_size);
+  for (size_t n = 0; n < n_vectors; n++) space->encode(mat + n * dim, codes + n * data_size);
+  return codes;
+}
+
+// Converts the float query vectors into the format given to the search methods, which has
+// space->get_query_size() bytes per query. Returns nullptr in the same way as encode_vectors.
+static char* encode_queries(hnswlib::SpaceInterface<float>* space, const float* mat, size_t n_queries, size_t dim) {
+  if (!space->is_encoded()) return nullptr;
+  const size_t query_size = space->get_query_size();
+  char* queries = (char*)ruby_xmalloc(n_queries * query_size);
+  for (size_t n = 0; n < n_queries; n++) space->encode_query(mat + n * dim, queries + n * query_size);
+  return queries;
+}
+
+// Returns true if the space stores vectors in a format smaller than the float array.
+// The binary codes of the hamming space are not an approximation of float vectors, so it is not regarded as compressed.
+static bool is_compressed_space(VALUE space) {
+  if (rb_obj_is_instance_of(space, rb_cHnswlibHammingSpace)) return false;
+  return get_hnsw_space(space)->get_data_size() < NUM2SIZET(rb_iv_get(space, "@dim")) * sizeof(float);
+}
+
+// Creates the full precision space with the same metric as the given compressed space,
+// which is used to re-rank the search results found on compressed vectors.
+static VALUE create_rerank_space(VALUE space) {
+  VALUE klass = rb_cHnswlibInnerProductSpace;
+  if (rb_obj_is_instance_of(space, rb_cHnswlibL2SpaceSQ8) || rb_obj_is_instance_of(space, rb_cHnswlibL2SpacePQ) ||
+      rb_obj_is_instance_of(space, rb_cHnswlibL2SpaceFp16) || rb_obj_is_instance_of(space, rb_cHnswlibL2SpaceBf16)) {
+    klass = rb_cHnswlibL2Space;
+  } else if (rb_obj_is_instance_of(space, rb_cHnswlibCosineSpaceFp16) || rb_obj_is_instance_of(space, rb_cHnswlibCosineSpaceBf16)) {
+    klass = rb_cHnswlibCosineSpace;
+  }
+  return rb_funcall(klass, rb_intern("new"), 1, rb_iv_get(space, "@dim"));
+}
+
+// Converts the float vectors into the format of the re-ranking space, such as normalized vectors for cosine.
+// Returns nullptr if re-ranking is disabled or the vectors are used as they are.
+static char* encode_rerank_vectors(VALUE rerank_space, const float* mat, size_t n_vectors, size_t dim) {
+  if (NIL_P(rerank_space)) return nullptr;
+  return encode_vectors(get_hnsw_space(rerank_space), mat, n_vectors, dim);
+}
+
+// Raises RuntimeError if the space has to learn its parameters from data before vectors are encoded.
+static void check_space_trained(VALUE space) {
+  if (!get_hnsw_space(space)->is_trained()) {
+    rb_raise(rb_eRuntimeError, "The quantization space has not been trained yet. Call train on the space with sample vectors.");
+  }
+}
+
+// Calls the given Ruby callable for each candidate. If the callable raises, the search is stopped by a C++ exception
+// so that it unwinds normally, and the caller re-raises the Ruby exception with rb_jump_tag(state()) afterwards.
 class CustomFilterFunctor : public hnswlib::BaseFilterFunctor {
 public:
-  CustomFilterFunctor(const VALUE& callback) : callback_(callback) {}
+  CustomFilterFunctor(const VALUE& callback) : callback_(callback), state_(0) {}
 
   bool operator()(hnswlib::labeltype id) {
-    VALUE result = rb_funcall(callback_, rb_intern("call"), 1, SIZET2NUM(id));
+    CallArgs args = {callback_, id};
+    VALUE result = rb_protect(call, (VALUE)&args, &state_);
+    if (state_ != 0) throw std::runtime_error("The filter function raised an exception.");
     return result == Qtrue ? true : false;
   }
 
+  int state() const { return state_; }
+
 private:
+  struct CallArgs {
+    VALUE callback;
+    hnswlib::labeltype id;
+  };
+
+  static VALUE call(VALUE ptr) {
+    CallArgs* args = (CallArgs*)ptr;
+    return rb_funcall(args->callback, rb_intern("call"), 1, SIZET2NUM(args->id));
+  }
+
   VALUE callback_;
+  int state_;
+};
+
+// Filters search results by a fixed set of labels without calling back into Ruby,
+// so that it can be used while the GVL is released.
+class LabelFilterFunctor : public hnswlib::BaseFilterFunctor {
+public:
+  LabelFilterFunctor() : n_labels_(0), deny_(false), use_bitmap_(false) {}
+
+  LabelFilterFunctor(const std::vector<hnswlib::labeltype>& labels, bool deny)
+      : n_labels_(0), deny_(deny), use_bitmap_(false) {
+    hnswlib::labeltype max_label = 0;
+    for (const hnswlib::labeltype label : labels) max_label = std::max(max_label, label);
+    // A bitmap is used when it is not much larger than a hash set of the same labels.
+    const size_t n_words = max_label / 64 + 1;
+    use_bitmap_ = n_words <= labels.size() * 2;
+    if (use_bitmap_) {
+      bitmap_.assign(n_words, 0);
+      for (const hnswlib::labeltype label : labels) {
+        if (!(bitmap_[label / 64] & (1ULL << (label % 64)))) n_labels_++;
+        bitmap_[label / 64] |= 1ULL << (label % 64);
+      }
+    } else {
+      labels_.insert(labels.begin(), labels.end());
+      n_labels_ = labels_.size();
+    }
+  }
+
+  bool operator()(hnswlib::labeltype id) {
+    bool found;
+    if (use_bitmap_) {
+      found = id / 64 < bitmap_.size() && (bitmap_[id / 64] & (1ULL << (id % 64)));
+    } else {
+      found = labels_.find(id) != labels_.end();
+    }
+    return found != deny_;
+  }
+
+  size_t size() const { return n_labels_; }
+
+  bool deny() const { return deny_; }
+
+private:
+  std::vector<uint64_t> bitmap_;
+  std::unordered_set<hnswlib::labeltype> labels_;
+  size_t n_labels_;
+  bool deny_;
+  bool use_bitmap_;
 };
 
+class RbHnswlibLabelFilter {
+public:
+  static VALUE hnsw_labelfilter_alloc(VALUE self) {
+    LabelFilterFunctor* ptr = (LabelFilterFunctor*)ruby_xmalloc(sizeof(LabelFilterFunctor));
+    new (ptr) LabelFilterFunctor(); // dummy call to constructor for GC.
+    return TypedData_Wrap_Struct(self, &hnsw_labelfilter_type, ptr);
+  };
+
+  static void hnsw_labelfilter_free(void* ptr) {
+    ((LabelFilterFunctor*)ptr)->~LabelFilterFunctor();
+    ruby_xfree(ptr);
+  };
+
+  static size_t hnsw_labelfilter_size(const void* ptr) { return sizeof(*((LabelFilterFunctor*)ptr)); };
+
+  static LabelFilterFunctor* get_hnsw_labelfilter(VALUE self) {
+    LabelFilterFunctor* ptr;
+    TypedData_Get_Struct(self, LabelFilterFunctor, &hnsw_labelfilter_type, ptr);
+    return ptr;
+  };
+
+  static VALUE define_class(VALUE outer) {
+    rb_cHnswlibLabelFilter = rb_define_class_under(outer, "LabelFilter", rb_cObject);
+    rb_define_alloc_func(rb_cHnswlibLabelFilter, hnsw_labelfilter_alloc);
+    rb_define_method(rb_cHnswlibLabelFilter, "initialize", RUBY_METHOD_FUNC(_hnsw_labelfilter_init), -1);
+    rb_define_method(rb_cHnswlibLabelFilter, "size", RUBY_METHOD_FUNC(_hnsw_labelfilter_size), 0);
+    rb_define_method(rb_cHnswlibLabelFilter, "deny?", RUBY_METHOD_FUNC(_hnsw_labelfilter_deny), 0);
+    return rb_cHnswlibLabelFilter;
+  };
+
+private:
+  static const rb_data_type_t hnsw_labelfilter_type;
+
+  static VALUE _hnsw_labelfilter_init(int argc, VALUE* argv, VALUE self) {
+    VALUE _labels, _deny;
+    VALUE kw_args = Qnil;
+    ID kw_table[1] = {rb_intern("deny")};
+    VALUE kw_values[1] = {Qundef};
+
+    rb_scan_args(argc, argv, "1:", &_labels, &kw_args);
+    rb_get_kwargs(kw_args, kw_table, 0, 1, kw_values);
+    _deny = kw_values[0] != Qundef ? kw_values[0] : Qfalse;
+
+    if (!RB_TYPE_P(_labels, T_ARRAY) && rb_respond_to(_labels, rb_intern("to_a"))) {
+      _labels = rb_funcall(_labels, rb_intern("to_a"), 0);
+    }
+    if (!RB_TYPE_P(_labels, T_ARRAY)) {
+      rb_raise(rb_eArgError, "Expect labels to be Ruby Array or Set.");
+      return Qnil;
+    }
+    if (!RB_TYPE_P(_deny, T_TRUE) && !RB_TYPE_P(_deny, T_FALSE)) {
+      rb_raise(rb_eArgError, "Expect deny to be Boolean.");
+      return Qnil;
+    }
+
+    const size_t n_labels = RARRAY_LEN(_labels);
+    std::vector<hnswlib::labeltype> labels(n_labels);
+    for (size_t i = 0; i < n_labels; i++) {
+      VALUE label = rb_ary_entry(_labels, i);
+      if (!RB_INTEGER_TYPE_P(label)) {
+        rb_raise(rb_eArgError, "Expect each label to be Ruby Integer.");
+        return Qnil;
+      }
+      labels[i] = (hnswlib::labeltype)NUM2SIZET(label);
+    }
+
+    LabelFilterFunctor* ptr = get_hnsw_labelfilter(self);
+    ptr->~LabelFilterFunctor();
+    new (ptr) LabelFilterFunctor(labels, _deny == Qtrue ? true : false);
+    return Qnil;
+  };
+
+  static VALUE _hnsw_labelfilter_size(VALUE self) { return SIZET2NUM(get_hnsw_labelfilter(self)->size()); };
+
+  static VALUE _hnsw_labelfilter_deny(VALUE self) { return get_hnsw_labelfilter(self)->deny() ? Qtrue : Qfalse; };
+};
+
+// clang-format off
+const rb_data_type_t RbHnswlibLabelFilter::hnsw_labelfilter_type = {
+  "RbHnswlibLabelFilter",
+  {
+    NULL,
+    RbHnswlibLabelFilter::hnsw_labelfilter_free,
+    RbHnswlibLabelFilter::hnsw_labelfilter_size
+  },
+  NULL,
+  NULL,
+  RUBY_TYPED_FREE_IMMEDIATELY
+};
+// clang-format on
+
 class RbHnswlibHierarchicalNSW {
 public:
   static VALUE hnsw_hierarchicalnsw_alloc(VALUE self) {
@@ -226,14 +1250,20 @@ public:
     rb_define_method(rb_cHnswlibHierarchicalNSW, "initialize", RUBY_METHOD_FUNC(_hnsw_hierarchicalnsw_initialize), -1);
     rb_define_method(rb_cHnswlibHierarchicalNSW, "init_index", RUBY_METHOD_FUNC(_hnsw_hierarchicalnsw_init_index), -1);
     rb_define_method(rb_cHnswlibHierarchicalNSW, "add_point", RUBY_METHOD_FUNC(_hnsw_hierarchicalnsw_add_point), -1);
+    rb_define_method(rb_cHnswlibHierarchicalNSW, "add_items", RUBY_METHOD_FUNC(_hnsw_hierarchicalnsw_add_items), -1);
     rb_define_method(rb_cHnswlibHierarchicalNSW, "search_knn", RUBY_METHOD_FUNC(_hnsw_hierarchicalnsw_search_knn), -1);
-    rb_define_method(rb_cHnswlibHierarchicalNSW, "save_index", RUBY_METHOD_FUNC(_hnsw_hierarchicalnsw_save_index), 1);
+    rb_define_method(rb_cHnswlibHierarchicalNSW, "search_knn_batch", RUBY_METHOD_FUNC(_hnsw_hierarchicalnsw_search_knn_batch),
+                     -1);
+    rb_define_method(rb_cHnswlibHierarchicalNSW, "save_index", RUBY_METHOD_FUNC(_hnsw_hierarchicalnsw_save_index), -1);
     rb_define_method(rb_cHnswlibHierarchicalNSW, "load_index", RUBY_METHOD_FUNC(_hnsw_hierarchicalnsw_load_index), -1);
     rb_define_method(rb_cHnswlibHierarchicalNSW, "get_point", RUBY_METHOD_FUNC(_hnsw_hierarchicalnsw_get_point), 1);
     rb_define_method(rb_cHnswlibHierarchicalNSW, "get_ids", RUBY_METHOD_FUNC(_hnsw_hierarchicalnsw_get_ids), 0);
     rb_define_method(rb_cHnswlibHierarchicalNSW, "mark_deleted", RUBY_METHOD_FUNC(_hnsw_hierarchicalnsw_mark_deleted), 1);
     rb_define_method(rb_cHnswlibHierarchicalNSW, "unmark_deleted", RUBY_METHOD_FUNC(_hnsw_hierarchicalnsw_unmark_deleted), 1);
     rb_define_method(rb_cHnswlibHierarchicalNSW, "resize_index", RUBY_METHOD_FUNC(_hnsw_hierarchicalnsw_resize_index), 1);
+    rb_define_method(rb_cHnswlibHierarchicalNSW, "reorder!", RUBY_METHOD_FUNC(_hnsw_hierarchicalnsw_reorder), 0);
+    rb_define_method(rb_cHnswlibHierarchicalNSW, "set_read_only", RUBY_METHOD_FUNC(_hnsw_hierarchicalnsw_set_read_only), 1);
+    rb_define_method(rb_cHnswlibHierarchicalNSW, "read_only?", RUBY_METHOD_FUNC(_hnsw_hierarchicalnsw_is_read_only), 0);
     rb_define_method(rb_cHnswlibHierarchicalNSW, "set_ef", RUBY_METHOD_FUNC(_hnsw_hierarchicalnsw_set_ef), 1);
     rb_define_method(rb_cHnswlibHierarchicalNSW, "get_ef", RUBY_METHOD_FUNC(_hnsw_hierarchicalnsw_get_ef), 0);
     rb_define_method(rb_cHnswlibHierarchicalNSW, "max_elements", RUBY_METHOD_FUNC(_hnsw_hierarchicalnsw_max_elements), 0);
@@ -244,8 +1274,124 @@ public:
     return rb_cHnswlibHierarchicalNSW;
   };
 
-private:
-  static const rb_data_type_t hnsw_hierarchicalnsw_type;
+private:
+  static const rb_data_type_t hnsw_hierarchicalnsw_type;
+
+  // Raises RuntimeError if a search or an insertion of another thread is using the index, because the operation
+  // would free or reallocate the structures it reads.
+  static void check_index_idle(VALUE self) {
+    if (get_hnsw_hierarchicalnsw(self)->active_calls_ > 0) {
+      rb_raise(rb_eRuntimeError, "The index cannot be changed while another thread is searching or adding items.");
+    }
+  };
+
+  struct AddPointArgs {
+    hnswlib::HierarchicalNSW<float>* index;
+    const void* vec;
+    const float* rerank_vec;
+    size_t idx;
+    bool replace_deleted;
+    char error[256];
+  };
+
+  struct AddItemsArgs {
+    hnswlib::HierarchicalNSW<float>* index;
+    const char* mat;
+    const float* rerank_mat;
+    const size_t* labels;
+    size_t n_items;
+    size_t row_size;
+    size_t dim;
+    size_t num_threads;
+    bool replace_deleted;
+    char error[256];
+  };
+
+  struct SearchKnnArgs {
+    hnswlib::HierarchicalNSW<float>* index;
+    const void* vec;
+    const float* rerank_vec;
+    size_t k;
+    hnswlib::BaseFilterFunctor* filter_func;
+    std::priority_queue<std::pair<float, size_t>> result;
+    char error[256];
+  };
+
+  static void* _hnsw_hierarchicalnsw_add_point_nogvl(void* ptr) {
+    AddPointArgs* args = (AddPointArgs*)ptr;
+    try {
+      args->index->addPoint((const void*)args->vec, (const void*)args->rerank_vec, args->idx, args->replace_deleted);
+    } catch (const std::exception& e) {
+      snprintf(args->error, sizeof(args->error), "%s", e.what());
+    }
+    return nullptr;
+  };
+
+  struct SearchKnnBatchArgs {
+    hnswlib::HierarchicalNSW<float>* index;
+    const char* mat;
+    const float* rerank_mat;
+    size_t n_queries;
+    size_t row_size;
+    size_t dim;
+    size_t k;
+    size_t num_threads;
+    uint64_t* labels;
+    float* distances;
+    char error[256];
+  };
+
+  static void* _hnsw_hierarchicalnsw_add_items_nogvl(void* ptr) {
+    AddItemsArgs* args = (AddItemsArgs*)ptr;
+    try {
+      ParallelFor(0, args->n_items, args->num_threads, [&](size_t row) {
+        args->index->addPoint((const void*)(args->mat + row * args->row_size), (const void*)(args->rerank_mat + row * args->dim),
+                              args->labels[row], args->replace_deleted);
+      });
+    } catch (const std::exception& e) {
+      snprintf(args->error, sizeof(args->error), "%s", e.what());
+    }
+    return nullptr;
+  };
+
+  static void* _hnsw_hierarchicalnsw_search_knn_batch_nogvl(void* ptr) {
+    SearchKnnBatchArgs* args = (SearchKnnBatchArgs*)ptr;
+    try {
+      ParallelFor(0, args->n_queries, args->num_threads, [&](size_t row) {
+        std::priority_queue<std::pair<float, size_t>> result =
+            args->index->searchKnnReranked((const void*)(args->mat + row * args->row_size),
+                                           (const void*)(args->rerank_mat + row * args->dim), args->k);
+        if (result.size() != args->k) {
+          throw std::runtime_error(
+              "Cannot return the results in a contiguous 2D array. Probably ef or M is too small.");
+        }
+        for (size_t i = args->k; i-- > 0;) {
+          const std::pair<float, size_t>& result_tuple = result.top();
+          args->labels[row * args->k + i] = (uint64_t)result_tuple.second;
+          args->distances[row * args->k + i] = result_tuple.first;
+          result.pop();
+        }
+      });
+    } catch (const std::exception& e) {
+      snprintf(args->error, sizeof(args->error), "%s", e.what());
+    }
+    return nullptr;
+  };
+
+  static void* _hnsw_hierarchicalnsw_search_knn_nogvl(void* ptr) {
+    SearchKnnArgs* args = (SearchKnnArgs*)ptr;
+    try {
+      args->result = args->index->searchKnnReranked(args->vec, args->rerank_vec, args->k, args->filter_func);
+    } catch (const std::exception& e) {
+      snprintf(args->error, sizeof(args->error), "%s", e.what());
+    }
+    return nullptr;
+  };
+
+  // Frees the results of an interrupted search, since the arguments on the stack are not destructed.
+  static void _hnsw_hierarchicalnsw_search_knn_discard(void* ptr) {
+    std::priority_queue<std::pair<float, size_t>>().swap(((SearchKnnArgs*)ptr)->result);
+  };
 
   static VALUE _hnsw_hierarchicalnsw_initialize(int argc, VALUE* argv, VALUE self) {
     VALUE kw_args = Qnil;
@@ -258,40 +1404,35 @@ private:
       rb_raise(rb_eTypeError, "expected space, String");
       return Qnil;
     }
-    if (strcmp(StringValueCStr(kw_values[0]), "l2") != 0 && strcmp(StringValueCStr(kw_values[0]), "ip") != 0 &&
-        strcmp(StringValueCStr(kw_values[0]), "cosine") != 0) {
-      rb_raise(rb_eArgError, "expected space, 'l2', 'ip', or 'cosine' only");
-      return Qnil;
-    }
     if (!RB_INTEGER_TYPE_P(kw_values[1])) {
       rb_raise(rb_eTypeError, "expected dim, Integer");
       return Qnil;
     }
 
-    if (strcmp(StringValueCStr(kw_values[0]), "l2") == 0) {
-      rb_iv_set(self, "@space", rb_funcall(rb_const_get(rb_mHnswlib, rb_intern("L2Space")), rb_intern("new"), 1, kw_values[1]));
-    } else {
-      rb_iv_set(self, "@space",
-                rb_funcall(rb_const_get(rb_mHnswlib, rb_intern("InnerProductSpace")), rb_intern("new"), 1, kw_values[1]));
+    VALUE space = create_space(kw_values[0], kw_values[1]);
+    if (NIL_P(space)) {
+      rb_raise(rb_eArgError, "expected space, 'l2', 'ip', or 'cosine' only, optionally suffixed with '_fp16' or '_bf16', or 'l2_sq8' or 'l2_pq<n_subvectors>' or 'hamming'");
+      return Qnil;
     }
-
-    rb_iv_set(self, "@normalize", Qfalse);
-    if (strcmp(StringValueCStr(kw_values[0]), "cosine") == 0) rb_iv_set(self, "@normalize", Qtrue);
+    rb_iv_set(self, "@space", space);
 
     return Qnil;
   };
 
   static VALUE _hnsw_hierarchicalnsw_init_index(int argc, VALUE* argv, VALUE self) {
     VALUE kw_args = Qnil;
-    ID kw_table[5] = {rb_intern("max_elements"), rb_intern("m"), rb_intern("ef_construction"), rb_intern("random_seed"),
-                      rb_intern("allow_replace_deleted")};
-    VALUE kw_values[5] = {Qundef, Qundef, Qundef, Qundef, Qundef};
+    ID kw_table[8] = {rb_intern("max_elements"), rb_intern("m"), rb_intern("ef_construction"), rb_intern("random_seed"),
+                      rb_intern("allow_replace_deleted"), rb_intern("rerank"), rb_intern("split_layout"), rb_intern("huge_pages")};
+    VALUE kw_values[8] = {Qundef, Qundef, Qundef, Qundef, Qundef, Qundef, Qundef, Qundef};
     rb_scan_args(argc, argv, ":", &kw_args);
-    rb_get_kwargs(kw_args, kw_table, 1, 4, kw_values);
+    rb_get_kwargs(kw_args, kw_table, 1, 7, kw_values);
     if (kw_values[1] == Qundef) kw_values[1] = SIZET2NUM(16);
     if (kw_values[2] == Qundef) kw_values[2] = SIZET2NUM(200);
     if (kw_values[3] == Qundef) kw_values[3] = SIZET2NUM(100);
     if (kw_values[4] == Qundef) kw_values[4] = Qfalse;
+    if (kw_values[5] == Qundef) kw_values[5] = Qfalse;
+    if (kw_values[6] == Qundef) kw_values[6] = Qfalse;
+    if (kw_values[7] == Qundef) kw_values[7] = Qfalse;
 
     if (!RB_INTEGER_TYPE_P(kw_values[0])) {
       rb_raise(rb_eTypeError, "expected max_elements, Integer");
@@ -313,25 +1454,42 @@ private:
       rb_raise(rb_eTypeError, "expected allow_replace_deleted, Boolean");
       return Qnil;
     }
+    if (!RB_TYPE_P(kw_values[5], T_TRUE) && !RB_TYPE_P(kw_values[5], T_FALSE)) {
+      rb_raise(rb_eTypeError, "expected rerank, Boolean");
+      return Qnil;
+    }
+    if (!RB_TYPE_P(kw_values[6], T_TRUE) && !RB_TYPE_P(kw_values[6], T_FALSE)) {
+      rb_raise(rb_eTypeError, "expected split_layout, Boolean");
+      return Qnil;
+    }
+    if (!RB_TYPE_P(kw_values[7], T_TRUE) && !RB_TYPE_P(kw_values[7], T_FALSE)) {
+      rb_raise(rb_eTypeError, "expected huge_pages, Boolean");
+      return Qnil;
+    }
 
-    hnswlib::SpaceInterface<float>* space = nullptr;
-    VALUE ivspace = rb_iv_get(self, "@space");
-    if (rb_obj_is_instance_of(ivspace, rb_cHnswlibL2Space)) {
-      space = RbHnswlibL2Space::get_hnsw_l2space(ivspace);
-    } else {
-      space = RbHnswlibInnerProductSpace::get_hnsw_ipspace(ivspace);
+    check_index_idle(self);
+    hnswlib::SpaceInterface<float>* space = get_hnsw_space(rb_iv_get(self, "@space"));
+    if (kw_values[5] == Qtrue && !is_compressed_space(rb_iv_get(self, "@space"))) {
+      rb_raise(rb_eArgError, "rerank is available only for the compressed spaces such as 'l2_fp16' or 'l2_sq8'.");
+      return Qnil;
     }
+    VALUE rerank_space = kw_values[5] == Qtrue ? create_rerank_space(rb_iv_get(self, "@space")) : Qnil;
+    rb_iv_set(self, "@rerank_space", rerank_space);
 
     const size_t max_elements = NUM2SIZET(kw_values[0]);
     const size_t m = NUM2SIZET(kw_values[1]);
     const size_t ef_construction = NUM2SIZET(kw_values[2]);
     const size_t random_seed = NUM2SIZET(kw_values[3]);
     const bool allow_replace_deleted = kw_values[4] == Qtrue ? true : false;
+    const bool split_layout = kw_values[6] == Qtrue ? true : false;
+    const bool huge_pages = kw_values[7] == Qtrue ? true : false;
 
     hnswlib::HierarchicalNSW<float>* ptr = get_hnsw_hierarchicalnsw(self);
     try {
       ptr->~HierarchicalNSW();
-      new (ptr) hnswlib::HierarchicalNSW<float>(space, max_elements, m, ef_construction, random_seed, allow_replace_deleted);
+      new (ptr) hnswlib::HierarchicalNSW<float>(space, max_elements, m, ef_construction, random_seed, allow_replace_deleted,
+                                                split_layout, huge_pages);
+      if (!NIL_P(rerank_space)) ptr->enableRerank(get_hnsw_space(rerank_space));
     } catch (const std::runtime_error& e) {
       rb_raise(rb_eRuntimeError, "%s", e.what());
       return Qnil;
@@ -351,122 +1509,303 @@ private:
     _replace_deleted = kw_values[0] != Qundef ? kw_values[0] : Qfalse;
 
     const size_t dim = NUM2SIZET(rb_iv_get(rb_iv_get(self, "@space"), "@dim"));
+    check_space_trained(rb_iv_get(self, "@space"));
 
-    if (!RB_TYPE_P(_arr, T_ARRAY)) {
-      rb_raise(rb_eArgError, "Expect point vector to be Ruby Array.");
-      return Qfalse;
-    }
     if (!RB_INTEGER_TYPE_P(_idx)) {
       rb_raise(rb_eArgError, "Expect index to be Ruby Integer.");
       return Qfalse;
     }
-    if (dim != RARRAY_LEN(_arr)) {
+    if (!RB_TYPE_P(_replace_deleted, T_TRUE) && !RB_TYPE_P(_replace_deleted, T_FALSE)) {
+      rb_raise(rb_eArgError, "Expect replace_deleted to be Boolean.");
+      return Qfalse;
+    }
+
+    FloatBufferView buf;
+    const bool is_array = RB_TYPE_P(_arr, T_ARRAY);
+    if (!is_array && !buf.acquire(_arr)) {
+      rb_raise(rb_eArgError, "Expect point vector to be Ruby Array, packed float32 String, or Numo::SFloat.");
+      return Qfalse;
+    }
+    if (is_array && dim != RARRAY_LEN(_arr)) {
       rb_raise(rb_eArgError, "Array size does not match to index dimensionality.");
       return Qfalse;
     }
-    if (!RB_TYPE_P(_replace_deleted, T_TRUE) && !RB_TYPE_P(_replace_deleted, T_FALSE)) {
-      rb_raise(rb_eArgError, "Expect replace_deleted to be Boolean.");
+    if (!is_array && !buf.is_vector(dim)) {
+      buf.release();
+      rb_raise(rb_eArgError, "Buffer size does not match to index dimensionality.");
       return Qfalse;
     }
 
-    float* vec = (float*)ruby_xmalloc(dim * sizeof(float));
-    for (size_t i = 0; i < dim; i++) vec[i] = (float)NUM2DBL(rb_ary_entry(_arr, i));
+    float* vec = nullptr;
+    if (is_array) {
+      vec = (float*)ruby_xmalloc(dim * sizeof(float));
+      for (size_t i = 0; i < dim; i++) vec[i] = (float)NUM2DBL(rb_ary_entry(_arr, i));
+    }
     const size_t idx = NUM2SIZET(_idx);
     const bool replace_deleted = _replace_deleted == Qtrue ? true : false;
 
-    if (rb_iv_get(self, "@normalize") == Qtrue) {
-      float norm = 0.0;
-      for (size_t i = 0; i < dim; i++) norm += vec[i] * vec[i];
-      norm = std::sqrt(std::fabs(norm));
-      if (norm >= 0.0) {
-        for (size_t i = 0; i < dim; i++) vec[i] /= norm;
+    const float* src = vec ? vec : buf.data();
+    char* code = encode_vectors(get_hnsw_space(rb_iv_get(self, "@space")), src, 1, dim);
+    char* rerank_code = encode_rerank_vectors(rb_iv_get(self, "@rerank_space"), src, 1, dim);
+    hnswlib::HierarchicalNSW<float>* index = get_hnsw_hierarchicalnsw(self);
+    AddPointArgs args = {index, code ? (const void*)code : (const void*)src, rerank_code ? (const float*)rerank_code : src,
+                         idx, replace_deleted, ""};
+    IndexCall call(index->active_calls_, buf);
+    call.free_on_exit(vec);
+    call.free_on_exit(code);
+    call.free_on_exit(rerank_code);
+    call.run(_hnsw_hierarchicalnsw_add_point_nogvl, &args);
+
+    if (args.error[0] != '\0') {
+      rb_raise(rb_eRuntimeError, "%s", args.error);
+      return Qfalse;
+    }
+
+    return Qtrue;
+  };
+
+  static VALUE _hnsw_hierarchicalnsw_add_items(int argc, VALUE* argv, VALUE self) {
+    VALUE _mat, _labels, _num_threads, _replace_deleted;
+    VALUE kw_args = Qnil;
+    ID kw_table[2] = {rb_intern("num_threads"), rb_intern("replace_deleted")};
+    VALUE kw_values[2] = {Qundef, Qundef};
+
+    rb_scan_args(argc, argv, "2:", &_mat, &_labels, &kw_args);
+    rb_get_kwargs(kw_args, kw_table, 0, 2, kw_values);
+    _num_threads = kw_values[0] != Qundef ? kw_values[0] : INT2NUM(-1);
+    _replace_deleted = kw_values[1] != Qundef ? kw_values[1] : Qfalse;
+
+    const size_t dim = NUM2SIZET(rb_iv_get(rb_iv_get(self, "@space"), "@dim"));
+    check_space_trained(rb_iv_get(self, "@space"));
+
+    if (!RB_TYPE_P(_labels, T_ARRAY)) {
+      rb_raise(rb_eArgError, "Expect labels to be Ruby Array.");
+      return Qfalse;
+    }
+    if (!RB_INTEGER_TYPE_P(_num_threads)) {
+      rb_raise(rb_eArgError, "Expect num_threads to be Ruby Integer.");
+      return Qfalse;
+    }
+    if (!RB_TYPE_P(_replace_deleted, T_TRUE) && !RB_TYPE_P(_replace_deleted, T_FALSE)) {
+      rb_raise(rb_eArgError, "Expect replace_deleted to be Boolean.");
+      return Qfalse;
+    }
+
+    const size_t n_items = RARRAY_LEN(_labels);
+    for (size_t n = 0; n < n_items; n++) {
+      if (!RB_INTEGER_TYPE_P(rb_ary_entry(_labels, n))) {
+        rb_raise(rb_eArgError, "Expect each label to be Ruby Integer.");
+        return Qfalse;
       }
     }
 
-    try {
-      get_hnsw_hierarchicalnsw(self)->addPoint((void*)vec, idx, replace_deleted);
-    } catch (const std::runtime_error& e) {
-      ruby_xfree(vec);
-      rb_raise(rb_eRuntimeError, "%s", e.what());
+    FloatBufferView buf;
+    const bool is_array = RB_TYPE_P(_mat, T_ARRAY);
+    if (!is_array && !buf.acquire(_mat)) {
+      rb_raise(rb_eArgError, "Expect item matrix to be Ruby Array, packed float32 String, or Numo::SFloat.");
+      return Qfalse;
+    }
+    if (!is_array && !buf.is_matrix(dim)) {
+      buf.release();
+      rb_raise(rb_eArgError, "Buffer size does not match to index dimensionality.");
+      return Qfalse;
+    }
+    if ((is_array ? (size_t)RARRAY_LEN(_mat) : buf.n_rows(dim)) != n_items) {
+      buf.release();
+      rb_raise(rb_eArgError, "The number of items does not match to the number of labels.");
+      return Qfalse;
+    }
+    for (size_t n = 0; is_array && n < n_items; n++) {
+      VALUE arr = rb_ary_entry(_mat, n);
+      if (!RB_TYPE_P(arr, T_ARRAY)) {
+        rb_raise(rb_eArgError, "Expect each item vector to be Ruby Array.");
+        return Qfalse;
+      }
+      if (dim != RARRAY_LEN(arr)) {
+        rb_raise(rb_eArgError, "Array size does not match to index dimensionality.");
+        return Qfalse;
+      }
+    }
+
+    float* mat = nullptr;
+    size_t* labels = (size_t*)ruby_xmalloc(n_items * sizeof(size_t));
+    if (is_array) mat = (float*)ruby_xmalloc(n_items * dim * sizeof(float));
+    for (size_t n = 0; n < n_items; n++) {
+      if (is_array) {
+        VALUE arr = rb_ary_entry(_mat, n);
+        float* vec = mat + n * dim;
+        for (size_t i = 0; i < dim; i++) vec[i] = (float)NUM2DBL(rb_ary_entry(arr, i));
+      }
+      labels[n] = NUM2SIZET(rb_ary_entry(_labels, n));
+    }
+
+    const long n_threads = NUM2LONG(_num_threads);
+    size_t num_threads = n_threads > 0 ? (size_t)n_threads : std::thread::hardware_concurrency();
+    // Spawning threads does not pay off for small batches.
+    if (n_items <= num_threads * 4) num_threads = 1;
+
+    hnswlib::SpaceInterface<float>* space = get_hnsw_space(rb_iv_get(self, "@space"));
+    const float* src = mat ? mat : buf.data();
+    char* codes = encode_vectors(space, src, n_items, dim);
+    char* rerank_codes = encode_rerank_vectors(rb_iv_get(self, "@rerank_space"), src, n_items, dim);
+    hnswlib::HierarchicalNSW<float>* index = get_hnsw_hierarchicalnsw(self);
+    AddItemsArgs args = {index, codes ? codes : (const char*)src,
+                         rerank_codes ? (const float*)rerank_codes : src, labels, n_items,
+                         codes ? space->get_data_size() : dim * sizeof(float), dim, num_threads,
+                         _replace_deleted == Qtrue ? true : false, ""};
+    IndexCall call(index->active_calls_, buf);
+    call.free_on_exit(mat);
+    call.free_on_exit(codes);
+    call.free_on_exit(rerank_codes);
+    call.free_on_exit(labels);
+    call.run(_hnsw_hierarchicalnsw_add_items_nogvl, &args);
+
+    if (args.error[0] != '\0') {
+      rb_raise(rb_eRuntimeError, "%s", args.error);
       return Qfalse;
     }
 
-    ruby_xfree(vec);
     return Qtrue;
   };
 
   static VALUE _hnsw_hierarchicalnsw_search_knn(int argc, VALUE* argv, VALUE self) {
-    VALUE arr, k, filter;
+    VALUE arr, k, filter, packed, out;
     VALUE kw_args = Qnil;
-    ID kw_table[1] = {rb_intern("filter")};
-    VALUE kw_values[1] = {Qundef};
+    ID kw_table[3] = {rb_intern("filter"), rb_intern("packed"), rb_intern("out")};
+    VALUE kw_values[3] = {Qundef, Qundef, Qundef};
 
     rb_scan_args(argc, argv, "2:", &arr, &k, &kw_args);
-    rb_get_kwargs(kw_args, kw_table, 0, 1, kw_values);
+    rb_get_kwargs(kw_args, kw_table, 0, 3, kw_values);
     filter = kw_values[0] != Qundef ? kw_values[0] : Qnil;
+    packed = kw_values[1] != Qundef ? kw_values[1] : Qfalse;
+    out = kw_values[2] != Qundef ? kw_values[2] : Qnil;
 
     const size_t dim = NUM2SIZET(rb_iv_get(rb_iv_get(self, "@space"), "@dim"));
+    check_space_trained(rb_iv_get(self, "@space"));
 
-    if (!RB_TYPE_P(arr, T_ARRAY)) {
-      rb_raise(rb_eArgError, "Expect query vector to be Ruby Array.");
-      return Qnil;
-    }
     if (!RB_INTEGER_TYPE_P(k)) {
       rb_raise(rb_eArgError, "Expect the number of nearest neighbors to be Ruby Integer.");
       return Qnil;
     }
-    if (dim != RARRAY_LEN(arr)) {
+    if (!RB_TYPE_P(packed, T_TRUE) && !RB_TYPE_P(packed, T_FALSE)) {
+      rb_raise(rb_eArgError, "Expect packed to be Boolean.");
+      return Qnil;
+    }
+    if (!NIL_P(out) && (!RB_TYPE_P(out, T_ARRAY) || RARRAY_LEN(out) != 2 || !RB_TYPE_P(rb_ary_entry(out, 0), T_STRING) ||
+                        !RB_TYPE_P(rb_ary_entry(out, 1), T_STRING))) {
+      rb_raise(rb_eArgError, "Expect out to be Ruby Array of two Strings.");
+      return Qnil;
+    }
+    if (!NIL_P(out)) {
+      rb_str_modify(rb_ary_entry(out, 0));
+      rb_str_modify(rb_ary_entry(out, 1));
+    }
+
+    FloatBufferView buf;
+    const bool is_array = RB_TYPE_P(arr, T_ARRAY);
+    if (!is_array && !buf.acquire(arr)) {
+      rb_raise(rb_eArgError, "Expect query vector to be Ruby Array, packed float32 String, or Numo::SFloat.");
+      return Qnil;
+    }
+    if (is_array && dim != RARRAY_LEN(arr)) {
       rb_raise(rb_eArgError, "Array size does not match to index dimensionality.");
       return Qnil;
     }
+    if (!is_array && !buf.is_vector(dim)) {
+      buf.release();
+      rb_raise(rb_eArgError, "Buffer size does not match to index dimensionality.");
+      return Qnil;
+    }
 
-    CustomFilterFunctor* filter_func = nullptr;
-    if (!NIL_P(filter)) {
+    hnswlib::BaseFilterFunctor* filter_func = nullptr;
+    CustomFilterFunctor* custom_filter_func = nullptr;
+    if (rb_obj_is_kind_of(filter, rb_cHnswlibLabelFilter)) {
+      filter_func = RbHnswlibLabelFilter::get_hnsw_labelfilter(filter);
+    } else if (!NIL_P(filter)) {
       try {
-        filter_func = new CustomFilterFunctor(filter);
+        custom_filter_func = new CustomFilterFunctor(filter);
+        filter_func = custom_filter_func;
       } catch (const std::bad_alloc& e) {
+        buf.release();
         rb_raise(rb_eRuntimeError, "%s", e.what());
         return Qnil;
       }
     }
 
-    float* vec = (float*)ruby_xmalloc(dim * sizeof(float));
-    for (size_t i = 0; i < dim; i++) {
-      vec[i] = (float)NUM2DBL(rb_ary_entry(arr, i));
+    float* vec = nullptr;
+    if (is_array) {
+      vec = (float*)ruby_xmalloc(dim * sizeof(float));
+      for (size_t i = 0; i < dim; i++) vec[i] = (float)NUM2DBL(rb_ary_entry(arr, i));
     }
 
-    if (rb_iv_get(self, "@normalize") == Qtrue) {
-      float norm = 0.0;
-      for (size_t i = 0; i < dim; i++) norm += vec[i] * vec[i];
-      norm = std::sqrt(std::fabs(norm));
-      if (norm >= 0.0) {
-        for (size_t i = 0; i < dim; i++) vec[i] /= norm;
-      }
+    const float* src = vec ? vec : buf.data();
+    char* code = encode_queries(get_hnsw_space(rb_iv_get(self, "@space")), src, 1, dim);
+    char* rerank_code = encode_rerank_vectors(rb_iv_get(self, "@rerank_space"), src, 1, dim);
+    hnswlib::HierarchicalNSW<float>* index = get_hnsw_hierarchicalnsw(self);
+    SearchKnnArgs args = {index,
+                          code ? (const void*)code : (const void*)src,
+                          rerank_code ? (const float*)rerank_code : src,
+                          NUM2SIZET(k),
+                          filter_func,
+                          {},
+                          ""};
+    // The filter function calls back into Ruby, so the search has to run with the GVL held. Other threads can run
+    // during the callbacks, so the search is counted in both cases.
+    IndexCall call(index->active_calls_, buf);
+    call.free_on_exit(vec);
+    call.free_on_exit(code);
+    call.free_on_exit(rerank_code);
+    call.run(_hnsw_hierarchicalnsw_search_knn_nogvl, &args, custom_filter_func != nullptr,
+             _hnsw_hierarchicalnsw_search_knn_discard);
+
+    const int filter_state = custom_filter_func ? custom_filter_func->state() : 0;
+    if (custom_filter_func) delete custom_filter_func;
+
+    if (filter_state != 0) {
+      rb_jump_tag(filter_state);
+      return Qnil;
     }
-
-    std::priority_queue<std::pair<float, size_t>> result;
-    try {
-      result = get_hnsw_hierarchicalnsw(self)->searchKnn((void*)vec, NUM2SIZET(k), filter_func);
-    } catch (const std::runtime_error& e) {
-      ruby_xfree(vec);
-      rb_raise(rb_eRuntimeError, "%s", e.what());
+    if (args.error[0] != '\0') {
+      rb_raise(rb_eRuntimeError, "%s", args.error);
       return Qnil;
     }
 
-    ruby_xfree(vec);
-    if (filter_func) delete filter_func;
+    std::priority_queue<std::pair<float, size_t>>& result = args.result;
 
     if (result.size() != NUM2SIZET(k)) {
       rb_warning("Cannot return as many search results as the requested number of neighbors. Probably ef or M is too small.");
     }
 
-    VALUE distances_arr = rb_ary_new();
-    VALUE neighbors_arr = rb_ary_new();
+    const size_t n_results = result.size();
+    if (packed == Qtrue || !NIL_P(out)) {
+      // The caller-provided strings are reused so that repeated queries do not allocate new objects.
+      VALUE labels_str = NIL_P(out) ? rb_str_new(NULL, 0) : rb_ary_entry(out, 0);
+      VALUE distances_str = NIL_P(out) ? rb_str_new(NULL, 0) : rb_ary_entry(out, 1);
+      rb_str_resize(labels_str, n_results * sizeof(uint64_t));
+      rb_str_resize(distances_str, n_results * sizeof(float));
+      char* labels = RSTRING_PTR(labels_str);
+      char* distances = RSTRING_PTR(distances_str);
+      for (size_t i = n_results; i-- > 0;) {
+        const std::pair<float, size_t>& result_tuple = result.top();
+        const uint64_t label = (uint64_t)result_tuple.second;
+        memcpy(labels + i * sizeof(uint64_t), &label, sizeof(uint64_t));
+        memcpy(distances + i * sizeof(float), &result_tuple.first, sizeof(float));
+        result.pop();
+      }
+
+      VALUE ret = rb_ary_new2(2);
+      rb_ary_store(ret, 0, labels_str);
+      rb_ary_store(ret, 1, distances_str);
+      return ret;
+    }
+
+    VALUE distances_arr = rb_ary_new2(n_results);
+    VALUE neighbors_arr = rb_ary_new2(n_results);
 
-    while (!result.empty()) {
+    for (size_t i = n_results; i-- > 0;) {
       const std::pair<float, size_t>& result_tuple = result.top();
-      rb_ary_unshift(distances_arr, DBL2NUM((double)result_tuple.first));
-      rb_ary_unshift(neighbors_arr, SIZET2NUM(result_tuple.second));
+      rb_ary_store(distances_arr, i, DBL2NUM((double)result_tuple.first));
+      rb_ary_store(neighbors_arr, i, SIZET2NUM(result_tuple.second));
       result.pop();
     }
 
@@ -476,22 +1815,157 @@ private:
     return ret;
   };
 
-  static VALUE _hnsw_hierarchicalnsw_save_index(VALUE self, VALUE _filename) {
+  static VALUE _hnsw_hierarchicalnsw_search_knn_batch(int argc, VALUE* argv, VALUE self) {
+    VALUE _mat, _k, _num_threads;
+    VALUE kw_args = Qnil;
+    ID kw_table[1] = {rb_intern("num_threads")};
+    VALUE kw_values[1] = {Qundef};
+
+    rb_scan_args(argc, argv, "2:", &_mat, &_k, &kw_args);
+    rb_get_kwargs(kw_args, kw_table, 0, 1, kw_values);
+    _num_threads = kw_values[0] != Qundef ? kw_values[0] : INT2NUM(-1);
+
+    const size_t dim = NUM2SIZET(rb_iv_get(rb_iv_get(self, "@space"), "@dim"));
+    check_space_trained(rb_iv_get(self, "@space"));
+
+    if (!RB_INTEGER_TYPE_P(_k)) {
+      rb_raise(rb_eArgError, "Expect the number of nearest neighbors to be Ruby Integer.");
+      return Qnil;
+    }
+    if (!RB_INTEGER_TYPE_P(_num_threads)) {
+      rb_raise(rb_eArgError, "Expect num_threads to be Ruby Integer.");
+      return Qnil;
+    }
+
+    FloatBufferView buf;
+    const bool is_array = RB_TYPE_P(_mat, T_ARRAY);
+    if (!is_array && !buf.acquire(_mat)) {
+      rb_raise(rb_eArgError, "Expect query matrix to be Ruby Array, packed float32 String, or Numo::SFloat.");
+      return Qnil;
+    }
+    if (!is_array && !buf.is_matrix(dim)) {
+      buf.release();
+      rb_raise(rb_eArgError, "Buffer size does not match to index dimensionality.");
+      return Qnil;
+    }
+
+    const size_t n_queries = is_array ? RARRAY_LEN(_mat) : buf.n_rows(dim);
+    for (size_t n = 0; is_array && n < n_queries; n++) {
+      VALUE arr = rb_ary_entry(_mat, n);
+      if (!RB_TYPE_P(arr, T_ARRAY)) {
+        rb_raise(rb_eArgError, "Expect each query vector to be Ruby Array.");
+        return Qnil;
+      }
+      if (dim != RARRAY_LEN(arr)) {
+        rb_raise(rb_eArgError, "Array size does not match to index dimensionality.");
+        return Qnil;
+      }
+    }
+
+    const size_t k = NUM2SIZET(_k);
+    float* mat = nullptr;
+    if (is_array) mat = (float*)ruby_xmalloc(n_queries * dim * sizeof(float));
+    for (size_t n = 0; is_array && n < n_queries; n++) {
+      VALUE arr = rb_ary_entry(_mat, n);
+      float* vec = mat + n * dim;
+      for (size_t i = 0; i < dim; i++) vec[i] = (float)NUM2DBL(rb_ary_entry(arr, i));
+    }
+
+    const long n_threads = NUM2LONG(_num_threads);
+    size_t num_threads = n_threads > 0 ? (size_t)n_threads : std::thread::hardware_concurrency();
+    // Spawning threads does not pay off for small batches.
+    if (n_queries <= num_threads * 4) num_threads = 1;
+
+    // The results are written into the returned strings, which are freed by GC if the search fails or is interrupted.
+    VALUE labels_str = rb_str_new(NULL, n_queries * k * sizeof(uint64_t));
+    VALUE distances_str = rb_str_new(NULL, n_queries * k * sizeof(float));
+    uint64_t* labels = (uint64_t*)RSTRING_PTR(labels_str);
+    float* distances = (float*)RSTRING_PTR(distances_str);
+    hnswlib::SpaceInterface<float>* space = get_hnsw_space(rb_iv_get(self, "@space"));
+    const float* src = mat ? mat : buf.data();
+    char* codes = encode_queries(space, src, n_queries, dim);
+    char* rerank_codes = encode_rerank_vectors(rb_iv_get(self, "@rerank_space"), src, n_queries, dim);
+    hnswlib::HierarchicalNSW<float>* index = get_hnsw_hierarchicalnsw(self);
+    SearchKnnBatchArgs args = {index,
+                               codes ? codes : (const char*)src,
+                               rerank_codes ? (const float*)rerank_codes : src,
+                               n_queries,
+                               codes ? space->get_query_size() : dim * sizeof(float),
+                               dim,
+                               k,
+                               num_threads,
+                               labels,
+                               distances,
+                               ""};
+    IndexCall call(index->active_calls_, buf);
+    call.free_on_exit(mat);
+    call.free_on_exit(codes);
+    call.free_on_exit(rerank_codes);
+    call.run(_hnsw_hierarchicalnsw_search_knn_batch_nogvl, &args);
+
+    if (args.error[0] != '\0') {
+      rb_raise(rb_eRuntimeError, "%s", args.error);
+      return Qnil;
+    }
+
+    VALUE ret = rb_ary_new2(2);
+    rb_ary_store(ret, 0, labels_str);
+    rb_ary_store(ret, 1, distances_str);
+    return ret;
+  };
+
+  static VALUE _hnsw_hierarchicalnsw_save_index(int argc, VALUE* argv, VALUE self) {
+    VALUE _filename, _label_index;
+    VALUE kw_args = Qnil;
+    ID kw_table[1] = {rb_intern("label_index")};
+    VALUE kw_values[1] = {Qundef};
+
+    rb_scan_args(argc, argv, "1:", &_filename, &kw_args);
+    rb_get_kwargs(kw_args, kw_table, 0, 1, kw_values);
+    _label_index = kw_values[0] != Qundef ? kw_values[0] : Qfalse;
+
+    if (!RB_TYPE_P(_filename, T_STRING)) {
+      rb_raise(rb_eArgError, "Expect filename to be Ruby String.");
+      return Qnil;
+    }
+    if (!RB_TYPE_P(_label_index, T_TRUE) && !RB_TYPE_P(_label_index, T_FALSE)) {
+      rb_raise(rb_eArgError, "Expect label_index to be Boolean.");
+      return Qnil;
+    }
+
+    check_index_idle(self);
     std::string filename(StringValuePtr(_filename));
-    get_hnsw_hierarchicalnsw(self)->saveIndex(filename);
+    hnswlib::HierarchicalNSW<float>* index = get_hnsw_hierarchicalnsw(self);
+    // The label index of the previous save would no longer describe the index file.
+    if (_label_index == Qfalse) std::remove((filename + ".labels").c_str());
+    try {
+      index->saveIndex(filename);
+      // The full precision vectors for re-ranking are saved in a separate file so that they can be mapped on loading.
+      if (index->isRerankEnabled()) index->saveRerankData(filename + ".rerank");
+      if (_label_index == Qtrue) index->saveLabelIndex(filename + ".labels", filename);
+    } catch (const std::runtime_error& e) {
+      rb_raise(rb_eRuntimeError, "%s", e.what());
+      return Qnil;
+    }
     RB_GC_GUARD(_filename);
     return Qnil;
   };
 
   static VALUE _hnsw_hierarchicalnsw_load_index(int argc, VALUE* argv, VALUE self) {
-    VALUE _filename, _allow_replace_deleted;
+    VALUE _filename, _allow_replace_deleted, _rerank, _split_layout, _huge_pages, _mmap, _label_index;
     VALUE kw_args = Qnil;
-    ID kw_table[1] = {rb_intern("allow_replace_deleted")};
-    VALUE kw_values[1] = {Qundef};
+    ID kw_table[6] = {rb_intern("allow_replace_deleted"), rb_intern("rerank"), rb_intern("split_layout"), rb_intern("huge_pages"),
+                      rb_intern("mmap"), rb_intern("label_index")};
+    VALUE kw_values[6] = {Qundef, Qundef, Qundef, Qundef, Qundef, Qundef};
 
     rb_scan_args(argc, argv, "1:", &_filename, &kw_args);
-    rb_get_kwargs(kw_args, kw_table, 0, 1, kw_values);
+    rb_get_kwargs(kw_args, kw_table, 0, 6, kw_values);
     _allow_replace_deleted = kw_values[0] != Qundef ? kw_values[0] : Qfalse;
+    _rerank = kw_values[1] != Qundef ? kw_values[1] : Qfalse;
+    _split_layout = kw_values[2] != Qundef ? kw_values[2] : Qfalse;
+    _huge_pages = kw_values[3] != Qundef ? kw_values[3] : Qfalse;
+    _mmap = kw_values[4] != Qundef ? kw_values[4] : Qfalse;
+    _label_index = kw_values[5] != Qundef ? kw_values[5] : Qfalse;
 
     if (!RB_TYPE_P(_filename, T_STRING)) {
       rb_raise(rb_eArgError, "Expect filename to be Ruby Array.");
@@ -502,36 +1976,53 @@ private:
       rb_raise(rb_eArgError, "Expect replace_deleted to be Boolean.");
       return Qnil;
     }
+    const bool use_mmap = RB_SYMBOL_P(_rerank) && SYM2ID(_rerank) == rb_intern("mmap");
+    if (!RB_TYPE_P(_rerank, T_TRUE) && !RB_TYPE_P(_rerank, T_FALSE) && !use_mmap) {
+      rb_raise(rb_eArgError, "Expect rerank to be Boolean or :mmap.");
+      return Qnil;
+    }
+    if (!RB_TYPE_P(_split_layout, T_TRUE) && !RB_TYPE_P(_split_layout, T_FALSE)) {
+      rb_raise(rb_eArgError, "Expect split_layout to be Boolean.");
+      return Qnil;
+    }
+    if (!RB_TYPE_P(_huge_pages, T_TRUE) && !RB_TYPE_P(_huge_pages, T_FALSE)) {
+      rb_raise(rb_eArgError, "Expect huge_pages to be Boolean.");
+      return Qnil;
+    }
+    if (!RB_TYPE_P(_mmap, T_TRUE) && !RB_TYPE_P(_mmap, T_FALSE)) {
+      rb_raise(rb_eArgError, "Expect mmap to be Boolean.");
+      return Qnil;
+    }
+    if (_mmap == Qtrue && (_split_layout == Qtrue || _huge_pages == Qtrue)) {
+      rb_raise(rb_eArgError, "mmap cannot be used with split_layout or huge_pages.");
+      return Qnil;
+    }
+    if (!RB_TYPE_P(_label_index, T_TRUE) && !RB_TYPE_P(_label_index, T_FALSE)) {
+      rb_raise(rb_eArgError, "Expect label_index to be Boolean.");
+      return Qnil;
+    }
 
+    check_index_idle(self);
     std::string filename(StringValuePtr(_filename));
     const bool allow_replace_deleted = _allow_replace_deleted == Qtrue ? true : false;
-    VALUE ivspace = rb_iv_get(self, "@space");
-    hnswlib::SpaceInterface<float>* space;
-    if (rb_obj_is_instance_of(ivspace, rb_cHnswlibL2Space)) {
-      space = RbHnswlibL2Space::get_hnsw_l2space(ivspace);
-    } else {
-      space = RbHnswlibInnerProductSpace::get_hnsw_ipspace(ivspace);
+    const bool split_layout = _split_layout == Qtrue ? true : false;
+    const bool huge_pages = _huge_pages == Qtrue ? true : false;
+    const bool load_mmap = _mmap == Qtrue ? true : false;
+    hnswlib::SpaceInterface<float>* space = get_hnsw_space(rb_iv_get(self, "@space"));
+    if (_rerank != Qfalse && !is_compressed_space(rb_iv_get(self, "@space"))) {
+      rb_raise(rb_eArgError, "rerank is available only for the compressed spaces such as 'l2_fp16' or 'l2_sq8'.");
+      return Qnil;
     }
+    VALUE rerank_space = _rerank != Qfalse ? create_rerank_space(rb_iv_get(self, "@space")) : Qnil;
+    rb_iv_set(self, "@rerank_space", rerank_space);
 
     hnswlib::HierarchicalNSW<float>* index = get_hnsw_hierarchicalnsw(self);
-    if (index->data_level0_memory_) {
-      free(index->data_level0_memory_);
-      index->data_level0_memory_ = nullptr;
-    }
-    if (index->linkLists_) {
-      for (hnswlib::tableint i = 0; i < index->cur_element_count; i++) {
-        if (index->element_levels_[i] > 0 && index->linkLists_[i]) {
-          free(index->linkLists_[i]);
-          index->linkLists_[i] = nullptr;
-        }
-      }
-      free(index->linkLists_);
-      index->linkLists_ = nullptr;
-    }
-
+    const std::string label_index_filename = _label_index == Qtrue ? filename + ".labels" : std::string();
     try {
-      index->loadIndex(filename, space);
+      // The deleted items to be replaced are collected while loading.
       index->allow_replace_deleted_ = allow_replace_deleted;
+      index->loadIndex(filename, space, 0, split_layout, huge_pages, load_mmap, label_index_filename);
+      if (!NIL_P(rerank_space)) index->loadRerankData(filename + ".rerank", get_hnsw_space(rerank_space), use_mmap);
     } catch (const std::runtime_error& e) {
       rb_raise(rb_eRuntimeError, "%s", e.what());
       return Qnil;
@@ -543,8 +2034,17 @@ private:
 
   static VALUE _hnsw_hierarchicalnsw_get_point(VALUE self, VALUE idx) {
     VALUE ret = Qnil;
+    hnswlib::SpaceInterface<float>* space = get_hnsw_space(rb_iv_get(self, "@space"));
     try {
-      std::vector<float> vec = get_hnsw_hierarchicalnsw(self)->template getDataByLabel<float>(NUM2SIZET(idx));
+      std::vector<float> vec;
+      if (space->is_encoded()) {
+        std::vector<char> code(space->get_data_size());
+        get_hnsw_hierarchicalnsw(self)->getRawDataByLabel(NUM2SIZET(idx), code.data());
+        vec.resize(NUM2SIZET(rb_iv_get(rb_iv_get(self, "@space"), "@dim")));
+        space->decode(code.data(), vec.data());
+      } else {
+        vec = get_hnsw_hierarchicalnsw(self)->template getDataByLabel<float>(NUM2SIZET(idx));
+      }
       ret = rb_ary_new2(vec.size());
       for (size_t i = 0; i < vec.size(); i++) rb_ary_store(ret, i, DBL2NUM((double)vec[i]));
     } catch (const std::runtime_error& e) {
@@ -555,8 +2055,12 @@ private:
   };
 
   static VALUE _hnsw_hierarchicalnsw_get_ids(VALUE self) {
-    VALUE ret = rb_ary_new();
-    for (auto kv : get_hnsw_hierarchicalnsw(self)->label_lookup_) rb_ary_push(ret, SIZET2NUM(kv.first));
+    // The labels are copied out first, because the shards are locked while being visited.
+    std::vector<hnswlib::labeltype> labels;
+    get_hnsw_hierarchicalnsw(self)->label_lookup_.forEach(
+      [&labels](hnswlib::labeltype label, unsigned int&) { labels.push_back(label); });
+    VALUE ret = rb_ary_new2(labels.size());
+    for (const hnswlib::labeltype label : labels) rb_ary_push(ret, SIZET2NUM(label));
     return ret;
   };
 
@@ -581,6 +2085,7 @@ private:
   };
 
   static VALUE _hnsw_hierarchicalnsw_resize_index(VALUE self, VALUE new_max_elements) {
+    check_index_idle(self);
     if (NUM2SIZET(new_max_elements) < get_hnsw_hierarchicalnsw(self)->cur_element_count) {
       rb_raise(rb_eArgError, "Cannot resize, max element is less than the current number of elements.");
       return Qnil;
@@ -597,6 +2102,34 @@ private:
     return Qnil;
   };
 
+  static VALUE _hnsw_hierarchicalnsw_reorder(VALUE self) {
+    check_index_idle(self);
+    try {
+      get_hnsw_hierarchicalnsw(self)->reorderGraph();
+    } catch (const std::runtime_error& e) {
+      rb_raise(rb_eRuntimeError, "%s", e.what());
+      return Qnil;
+    } catch (const std::bad_alloc& e) {
+      rb_raise(rb_eRuntimeError, "%s", e.what());
+      return Qnil;
+    }
+    return Qnil;
+  };
+
+  static VALUE _hnsw_hierarchicalnsw_set_read_only(VALUE self, VALUE read_only) {
+    if (!RB_TYPE_P(read_only, T_TRUE) && !RB_TYPE_P(read_only, T_FALSE)) {
+      rb_raise(rb_eArgError, "Expect read_only to be Boolean.");
+      return Qnil;
+    }
+    check_index_idle(self);
+    get_hnsw_hierarchicalnsw(self)->setReadOnly(read_only == Qtrue ? true : false);
+    return Qnil;
+  };
+
+  static VALUE _hnsw_hierarchicalnsw_is_read_only(VALUE self) {
+    return get_hnsw_hierarchicalnsw(self)->read_only_ ? Qtrue : Qfalse;
+  };
+
   static VALUE _hnsw_hierarchicalnsw_set_ef(VALUE self, VALUE ef) {
     get_hnsw_hierarchicalnsw(self)->setEf(NUM2SIZET(ef));
     return Qnil;
@@ -674,6 +2207,44 @@ public:
 private:
   static const rb_data_type_t hnsw_bruteforcesearch_type;
 
+  // Raises RuntimeError if a search of another thread is using the index, because the operation would free its data.
+  static void check_index_idle(VALUE self) {
+    if (get_hnsw_bruteforcesearch(self)->active_calls_ > 0) {
+      rb_raise(rb_eRuntimeError, "The index cannot be changed while another thread is searching.");
+    }
+  };
+
+  struct SearchKnnArgs {
+    hnswlib::BruteforceSearch<float>* index;
+    const void* vec;
+    size_t k;
+    hnswlib::BaseFilterFunctor* filter_func;
+    bool with_gvl;
+    std::priority_queue<std::pair<float, size_t>> result;
+    char error[256];
+  };
+
+  static void* _hnsw_bruteforcesearch_search_knn_nogvl(void* ptr) {
+    SearchKnnArgs* args = (SearchKnnArgs*)ptr;
+    try {
+      // add_point and remove_point write the records under index_lock, so the search holds it shared to read
+      // consistent records while the other searches run. With the GVL held, the search cannot run concurrently
+      // with them, and does not take the lock, since another thread could wait for it with the GVL held while
+      // the filter function calls back into Ruby.
+      std::shared_lock<std::shared_timed_mutex> lock(args->index->index_lock, std::defer_lock);
+      if (!args->with_gvl) lock.lock();
+      args->result = args->index->searchKnn(args->vec, args->k, args->filter_func);
+    } catch (const std::exception& e) {
+      snprintf(args->error, sizeof(args->error), "%s", e.what());
+    }
+    return nullptr;
+  };
+
+  // Frees the results of an interrupted search, since the arguments on the stack are not destructed.
+  static void _hnsw_bruteforcesearch_search_knn_discard(void* ptr) {
+    std::priority_queue<std::pair<float, size_t>>().swap(((SearchKnnArgs*)ptr)->result);
+  };
+
   static VALUE _hnsw_bruteforcesearch_initialize(int argc, VALUE* argv, VALUE self) {
     VALUE kw_args = Qnil;
     ID kw_table[2] = {rb_intern("space"), rb_intern("dim")};
@@ -685,25 +2256,17 @@ private:
       rb_raise(rb_eTypeError, "expected space, String");
       return Qnil;
     }
-    if (strcmp(StringValueCStr(kw_values[0]), "l2") != 0 && strcmp(StringValueCStr(kw_values[0]), "ip") != 0 &&
-        strcmp(StringValueCStr(kw_values[0]), "cosine") != 0) {
-      rb_raise(rb_eArgError, "expected space, 'l2', 'ip', or 'cosine' only");
-      return Qnil;
-    }
     if (!RB_INTEGER_TYPE_P(kw_values[1])) {
       rb_raise(rb_eTypeError, "expected dim, Integer");
       return Qnil;
     }
 
-    if (strcmp(StringValueCStr(kw_values[0]), "l2") == 0) {
-      rb_iv_set(self, "@space", rb_funcall(rb_const_get(rb_mHnswlib, rb_intern("L2Space")), rb_intern("new"), 1, kw_values[1]));
-    } else {
-      rb_iv_set(self, "@space",
-                rb_funcall(rb_const_get(rb_mHnswlib, rb_intern("InnerProductSpace")), rb_intern("new"), 1, kw_values[1]));
+    VALUE space = create_space(kw_values[0], kw_values[1]);
+    if (NIL_P(space)) {
+      rb_raise(rb_eArgError, "expected space, 'l2', 'ip', or 'cosine' only, optionally suffixed with '_fp16' or '_bf16', or 'l2_sq8' or 'l2_pq<n_subvectors>' or 'hamming'");
+      return Qnil;
     }
-
-    rb_iv_set(self, "@normalize", Qfalse);
-    if (strcmp(StringValueCStr(kw_values[0]), "cosine") == 0) rb_iv_set(self, "@normalize", Qtrue);
+    rb_iv_set(self, "@space", space);
 
     return Qnil;
   };
@@ -720,13 +2283,8 @@ private:
       return Qnil;
     }
 
-    hnswlib::SpaceInterface<float>* space = nullptr;
-    VALUE ivspace = rb_iv_get(self, "@space");
-    if (rb_obj_is_instance_of(ivspace, rb_cHnswlibL2Space)) {
-      space = RbHnswlibL2Space::get_hnsw_l2space(ivspace);
-    } else {
-      space = RbHnswlibInnerProductSpace::get_hnsw_ipspace(ivspace);
-    }
+    check_index_idle(self);
+    hnswlib::SpaceInterface<float>* space = get_hnsw_space(rb_iv_get(self, "@space"));
 
     const size_t max_elements = NUM2SIZET(kw_values[0]);
 
@@ -744,41 +2302,50 @@ private:
 
   static VALUE _hnsw_bruteforcesearch_add_point(VALUE self, VALUE arr, VALUE idx) {
     const size_t dim = NUM2SIZET(rb_iv_get(rb_iv_get(self, "@space"), "@dim"));
+    check_space_trained(rb_iv_get(self, "@space"));
 
-    if (!RB_TYPE_P(arr, T_ARRAY)) {
-      rb_raise(rb_eArgError, "Expect point vector to be Ruby Array.");
-      return Qfalse;
-    }
     if (!RB_INTEGER_TYPE_P(idx)) {
       rb_raise(rb_eArgError, "Expect index to be Ruby Integer.");
       return Qfalse;
     }
-    if (dim != RARRAY_LEN(arr)) {
+
+    FloatBufferView buf;
+    const bool is_array = RB_TYPE_P(arr, T_ARRAY);
+    if (!is_array && !buf.acquire(arr)) {
+      rb_raise(rb_eArgError, "Expect point vector to be Ruby Array, packed float32 String, or Numo::SFloat.");
+      return Qfalse;
+    }
+    if (is_array && dim != RARRAY_LEN(arr)) {
       rb_raise(rb_eArgError, "Array size does not match to index dimensionality.");
       return Qfalse;
     }
+    if (!is_array && !buf.is_vector(dim)) {
+      buf.release();
+      rb_raise(rb_eArgError, "Buffer size does not match to index dimensionality.");
+      return Qfalse;
+    }
 
-    float* vec = (float*)ruby_xmalloc(dim * sizeof(float));
-    for (size_t i = 0; i < dim; i++) vec[i] = (float)NUM2DBL(rb_ary_entry(arr, i));
-
-    if (rb_iv_get(self, "@normalize") == Qtrue) {
-      float norm = 0.0;
-      for (size_t i = 0; i < dim; i++) norm += vec[i] * vec[i];
-      norm = std::sqrt(std::fabs(norm));
-      if (norm >= 0.0) {
-        for (size_t i = 0; i < dim; i++) vec[i] /= norm;
-      }
+    float* vec = nullptr;
+    if (is_array) {
+      vec = (float*)ruby_xmalloc(dim * sizeof(float));
+      for (size_t i = 0; i < dim; i++) vec[i] = (float)NUM2DBL(rb_ary_entry(arr, i));
     }
 
+    const float* src = vec ? vec : buf.data();
+    char* code = encode_vectors(get_hnsw_space(rb_iv_get(self, "@space")), src, 1, dim);
     try {
-      get_hnsw_bruteforcesearch(self)->addPoint((void*)vec, NUM2SIZET(idx));
+      get_hnsw_bruteforcesearch(self)->addPoint(code ? (const void*)code : (const void*)src, NUM2SIZET(idx));
     } catch (const std::runtime_error& e) {
-      ruby_xfree(vec);
+      if (vec) ruby_xfree(vec);
+      if (code) ruby_xfree(code);
+      buf.release();
       rb_raise(rb_eRuntimeError, "%s", e.what());
       return Qfalse;
     }
 
-    ruby_xfree(vec);
+    if (vec) ruby_xfree(vec);
+    if (code) ruby_xfree(code);
+    buf.release();
     return Qtrue;
   };
 
@@ -793,59 +2360,89 @@ private:
     filter = kw_values[0] != Qundef ? kw_values[0] : Qnil;
 
     const size_t dim = NUM2SIZET(rb_iv_get(rb_iv_get(self, "@space"), "@dim"));
+    check_space_trained(rb_iv_get(self, "@space"));
 
-    if (!RB_TYPE_P(arr, T_ARRAY)) {
-      rb_raise(rb_eArgError, "Expect query vector to be Ruby Array.");
-      return Qnil;
-    }
     if (!RB_INTEGER_TYPE_P(k)) {
       rb_raise(rb_eArgError, "Expect the number of nearest neighbors to be Ruby Integer.");
       return Qnil;
     }
-    if (dim != RARRAY_LEN(arr)) {
+
+    FloatBufferView buf;
+    const bool is_array = RB_TYPE_P(arr, T_ARRAY);
+    if (!is_array && !buf.acquire(arr)) {
+      rb_raise(rb_eArgError, "Expect query vector to be Ruby Array, packed float32 String, or Numo::SFloat.");
+      return Qnil;
+    }
+    if (is_array && dim != RARRAY_LEN(arr)) {
       rb_raise(rb_eArgError, "Array size does not match to index dimensionality.");
       return Qnil;
     }
+    if (!is_array && !buf.is_vector(dim)) {
+      buf.release();
+      rb_raise(rb_eArgError, "Buffer size does not match to index dimensionality.");
+      return Qnil;
+    }
 
-    CustomFilterFunctor* filter_func = nullptr;
-    if (!NIL_P(filter)) {
+    hnswlib::BaseFilterFunctor* filter_func = nullptr;
+    CustomFilterFunctor* custom_filter_func = nullptr;
+    if (rb_obj_is_kind_of(filter, rb_cHnswlibLabelFilter)) {
+      filter_func = RbHnswlibLabelFilter::get_hnsw_labelfilter(filter);
+    } else if (!NIL_P(filter)) {
       try {
-        filter_func = new CustomFilterFunctor(filter);
+        custom_filter_func = new CustomFilterFunctor(filter);
+        filter_func = custom_filter_func;
       } catch (const std::bad_alloc& e) {
+        buf.release();
         rb_raise(rb_eRuntimeError, "%s", e.what());
         return Qnil;
       }
     }
 
-    float* vec = (float*)ruby_xmalloc(dim * sizeof(float));
-    for (size_t i = 0; i < dim; i++) vec[i] = (float)NUM2DBL(rb_ary_entry(arr, i));
-
-    if (rb_iv_get(self, "@normalize") == Qtrue) {
-      float norm = 0.0;
-      for (size_t i = 0; i < dim; i++) norm += vec[i] * vec[i];
-      norm = std::sqrt(std::fabs(norm));
-      if (norm >= 0.0) {
-        for (size_t i = 0; i < dim; i++) vec[i] /= norm;
-      }
+    float* vec = nullptr;
+    if (is_array) {
+      vec = (float*)ruby_xmalloc(dim * sizeof(float));
+      for (size_t i = 0; i < dim; i++) vec[i] = (float)NUM2DBL(rb_ary_entry(arr, i));
     }
 
-    std::priority_queue<std::pair<float, size_t>> result =
-        get_hnsw_bruteforcesearch(self)->searchKnn((void*)vec, NUM2SIZET(k), filter_func);
+    const float* src = vec ? vec : buf.data();
+    char* code = encode_queries(get_hnsw_space(rb_iv_get(self, "@space")), src, 1, dim);
+    hnswlib::BruteforceSearch<float>* index = get_hnsw_bruteforcesearch(self);
+    SearchKnnArgs args = {index, code ? (const void*)code : (const void*)src, NUM2SIZET(k), filter_func,
+                          custom_filter_func != nullptr, {}, ""};
+    // The filter function calls back into Ruby, so the search has to run with the GVL held. Other threads can run
+    // during the callbacks, so the search is counted in both cases.
+    IndexCall call(index->active_calls_, buf);
+    call.free_on_exit(vec);
+    call.free_on_exit(code);
+    call.run(_hnsw_bruteforcesearch_search_knn_nogvl, &args, custom_filter_func != nullptr,
+             _hnsw_bruteforcesearch_search_knn_discard);
+
+    const int filter_state = custom_filter_func ? custom_filter_func->state() : 0;
+    if (custom_filter_func) delete custom_filter_func;
+
+    if (filter_state != 0) {
+      rb_jump_tag(filter_state);
+      return Qnil;
+    }
+    if (args.error[0] != '\0') {
+      rb_raise(rb_eRuntimeError, "%s", args.error);
+      return Qnil;
+    }
 
-    ruby_xfree(vec);
-    if (filter_func) delete filter_func;
+    std::priority_queue<std::pair<float, size_t>>& result = args.result;
 
     if (result.size() != NUM2SIZET(k)) {
       rb_warning("Cannot return as many search results as the requested number of neighbors.");
     }
 
-    VALUE distances_arr = rb_ary_new2(result.size());
-    VALUE neighbors_arr = rb_ary_new2(result.size());
+    const size_t n_results = result.size();
+    VALUE distances_arr = rb_ary_new2(n_results);
+    VALUE neighbors_arr = rb_ary_new2(n_results);
 
-    while (!result.empty()) {
+    for (size_t i = n_results; i-- > 0;) {
       const std::pair<float, size_t>& result_tuple = result.top();
-      rb_ary_unshift(distances_arr, DBL2NUM((double)result_tuple.first));
-      rb_ary_unshift(neighbors_arr, SIZET2NUM(result_tuple.second));
+      rb_ary_store(distances_arr, i, DBL2NUM((double)result_tuple.first));
+      rb_ary_store(neighbors_arr, i, SIZET2NUM(result_tuple.second));
       result.pop();
     }
 
@@ -863,14 +2460,9 @@ private:
   };
 
   static VALUE _hnsw_bruteforcesearch_load_index(VALUE self, VALUE _filename) {
+    check_index_idle(self);
     std::string filename(StringValuePtr(_filename));
-    VALUE ivspace = rb_iv_get(self, "@space");
-    hnswlib::SpaceInterface<float>* space;
-    if (rb_obj_is_instance_of(ivspace, rb_cHnswlibL2Space)) {
-      space = RbHnswlibL2Space::get_hnsw_l2space(ivspace);
-    } else {
-      space = RbHnswlibInnerProductSpace::get_hnsw_ipspace(ivspace);
-    }
+    hnswlib::SpaceInterface<float>* space = get_hnsw_space(rb_iv_get(self, "@space"));
     hnswlib::BruteforceSearch<float>* index = get_hnsw_bruteforcesearch(self);
     if (index->data_) {
       free(index->data_);
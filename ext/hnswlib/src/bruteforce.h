@@ -2,6 +2,7 @@
 #include <unordered_map>
 #include <fstream>
 #include <mutex>
+#include <shared_mutex>
 #include <algorithm>
 #include <assert.h>
 
@@ -16,8 +17,11 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
 
     size_t data_size_;
     DISTFUNC <dist_t> fstdistfunc_;
+    DISTFUNC <dist_t> query_fstdistfunc_;
     void *dist_func_param_;
-    std::mutex index_lock;
+    SpaceInterface<dist_t> *space_ = nullptr;  // space whose learned parameters are saved with the index
+    std::shared_timed_mutex index_lock;  // shared by the searches, exclusive for the writes of records
+    size_t active_calls_ = 0;  // number of searches running on other threads (see HierarchicalNSW::active_calls_)
 
     std::unordered_map<labeltype, size_t > dict_external_to_internal;
 
@@ -46,8 +50,10 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
 
     BruteforceSearch(SpaceInterface <dist_t> *s, size_t maxElements) {
         maxelements_ = maxElements;
+        space_ = s;
         data_size_ = s->get_data_size();
         fstdistfunc_ = s->get_dist_func();
+        query_fstdistfunc_ = s->get_query_dist_func();
         dist_func_param_ = s->get_dist_func_param();
         size_per_element_ = data_size_ + sizeof(labeltype);
         data_ = (char *) malloc(maxElements * size_per_element_);
@@ -65,7 +71,7 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
     void addPoint(const void *datapoint, labeltype label, bool replace_deleted = false) {
         int idx;
         {
-            std::unique_lock<std::mutex> lock(index_lock);
+            std::unique_lock<std::shared_timed_mutex> lock(index_lock);
 
             auto search = dict_external_to_internal.find(label);
             if (search != dict_external_to_internal.end()) {
@@ -78,14 +84,15 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
                 dict_external_to_internal[label] = idx;
                 cur_element_count++;
             }
+            // The record is written under the lock, so that a search holding it does not read a torn record.
+            memcpy(data_ + size_per_element_ * idx + data_size_, &label, sizeof(labeltype));
+            memcpy(data_ + size_per_element_ * idx, datapoint, data_size_);
         }
-        memcpy(data_ + size_per_element_ * idx + data_size_, &label, sizeof(labeltype));
-        memcpy(data_ + size_per_element_ * idx, datapoint, data_size_);
     }
 
 
     void removePoint(labeltype cur_external) {
-        std::unique_lock<std::mutex> lock(index_lock);
+        std::unique_lock<std::shared_timed_mutex> lock(index_lock);
 
         auto found = dict_external_to_internal.find(cur_external);
         if (found == dict_external_to_internal.end()) {
@@ -110,7 +117,7 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
         std::priority_queue<std::pair<dist_t, labeltype >> topResults;
         if (cur_element_count == 0) return topResults;
         for (int i = 0; i < k; i++) {
-            dist_t dist = fstdistfunc_(query_data, data_ + size_per_element_ * i, dist_func_param_);
+            dist_t dist = query_fstdistfunc_(query_data, data_ + size_per_element_ * i, dist_func_param_);
             labeltype label = *((labeltype*) (data_ + size_per_element_ * i + data_size_));
             if ((!isIdAllowed) || (*isIdAllowed)(label)) {
                 topResults.emplace(dist, label);
@@ -118,7 +125,7 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
         }
         dist_t lastdist = topResults.empty() ? std::numeric_limits<dist_t>::max() : topResults.top().first;
         for (int i = k; i < cur_element_count; i++) {
-            dist_t dist = fstdistfunc_(query_data, data_ + size_per_element_ * i, dist_func_param_);
+            dist_t dist = query_fstdistfunc_(query_data, data_ + size_per_element_ * i, dist_func_param_);
             if (dist <= lastdist) {
                 labeltype label = *((labeltype *) (data_ + size_per_element_ * i + data_size_));
                 if ((!isIdAllowed) || (*isIdAllowed)(label)) {
@@ -145,6 +152,8 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
         writeBinaryPOD(output, cur_element_count);
 
         output.write(data_, maxelements_ * size_per_element_);
+        if (space_)
+            space_->save_state(output);
 
         output.close();
     }
@@ -158,8 +167,10 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
         readBinaryPOD(input, size_per_element_);
         readBinaryPOD(input, cur_element_count);
 
+        space_ = s;
         data_size_ = s->get_data_size();
         fstdistfunc_ = s->get_dist_func();
+        query_fstdistfunc_ = s->get_query_dist_func();
         dist_func_param_ = s->get_dist_func_param();
         size_per_element_ = data_size_ + sizeof(labeltype);
         data_ = (char *) malloc(maxelements_ * size_per_element_);
@@ -167,6 +178,7 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
             throw std::runtime_error("Not enough memory: loadIndex failed to allocate data");
 
         input.read(data_, maxelements_ * size_per_element_);
+        s->load_state(input);
 
         input.close();
     }
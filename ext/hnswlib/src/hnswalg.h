@@ -2,6 +2,7 @@
 
 #include "visited_list_pool.h"
 #include "hnswlib.h"
+#include "label_lookup.h"
 #include <atomic>
 #include <random>
 #include <stdlib.h>
@@ -9,16 +10,196 @@
 #include <unordered_set>
 #include <list>
 #include <memory>
+#include <cstdio>
+#include <thread>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define HNSWLIB_HAVE_MMAP
+#endif
 
 namespace hnswlib {
 typedef unsigned int tableint;
 typedef unsigned int linklistsizeint;
 
+// Allocates memory starting at a cache line boundary. The memory must be released with alignedFree.
+static void *alignedMalloc(size_t size) {
+    const size_t alignment = 64;
+    if (size == 0) size = alignment;
+#if defined(_WIN32)
+    return _aligned_malloc(size, alignment);
+#else
+    void *ptr = nullptr;
+    if (posix_memalign(&ptr, alignment, size) != 0) return nullptr;
+    return ptr;
+#endif
+}
+
+static void alignedFree(void *ptr) {
+#if defined(_WIN32)
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+// Allocates memory backed by 2 MB huge pages, so that traversing a large index causes fewer TLB misses.
+// Explicit huge pages are used if the system has reserved them, and otherwise the memory is mapped at
+// a huge page boundary and transparent huge pages are requested with madvise. Where mmap is not available,
+// the memory is allocated with alignedMalloc. The memory must be released with hugePageFree.
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+static const size_t HUGE_PAGE_HEADER_SIZE = 64;  // keeps the length of the mapping in front of the memory
+
+static void *hugePageMalloc(size_t size) {
+#if defined(HNSWLIB_HAVE_MMAP)
+    const size_t length = (size + HUGE_PAGE_HEADER_SIZE + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    char *addr = nullptr;
+#if defined(MAP_HUGETLB)
+    void *hugetlb_addr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (hugetlb_addr != MAP_FAILED) addr = (char *) hugetlb_addr;
+#endif
+    if (addr == nullptr) {
+        // Maps an extra huge page to align the start, and unmaps the unused parts before and after it.
+        void *base_addr = mmap(nullptr, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base_addr == MAP_FAILED) return nullptr;
+        char *base = (char *) base_addr;
+        addr = (char *) (((uintptr_t) base + HUGE_PAGE_SIZE - 1) & ~((uintptr_t) HUGE_PAGE_SIZE - 1));
+        if (addr > base) munmap(base, addr - base);
+        if (base + HUGE_PAGE_SIZE > addr) munmap(addr + length, base + HUGE_PAGE_SIZE - addr);
+#if defined(MADV_HUGEPAGE)
+        madvise(addr, length, MADV_HUGEPAGE);
+#endif
+    }
+    *((size_t *) addr) = length;
+    return addr + HUGE_PAGE_HEADER_SIZE;
+#else
+    return alignedMalloc(size);
+#endif
+}
+
+static void hugePageFree(void *ptr) {
+#if defined(HNSWLIB_HAVE_MMAP)
+    if (ptr == nullptr) return;
+    char *addr = (char *) ptr - HUGE_PAGE_HEADER_SIZE;
+    munmap(addr, *((size_t *) addr));
+#else
+    alignedFree(ptr);
+#endif
+}
+
+/*
+* A lock taking a single byte, so that the lock of each element does not take the 40 bytes of std::mutex.
+* The waiting thread spins for a while and then yields, as the locks are usually held only while a link list
+* is read or written, although addPoint holds the lock of the new element until its insertion ends.
+*/
+class SpinLock {
+    static const unsigned int MAX_SPINS = 64;
+
+    std::atomic<unsigned char> locked_{0};
+
+ public:
+    void lock() {
+        unsigned int n_spins = 0;
+        while (locked_.exchange(1, std::memory_order_acquire)) {
+            while (locked_.load(std::memory_order_relaxed)) {
+                if (n_spins < MAX_SPINS) {
+                    n_spins++;
+#if defined(USE_SSE)
+                    _mm_pause();
+#endif
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        }
+    }
+
+    bool try_lock() {
+        return !locked_.load(std::memory_order_relaxed) && !locked_.exchange(1, std::memory_order_acquire);
+    }
+
+    void unlock() {
+        locked_.store(0, std::memory_order_release);
+    }
+};
+
+/*
+* Allocates the link lists of the upper layers by bumping an offset in large blocks instead of one malloc per
+* element, so that the upper layers are stored compactly and are released at once. The memory of an allocation
+* is not moved or released until clear is called, so that the pointers to it stay valid while the arena grows.
+*/
+class LinkListArena {
+    static const size_t MIN_BLOCK_SIZE = 4 * 1024 * 1024;
+
+    std::vector<char *> blocks_;
+    size_t block_used_{0};
+    size_t block_size_{0};
+    bool huge_pages_{false};
+    std::mutex lock_;
+
+ public:
+    LinkListArena() { }
+
+    ~LinkListArena() {
+        clear();
+    }
+
+    void setHugePages(bool huge_pages) {
+        huge_pages_ = huge_pages;
+    }
+
+    // Adds a block holding at least the given number of bytes, which is used for the following allocations.
+    // loadIndex reserves the total size of the link lists in the file, so that they are stored in a single block.
+    bool reserve(size_t size) {
+        std::unique_lock<std::mutex> lock(lock_);
+        return addBlock(size);
+    }
+
+    // Returns the memory aligned to the link list entries, or nullptr if it cannot be allocated.
+    char *allocate(size_t size) {
+        size = (size + sizeof(tableint) - 1) / sizeof(tableint) * sizeof(tableint);
+        std::unique_lock<std::mutex> lock(lock_);
+        if (blocks_.empty() || block_used_ + size > block_size_) {
+            if (!addBlock(std::max(size, (size_t) MIN_BLOCK_SIZE))) return nullptr;
+        }
+        char *ptr = blocks_.back() + block_used_;
+        block_used_ += size;
+        return ptr;
+    }
+
+    void clear() {
+        for (char *block : blocks_) {
+            if (huge_pages_) {
+                hugePageFree(block);
+            } else {
+                free(block);
+            }
+        }
+        blocks_.clear();
+        block_used_ = 0;
+        block_size_ = 0;
+    }
+
+ private:
+    bool addBlock(size_t size) {
+        char *block = (char *) (huge_pages_ ? hugePageMalloc(size) : malloc(size));
+        if (block == nullptr) return false;
+        blocks_.push_back(block);
+        block_used_ = 0;
+        block_size_ = size;
+        return true;
+    }
+};
+
 template<typename dist_t>
 class HierarchicalNSW : public AlgorithmInterface<dist_t> {
  public:
     static const tableint MAX_LABEL_OPERATION_LOCKS = 65536;
     static const unsigned char DELETE_MARK = 0x01;
+    static const uint64_t LABEL_INDEX_MAGIC = 0x32584449424c4e48;  // "HNLBIDX2" in little endian
 
     size_t max_elements_{0};
     mutable std::atomic<size_t> cur_element_count{0};  // current number of elements
@@ -40,7 +221,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     mutable std::vector<std::mutex> label_op_locks_;
 
     std::mutex global;
-    std::vector<std::mutex> link_list_locks_;
+    std::vector<SpinLock> link_list_locks_;
 
     tableint enterpoint_node_{0};
 
@@ -49,15 +230,29 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
     char *data_level0_memory_{nullptr};
     char **linkLists_{nullptr};
+    LinkListArena link_list_arena_;  // holds the link lists of the upper layers pointed to by linkLists_
+
+    // With the split layout, the level-0 links, the vectors, and the labels are stored in separate arrays
+    // aligned to cache lines instead of the interleaved records of data_level0_memory_, which is then nullptr.
+    // The following point to the first element of each part for either layout, so that the accessors do not branch.
+    bool split_layout_{false};
+    char *links_level0_memory_{nullptr};
+    char *vector_memory_{nullptr};
+    char *label_memory_{nullptr};
+    size_t links_level0_stride_{0}, vector_stride_{0}, label_stride_{0};
+    bool huge_pages_{false};  // whether the base layer and the upper layers are backed by huge pages
+    void *level0_mmap_addr_{nullptr};  // start of the mapping if the base layer is mapped from an index file
+    size_t level0_mmap_size_{0};
     std::vector<int> element_levels_;  // keeps level of each element
 
     size_t data_size_{0};
 
     DISTFUNC<dist_t> fstdistfunc_;
+    DISTFUNC<dist_t> query_fstdistfunc_;  // distance from the query given to the search methods
+    BATCHDISTFUNC<dist_t> query_batch_fstdistfunc_{nullptr};  // the same distance to several elements at once
     void *dist_func_param_{nullptr};
 
-    mutable std::mutex label_lookup_lock;  // lock for label_lookup_
-    std::unordered_map<labeltype, tableint> label_lookup_;
+    LabelLookupTable<tableint> label_lookup_;  // locked by the shard of each label (see LabelLookupTable::getLock)
 
     std::default_random_engine level_generator_;
     std::default_random_engine update_probability_generator_;
@@ -66,6 +261,20 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     mutable std::atomic<long> metric_hops{0};
 
     bool allow_replace_deleted_ = false;  // flag to replace deleted elements (marked as deleted) during insertions
+    bool read_only_ = false;  // flag to reject modifications and read without locks (see setReadOnly)
+    // Number of searches and insertions running on other threads, which the Ruby binding counts while holding the GVL
+    // so that it does not free or reallocate the structures they use.
+    size_t active_calls_{0};
+
+    SpaceInterface<dist_t> *space_ = nullptr;  // space whose learned parameters are saved with the index
+
+    // Full precision vectors kept apart from the graph to re-rank the candidates found on compressed vectors.
+    char *rerank_data_{nullptr};
+    size_t rerank_data_size_{0};
+    DISTFUNC<dist_t> rerank_fstdistfunc_{nullptr};
+    void *rerank_dist_func_param_{nullptr};
+    void *rerank_mmap_addr_{nullptr};  // start of the mapping if rerank_data_ is mapped from a file
+    size_t rerank_mmap_size_{0};
 
     std::mutex deleted_elements_lock;  // lock for deleted_elements
     std::unordered_set<tableint> deleted_elements;  // contains internal ids of deleted elements
@@ -93,15 +302,22 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         size_t M = 16,
         size_t ef_construction = 200,
         size_t random_seed = 100,
-        bool allow_replace_deleted = false)
+        bool allow_replace_deleted = false,
+        bool split_layout = false,
+        bool huge_pages = false)
         : label_op_locks_(MAX_LABEL_OPERATION_LOCKS),
             link_list_locks_(max_elements),
+            split_layout_(split_layout),
+            huge_pages_(huge_pages),
             element_levels_(max_elements),
             allow_replace_deleted_(allow_replace_deleted) {
         max_elements_ = max_elements;
         num_deleted_ = 0;
+        space_ = s;
         data_size_ = s->get_data_size();
         fstdistfunc_ = s->get_dist_func();
+        query_fstdistfunc_ = s->get_query_dist_func();
+        query_batch_fstdistfunc_ = s->get_query_batch_dist_func();
         dist_func_param_ = s->get_dist_func_param();
         if ( M <= 10000 ) {
             M_ = M;
@@ -124,9 +340,9 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         label_offset_ = size_links_level0_ + data_size_;
         offsetLevel0_ = 0;
 
-        data_level0_memory_ = (char *) malloc(max_elements_ * size_data_per_element_);
-        if (data_level0_memory_ == nullptr)
+        if (!allocateLevel0(max_elements_))
             throw std::runtime_error("Not enough memory");
+        link_list_arena_.setHugePages(huge_pages_);
 
         cur_element_count = 0;
 
@@ -150,16 +366,115 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
     void clear() {
-        free(data_level0_memory_);
-        data_level0_memory_ = nullptr;
-        for (tableint i = 0; i < cur_element_count; i++) {
-            if (element_levels_[i] > 0)
-                free(linkLists_[i]);
-        }
+        freeLevel0();
+        link_list_arena_.clear();
         free(linkLists_);
         linkLists_ = nullptr;
         cur_element_count = 0;
         visited_list_pool_.reset(nullptr);
+        freeRerankData();
+    }
+
+
+    /*
+    * Keeps the vectors given to addPoint in the format of the space s as well, so that searchKnnReranked
+    * can re-rank the candidates found on compressed vectors with them.
+    */
+    void enableRerank(SpaceInterface<dist_t> *s) {
+        freeRerankData();
+        rerank_data_size_ = s->get_data_size();
+        rerank_fstdistfunc_ = s->get_dist_func();
+        rerank_dist_func_param_ = s->get_dist_func_param();
+        rerank_data_ = (char *) malloc(max_elements_ * rerank_data_size_);
+        if (rerank_data_ == nullptr)
+            throw std::runtime_error("Not enough memory: enableRerank failed to allocate rerank data");
+    }
+
+
+    bool isRerankEnabled() const {
+        return rerank_data_ != nullptr;
+    }
+
+
+    void freeRerankData() {
+#if defined(HNSWLIB_HAVE_MMAP)
+        if (rerank_mmap_addr_) {
+            munmap(rerank_mmap_addr_, rerank_mmap_size_);
+            rerank_mmap_addr_ = nullptr;
+            rerank_mmap_size_ = 0;
+            rerank_data_ = nullptr;
+        }
+#endif
+        free(rerank_data_);
+        rerank_data_ = nullptr;
+    }
+
+
+    void saveRerankData(const std::string &location) const {
+        // As in saveIndex, the file the rerank data is mapped from must not be truncated under the mapping.
+        const std::string path = rerank_mmap_addr_ ? location + ".tmp" : location;
+        std::ofstream output(path, std::ios::binary);
+        if (!output.is_open())
+            throw std::runtime_error("Cannot open file");
+
+        const size_t max_elements = max_elements_;
+        writeBinaryPOD(output, max_elements);
+        writeBinaryPOD(output, rerank_data_size_);
+        output.write(rerank_data_, max_elements_ * rerank_data_size_);
+        output.close();
+        if (path != location && std::rename(path.c_str(), location.c_str()) != 0)
+            throw std::runtime_error("Cannot replace rerank data file");
+    }
+
+
+    /*
+    * Loads the vectors saved by saveRerankData. If use_mmap is true, the file is mapped copy-on-write
+    * instead of being read, so that only the pages touched by re-ranking are brought into memory.
+    */
+    void loadRerankData(const std::string &location, SpaceInterface<dist_t> *s, bool use_mmap = false) {
+        std::ifstream input(location, std::ios::binary);
+        if (!input.is_open())
+            throw std::runtime_error("Cannot open file");
+
+        size_t n_elements, data_size;
+        readBinaryPOD(input, n_elements);
+        readBinaryPOD(input, data_size);
+        input.seekg(0, input.end);
+        const size_t total_filesize = input.tellg();
+        const size_t header_size = sizeof(n_elements) + sizeof(data_size);
+        if (data_size != s->get_data_size() || n_elements < cur_element_count ||
+            total_filesize != header_size + n_elements * data_size)
+            throw std::runtime_error("Rerank data seems to be corrupted or does not match to the index");
+
+        freeRerankData();
+        rerank_data_size_ = data_size;
+        rerank_fstdistfunc_ = s->get_dist_func();
+        rerank_dist_func_param_ = s->get_dist_func_param();
+
+#if defined(HNSWLIB_HAVE_MMAP)
+        // The mapping can hold new points only up to the capacity saved in the file.
+        if (use_mmap && n_elements >= max_elements_) {
+            input.close();
+            const int fd = open(location.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw std::runtime_error("Cannot open file");
+            void *addr = mmap(nullptr, total_filesize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (addr == MAP_FAILED)
+                throw std::runtime_error("Cannot map rerank data");
+            rerank_mmap_addr_ = addr;
+            rerank_mmap_size_ = total_filesize;
+            rerank_data_ = (char *) addr + header_size;
+            return;
+        }
+#endif
+
+        rerank_data_ = (char *) malloc(max_elements_ * rerank_data_size_);
+        if (rerank_data_ == nullptr)
+            throw std::runtime_error("Not enough memory: loadRerankData failed to allocate rerank data");
+        input.seekg(header_size, input.beg);
+        input.read(rerank_data_, cur_element_count * rerank_data_size_);
+        input.close();
     }
 
 
@@ -176,6 +491,23 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
+    /*
+    * Makes the index read-only, so that the methods modifying it throw an exception, and the methods looking up
+    * the elements by label skip the locks. The searches do not take locks in either mode, but in read-only mode
+    * they cannot observe a link list being rewritten by a concurrent insertion. It must not be changed while
+    * other operations run.
+    */
+    void setReadOnly(bool read_only) {
+        read_only_ = read_only;
+    }
+
+
+    void checkWritable() const {
+        if (read_only_)
+            throw std::runtime_error("The index is read-only");
+    }
+
+
     inline std::mutex& getLabelOpMutex(labeltype label) const {
         // calculate hash
         size_t lock_id = label & (MAX_LABEL_OPERATION_LOCKS - 1);
@@ -185,23 +517,23 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
     inline labeltype getExternalLabel(tableint internal_id) const {
         labeltype return_label;
-        memcpy(&return_label, (data_level0_memory_ + internal_id * size_data_per_element_ + label_offset_), sizeof(labeltype));
+        memcpy(&return_label, (label_memory_ + internal_id * label_stride_), sizeof(labeltype));
         return return_label;
     }
 
 
     inline void setExternalLabel(tableint internal_id, labeltype label) const {
-        memcpy((data_level0_memory_ + internal_id * size_data_per_element_ + label_offset_), &label, sizeof(labeltype));
+        memcpy((label_memory_ + internal_id * label_stride_), &label, sizeof(labeltype));
     }
 
 
     inline labeltype *getExternalLabeLp(tableint internal_id) const {
-        return (labeltype *) (data_level0_memory_ + internal_id * size_data_per_element_ + label_offset_);
+        return (labeltype *) (label_memory_ + internal_id * label_stride_);
     }
 
 
     inline char *getDataByInternalId(tableint internal_id) const {
-        return (data_level0_memory_ + internal_id * size_data_per_element_ + offsetData_);
+        return (vector_memory_ + internal_id * vector_stride_);
     }
 
 
@@ -225,9 +557,8 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
     std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
     searchBaseLayer(tableint ep_id, const void *data_point, int layer) {
-        VisitedList *vl = visited_list_pool_->getFreeVisitedList();
-        vl_type *visited_array = vl->mass;
-        vl_type visited_array_tag = vl->curV;
+        VisitedListHandle vl_handle(visited_list_pool_.get());
+        VisitedList *vl = vl_handle.get();
 
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidateSet;
@@ -242,7 +573,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             lowerBound = std::numeric_limits<dist_t>::max();
             candidateSet.emplace(-lowerBound, ep_id);
         }
-        visited_array[ep_id] = visited_array_tag;
+        vl->testAndSet(ep_id);
 
         while (!candidateSet.empty()) {
             std::pair<dist_t, tableint> curr_el_pair = candidateSet.top();
@@ -253,7 +584,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
             tableint curNodeNum = curr_el_pair.second;
 
-            std::unique_lock <std::mutex> lock(link_list_locks_[curNodeNum]);
+            std::unique_lock <SpinLock> lock(link_list_locks_[curNodeNum]);
 
             int *data;  // = (int *)(linkList0_ + curNodeNum * size_links_per_element0_);
             if (layer == 0) {
@@ -265,8 +596,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             size_t size = getListCount((linklistsizeint*)data);
             tableint *datal = (tableint *) (data + 1);
 #ifdef USE_SSE
-            _mm_prefetch((char *) (visited_array + *(data + 1)), _MM_HINT_T0);
-            _mm_prefetch((char *) (visited_array + *(data + 1) + 64), _MM_HINT_T0);
+            _mm_prefetch(vl->address(*(data + 1)), _MM_HINT_T0);
             _mm_prefetch(getDataByInternalId(*datal), _MM_HINT_T0);
             _mm_prefetch(getDataByInternalId(*(datal + 1)), _MM_HINT_T0);
 #endif
@@ -275,11 +605,10 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 tableint candidate_id = *(datal + j);
 //                    if (candidate_id == 0) continue;
 #ifdef USE_SSE
-                _mm_prefetch((char *) (visited_array + *(datal + j + 1)), _MM_HINT_T0);
+                _mm_prefetch(vl->address(*(datal + j + 1)), _MM_HINT_T0);
                 _mm_prefetch(getDataByInternalId(*(datal + j + 1)), _MM_HINT_T0);
 #endif
-                if (visited_array[candidate_id] == visited_array_tag) continue;
-                visited_array[candidate_id] = visited_array_tag;
+                if (vl->testAndSet(candidate_id)) continue;
                 char *currObj1 = (getDataByInternalId(candidate_id));
 
                 dist_t dist1 = fstdistfunc_(data_point, currObj1, dist_func_param_);
@@ -300,33 +629,104 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 }
             }
         }
-        visited_list_pool_->releaseVisitedList(vl);
 
         return top_candidates;
     }
 
 
+    // Computes the distances from the query to the elements of the given internal ids. The batch kernel of the space
+    // is used if available, and is given the elements in chunks whose pointers fit in a buffer on the stack.
+    void computeQueryDistances(const void *query_data, const tableint *ids, size_t n, dist_t *dists) const {
+        if (!query_batch_fstdistfunc_) {
+            for (size_t i = 0; i < n; i++) {
+                dists[i] = query_fstdistfunc_(query_data, getDataByInternalId(ids[i]), dist_func_param_);
+            }
+            return;
+        }
+        const size_t chunk_size = 32;
+        const void *vectors[chunk_size];
+        for (size_t i = 0; i < n; i += chunk_size) {
+            const size_t n_vectors = std::min(chunk_size, n - i);
+            for (size_t j = 0; j < n_vectors; j++) vectors[j] = getDataByInternalId(ids[i + j]);
+            query_batch_fstdistfunc_(query_data, vectors, n_vectors, dist_func_param_, dists + i);
+        }
+    }
+
+
+    // Sizes the scratch space of the visited list for the neighbors of a node on any layer, and returns its distances.
+    dist_t *prepareNeighborBuffers(VisitedList *vl) const {
+        static_assert(sizeof(dist_t) <= sizeof(uint64_t), "distances must fit in the scratch space of the visited list");
+        const size_t max_neighbors = std::max(maxM0_, maxM_);
+        if (vl->neighbor_ids.size() < max_neighbors) {
+            vl->neighbor_ids.resize(max_neighbors);
+            vl->neighbor_dists.resize(max_neighbors);
+        }
+        return (dist_t *) vl->neighbor_dists.data();
+    }
+
+
+    // Descends the upper layers greedily from the entry point, and returns the closest element found,
+    // from which the search of the bottom layer starts. neighbor_dists must hold maxM_ distances.
+    tableint searchUpperLayers(const void *query_data, dist_t *neighbor_dists) const {
+        tableint currObj = enterpoint_node_;
+        dist_t curdist = query_fstdistfunc_(query_data, getDataByInternalId(enterpoint_node_), dist_func_param_);
+
+        for (int level = maxlevel_; level > 0; level--) {
+            bool changed = true;
+            while (changed) {
+                changed = false;
+                unsigned int *data;
+
+                data = (unsigned int *) get_linklist(currObj, level);
+                int size = getListCount(data);
+                metric_hops++;
+                metric_distance_computations+=size;
+
+                tableint *datal = (tableint *) (data + 1);
+                for (int i = 0; i < size; i++) {
+                    tableint cand = datal[i];
+                    if (cand < 0 || cand > max_elements_)
+                        throw std::runtime_error("cand error");
+                }
+                computeQueryDistances(query_data, datal, size, neighbor_dists);
+
+                for (int i = 0; i < size; i++) {
+                    dist_t d = neighbor_dists[i];
+                    if (d < curdist) {
+                        curdist = d;
+                        currObj = datal[i];
+                        changed = true;
+                    }
+                }
+            }
+        }
+        return currObj;
+    }
+
+
     // bare_bone_search means there is no check for deletions and stop condition is ignored in return of extra performance
+    // vl is the visited list of the search, whose neighbor buffers have been sized by prepareNeighborBuffers.
     template <bool bare_bone_search = true, bool collect_metrics = false>
     std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
     searchBaseLayerST(
+        VisitedList *vl,
         tableint ep_id,
         const void *data_point,
         size_t ef,
         BaseFilterFunctor* isIdAllowed = nullptr,
         BaseSearchStopCondition<dist_t>* stop_condition = nullptr) const {
-        VisitedList *vl = visited_list_pool_->getFreeVisitedList();
-        vl_type *visited_array = vl->mass;
-        vl_type visited_array_tag = vl->curV;
-
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidate_set;
 
+        // The unvisited neighbors of each node and their distances, which are computed at once.
+        tableint *neighbor_ids = vl->neighbor_ids.data();
+        dist_t *neighbor_dists = (dist_t *) vl->neighbor_dists.data();
+
         dist_t lowerBound;
         if (bare_bone_search ||
             (!isMarkedDeleted(ep_id) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(ep_id))))) {
             char* ep_data = getDataByInternalId(ep_id);
-            dist_t dist = fstdistfunc_(data_point, ep_data, dist_func_param_);
+            dist_t dist = query_fstdistfunc_(data_point, ep_data, dist_func_param_);
             lowerBound = dist;
             top_candidates.emplace(dist, ep_id);
             if (!bare_bone_search && stop_condition) {
@@ -338,7 +738,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             candidate_set.emplace(-lowerBound, ep_id);
         }
 
-        visited_array[ep_id] = visited_array_tag;
+        vl->testAndSet(ep_id);
 
         while (!candidate_set.empty()) {
             std::pair<dist_t, tableint> current_node_pair = candidate_set.top();
@@ -369,74 +769,74 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             }
 
 #ifdef USE_SSE
-            _mm_prefetch((char *) (visited_array + *(data + 1)), _MM_HINT_T0);
-            _mm_prefetch((char *) (visited_array + *(data + 1) + 64), _MM_HINT_T0);
-            _mm_prefetch(data_level0_memory_ + (*(data + 1)) * size_data_per_element_ + offsetData_, _MM_HINT_T0);
+            _mm_prefetch(vl->address(*(data + 1)), _MM_HINT_T0);
+            _mm_prefetch(getDataByInternalId(*(data + 1)), _MM_HINT_T0);
             _mm_prefetch((char *) (data + 2), _MM_HINT_T0);
 #endif
 
+            size_t n_neighbors = 0;
             for (size_t j = 1; j <= size; j++) {
                 int candidate_id = *(data + j);
 //                    if (candidate_id == 0) continue;
 #ifdef USE_SSE
-                _mm_prefetch((char *) (visited_array + *(data + j + 1)), _MM_HINT_T0);
-                _mm_prefetch(data_level0_memory_ + (*(data + j + 1)) * size_data_per_element_ + offsetData_,
-                                _MM_HINT_T0);  ////////////
+                _mm_prefetch(vl->address(*(data + j + 1)), _MM_HINT_T0);
+                _mm_prefetch(getDataByInternalId(*(data + j + 1)), _MM_HINT_T0);
 #endif
-                if (!(visited_array[candidate_id] == visited_array_tag)) {
-                    visited_array[candidate_id] = visited_array_tag;
+                if (!vl->testAndSet(candidate_id)) {
+                    neighbor_ids[n_neighbors++] = candidate_id;
+                }
+            }
+            computeQueryDistances(data_point, neighbor_ids, n_neighbors, neighbor_dists);
 
-                    char *currObj1 = (getDataByInternalId(candidate_id));
-                    dist_t dist = fstdistfunc_(data_point, currObj1, dist_func_param_);
+            for (size_t j = 0; j < n_neighbors; j++) {
+                tableint candidate_id = neighbor_ids[j];
+                char *currObj1 = (getDataByInternalId(candidate_id));
+                dist_t dist = neighbor_dists[j];
 
-                    bool flag_consider_candidate;
-                    if (!bare_bone_search && stop_condition) {
-                        flag_consider_candidate = stop_condition->should_consider_candidate(dist, lowerBound);
-                    } else {
-                        flag_consider_candidate = top_candidates.size() < ef || lowerBound > dist;
-                    }
+                bool flag_consider_candidate;
+                if (!bare_bone_search && stop_condition) {
+                    flag_consider_candidate = stop_condition->should_consider_candidate(dist, lowerBound);
+                } else {
+                    flag_consider_candidate = top_candidates.size() < ef || lowerBound > dist;
+                }
 
-                    if (flag_consider_candidate) {
-                        candidate_set.emplace(-dist, candidate_id);
+                if (flag_consider_candidate) {
+                    candidate_set.emplace(-dist, candidate_id);
 #ifdef USE_SSE
-                        _mm_prefetch(data_level0_memory_ + candidate_set.top().second * size_data_per_element_ +
-                                        offsetLevel0_,  ///////////
-                                        _MM_HINT_T0);  ////////////////////////
+                    _mm_prefetch((char *) get_linklist0(candidate_set.top().second), _MM_HINT_T0);
 #endif
 
-                        if (bare_bone_search ||
-                            (!isMarkedDeleted(candidate_id) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(candidate_id))))) {
-                            top_candidates.emplace(dist, candidate_id);
-                            if (!bare_bone_search && stop_condition) {
-                                stop_condition->add_point_to_result(getExternalLabel(candidate_id), currObj1, dist);
-                            }
+                    if (bare_bone_search ||
+                        (!isMarkedDeleted(candidate_id) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(candidate_id))))) {
+                        top_candidates.emplace(dist, candidate_id);
+                        if (!bare_bone_search && stop_condition) {
+                            stop_condition->add_point_to_result(getExternalLabel(candidate_id), currObj1, dist);
                         }
+                    }
 
-                        bool flag_remove_extra = false;
+                    bool flag_remove_extra = false;
+                    if (!bare_bone_search && stop_condition) {
+                        flag_remove_extra = stop_condition->should_remove_extra();
+                    } else {
+                        flag_remove_extra = top_candidates.size() > ef;
+                    }
+                    while (flag_remove_extra) {
+                        tableint id = top_candidates.top().second;
+                        top_candidates.pop();
                         if (!bare_bone_search && stop_condition) {
+                            stop_condition->remove_point_from_result(getExternalLabel(id), getDataByInternalId(id), dist);
                             flag_remove_extra = stop_condition->should_remove_extra();
                         } else {
                             flag_remove_extra = top_candidates.size() > ef;
                         }
-                        while (flag_remove_extra) {
-                            tableint id = top_candidates.top().second;
-                            top_candidates.pop();
-                            if (!bare_bone_search && stop_condition) {
-                                stop_condition->remove_point_from_result(getExternalLabel(id), getDataByInternalId(id), dist);
-                                flag_remove_extra = stop_condition->should_remove_extra();
-                            } else {
-                                flag_remove_extra = top_candidates.size() > ef;
-                            }
-                        }
-
-                        if (!top_candidates.empty())
-                            lowerBound = top_candidates.top().first;
                     }
+
+                    if (!top_candidates.empty())
+                        lowerBound = top_candidates.top().first;
                 }
             }
         }
 
-        visited_list_pool_->releaseVisitedList(vl);
         return top_candidates;
     }
 
@@ -485,7 +885,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
 
     linklistsizeint *get_linklist0(tableint internal_id) const {
-        return (linklistsizeint *) (data_level0_memory_ + internal_id * size_data_per_element_ + offsetLevel0_);
+        return (linklistsizeint *) (links_level0_memory_ + internal_id * links_level0_stride_);
     }
 
 
@@ -527,7 +927,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         {
             // lock only during the update
             // because during the addition the lock for cur_c is already acquired
-            std::unique_lock <std::mutex> lock(link_list_locks_[cur_c], std::defer_lock);
+            std::unique_lock <SpinLock> lock(link_list_locks_[cur_c], std::defer_lock);
             if (isUpdate) {
                 lock.lock();
             }
@@ -540,7 +940,6 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             if (*ll_cur && !isUpdate) {
                 throw std::runtime_error("The newly inserted element should have blank link list");
             }
-            setListCount(ll_cur, selectedNeighbors.size());
             tableint *data = (tableint *) (ll_cur + 1);
             for (size_t idx = 0; idx < selectedNeighbors.size(); idx++) {
                 if (data[idx] && !isUpdate)
@@ -550,10 +949,12 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
                 data[idx] = selectedNeighbors[idx];
             }
+            // The entries are written before the count that makes them visible to the searches (see setListCount).
+            setListCount(ll_cur, selectedNeighbors.size());
         }
 
         for (size_t idx = 0; idx < selectedNeighbors.size(); idx++) {
-            std::unique_lock <std::mutex> lock(link_list_locks_[selectedNeighbors[idx]]);
+            std::unique_lock <SpinLock> lock(link_list_locks_[selectedNeighbors[idx]]);
 
             linklistsizeint *ll_other;
             if (level == 0)
@@ -631,7 +1032,181 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
+    // Allocates the base layer for the given number of elements in the current layout, and sets the pointers to
+    // the parts of the first element. Returns false if the memory cannot be allocated.
+    bool allocateLevel0(size_t max_elements) {
+        if (!split_layout_) {
+            data_level0_memory_ = (char *) allocateLevel0Block(max_elements * size_data_per_element_);
+            if (data_level0_memory_ == nullptr) return false;
+            setLevel0Pointers();
+            return true;
+        }
+        links_level0_memory_ = (char *) allocateLevel0Block(max_elements * size_links_level0_);
+        vector_memory_ = (char *) allocateLevel0Block(max_elements * data_size_);
+        label_memory_ = (char *) allocateLevel0Block(max_elements * sizeof(labeltype));
+        if (links_level0_memory_ == nullptr || vector_memory_ == nullptr || label_memory_ == nullptr) {
+            freeLevel0();
+            return false;
+        }
+        setLevel0Pointers();
+        return true;
+    }
+
+    bool reallocateLevel0(size_t new_max_elements) {
+        if (!split_layout_) {
+            char *data_level0_memory_new = nullptr;
+            if (huge_pages_ || level0_mmap_addr_) {
+                data_level0_memory_new = (char *) allocateLevel0Block(new_max_elements * size_data_per_element_);
+                if (data_level0_memory_new == nullptr) return false;
+                memcpy(data_level0_memory_new, data_level0_memory_, cur_element_count * size_data_per_element_);
+                freeLevel0();
+            } else {
+                data_level0_memory_new = (char *) realloc(data_level0_memory_, new_max_elements * size_data_per_element_);
+                if (data_level0_memory_new == nullptr) return false;
+            }
+            data_level0_memory_ = data_level0_memory_new;
+            setLevel0Pointers();
+            return true;
+        }
+        char *links_level0_memory_new = (char *) allocateLevel0Block(new_max_elements * size_links_level0_);
+        char *vector_memory_new = (char *) allocateLevel0Block(new_max_elements * data_size_);
+        char *label_memory_new = (char *) allocateLevel0Block(new_max_elements * sizeof(labeltype));
+        if (links_level0_memory_new == nullptr || vector_memory_new == nullptr || label_memory_new == nullptr) {
+            freeLevel0Block(links_level0_memory_new);
+            freeLevel0Block(vector_memory_new);
+            freeLevel0Block(label_memory_new);
+            return false;
+        }
+        memcpy(links_level0_memory_new, links_level0_memory_, cur_element_count * size_links_level0_);
+        memcpy(vector_memory_new, vector_memory_, cur_element_count * data_size_);
+        memcpy(label_memory_new, label_memory_, cur_element_count * sizeof(labeltype));
+        freeLevel0();
+        links_level0_memory_ = links_level0_memory_new;
+        vector_memory_ = vector_memory_new;
+        label_memory_ = label_memory_new;
+        setLevel0Pointers();
+        return true;
+    }
+
+    // The interleaved records are allocated with malloc so that they can be resized with realloc,
+    // and the arrays of the split layout are aligned to cache lines.
+    void *allocateLevel0Block(size_t size) const {
+        if (huge_pages_) return hugePageMalloc(size);
+        return split_layout_ ? alignedMalloc(size) : malloc(size);
+    }
+
+    void freeLevel0Block(void *ptr) const {
+        if (huge_pages_) {
+            hugePageFree(ptr);
+        } else if (split_layout_) {
+            alignedFree(ptr);
+        } else {
+            free(ptr);
+        }
+    }
+
+    void setLevel0Pointers() {
+        if (split_layout_) {
+            links_level0_stride_ = size_links_level0_;
+            vector_stride_ = data_size_;
+            label_stride_ = sizeof(labeltype);
+        } else {
+            links_level0_memory_ = data_level0_memory_ + offsetLevel0_;
+            vector_memory_ = data_level0_memory_ + offsetData_;
+            label_memory_ = data_level0_memory_ + label_offset_;
+            links_level0_stride_ = vector_stride_ = label_stride_ = size_data_per_element_;
+        }
+    }
+
+    /*
+    * Maps the base layer of the index file copy-on-write instead of reading it, so that loading does not copy
+    * the records and the processes loading the same file share its pages in the page cache. The records start
+    * at header_size in the file, and as the file is mapped from its beginning, they need not be page aligned.
+    * The capacity for the elements beyond the file is mapped as anonymous memory right after the records.
+    * Returns false if memory mapping is not available.
+    */
+    bool mapLevel0(const std::string &location, size_t header_size, size_t max_elements) {
+#if defined(HNSWLIB_HAVE_MMAP)
+        const size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+        const size_t file_size = header_size + cur_element_count * size_data_per_element_;
+        const size_t length = (header_size + max_elements * size_data_per_element_ + page_size - 1) / page_size * page_size;
+        void *addr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED)
+            throw std::runtime_error("Not enough memory: loadIndex failed to map level0");
+        const int fd = open(location.c_str(), O_RDONLY);
+        if (fd < 0 || mmap(addr, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            if (fd >= 0) close(fd);
+            munmap(addr, length);
+            throw std::runtime_error("Cannot map index file");
+        }
+        close(fd);
+        level0_mmap_addr_ = addr;
+        level0_mmap_size_ = length;
+        data_level0_memory_ = (char *) addr + header_size;
+        setLevel0Pointers();
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void freeLevel0() {
+#if defined(HNSWLIB_HAVE_MMAP)
+        if (level0_mmap_addr_) {
+            munmap(level0_mmap_addr_, level0_mmap_size_);
+            level0_mmap_addr_ = nullptr;
+            level0_mmap_size_ = 0;
+            data_level0_memory_ = nullptr;
+            links_level0_memory_ = vector_memory_ = label_memory_ = nullptr;
+            return;
+        }
+#endif
+        if (split_layout_) {
+            freeLevel0Block(links_level0_memory_);
+            freeLevel0Block(vector_memory_);
+            freeLevel0Block(label_memory_);
+        } else {
+            freeLevel0Block(data_level0_memory_);
+        }
+        data_level0_memory_ = nullptr;
+        links_level0_memory_ = vector_memory_ = label_memory_ = nullptr;
+    }
+
+    // The index files always store the base layer as interleaved records, so that they do not depend on the layout.
+    // The split layout converts the records in chunks while saving and loading them.
+    void writeSplitLevel0(std::ostream &output) const {
+        const size_t chunk_size = 1024;
+        std::vector<char> records(chunk_size * size_data_per_element_);
+        for (size_t i = 0; i < cur_element_count; i += chunk_size) {
+            const size_t n_records = std::min(chunk_size, cur_element_count - i);
+            for (size_t j = 0; j < n_records; j++) {
+                char *record = records.data() + j * size_data_per_element_;
+                memcpy(record + offsetLevel0_, get_linklist0(i + j), size_links_level0_);
+                memcpy(record + offsetData_, getDataByInternalId(i + j), data_size_);
+                memcpy(record + label_offset_, getExternalLabeLp(i + j), sizeof(labeltype));
+            }
+            output.write(records.data(), n_records * size_data_per_element_);
+        }
+    }
+
+    void readSplitLevel0(std::istream &input) {
+        const size_t chunk_size = 1024;
+        std::vector<char> records(chunk_size * size_data_per_element_);
+        for (size_t i = 0; i < cur_element_count; i += chunk_size) {
+            const size_t n_records = std::min(chunk_size, cur_element_count - i);
+            input.read(records.data(), n_records * size_data_per_element_);
+            for (size_t j = 0; j < n_records; j++) {
+                const char *record = records.data() + j * size_data_per_element_;
+                memcpy(get_linklist0(i + j), record + offsetLevel0_, size_links_level0_);
+                memcpy(getDataByInternalId(i + j), record + offsetData_, data_size_);
+                memcpy(getExternalLabeLp(i + j), record + label_offset_, sizeof(labeltype));
+            }
+        }
+    }
+
+
     void resizeIndex(size_t new_max_elements) {
+        checkWritable();
         if (new_max_elements < cur_element_count)
             throw std::runtime_error("Cannot resize, max element is less than the current number of elements");
 
@@ -639,13 +1214,11 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
         element_levels_.resize(new_max_elements);
 
-        std::vector<std::mutex>(new_max_elements).swap(link_list_locks_);
+        std::vector<SpinLock>(new_max_elements).swap(link_list_locks_);
 
         // Reallocate base layer
-        char * data_level0_memory_new = (char *) realloc(data_level0_memory_, new_max_elements * size_data_per_element_);
-        if (data_level0_memory_new == nullptr)
+        if (!reallocateLevel0(new_max_elements))
             throw std::runtime_error("Not enough memory: resizeIndex failed to allocate base layer");
-        data_level0_memory_ = data_level0_memory_new;
 
         // Reallocate all other layers
         char ** linkLists_new = (char **) realloc(linkLists_, sizeof(void *) * new_max_elements);
@@ -653,9 +1226,94 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             throw std::runtime_error("Not enough memory: resizeIndex failed to allocate other layers");
         linkLists_ = linkLists_new;
 
+        if (rerank_data_) {
+            char *rerank_data_new = (char *) malloc(new_max_elements * rerank_data_size_);
+            if (rerank_data_new == nullptr)
+                throw std::runtime_error("Not enough memory: resizeIndex failed to allocate rerank data");
+            memcpy(rerank_data_new, rerank_data_, cur_element_count * rerank_data_size_);
+            freeRerankData();
+            rerank_data_ = rerank_data_new;
+        }
+
         max_elements_ = new_max_elements;
     }
 
+
+    /*
+    * Renumbers the internal ids in the breadth-first order of the bottom layer starting from the entry point,
+    * so that the neighbors of an element are stored close to it and traversing the graph touches fewer pages.
+    * The labels, the graph, and the search results do not change. As the index files store the elements in the
+    * order of internal ids, the new order is kept by saveIndex. It must not run concurrently with other operations.
+    */
+    void reorderGraph() {
+        checkWritable();
+        const size_t n_elements = cur_element_count;
+        if (n_elements == 0) return;
+
+        std::vector<tableint> order;
+        order.reserve(n_elements);
+        std::vector<bool> queued(n_elements, false);
+        tableint start = enterpoint_node_;
+        tableint next_start = 0;
+        while (true) {
+            queued[start] = true;
+            order.push_back(start);
+            for (size_t head = order.size() - 1; head < order.size(); head++) {
+                linklistsizeint *ll = get_linklist0(order[head]);
+                const size_t size = getListCount(ll);
+                const tableint *datal = (tableint *) (ll + 1);
+                for (size_t j = 0; j < size; j++) {
+                    if (queued[datal[j]]) continue;
+                    queued[datal[j]] = true;
+                    order.push_back(datal[j]);
+                }
+            }
+            if (order.size() == n_elements) break;
+            // The elements unreachable from the entry point follow in the order of their current ids.
+            while (queued[next_start]) next_start++;
+            start = next_start;
+        }
+
+        std::vector<tableint> new_ids(n_elements);
+        for (size_t i = 0; i < n_elements; i++) new_ids[order[i]] = i;
+
+        permuteRows(links_level0_memory_, links_level0_stride_, size_links_level0_, order);
+        permuteRows(vector_memory_, vector_stride_, data_size_, order);
+        permuteRows(label_memory_, label_stride_, sizeof(labeltype), order);
+        if (rerank_data_)
+            permuteRows(rerank_data_, rerank_data_size_, rerank_data_size_, order);
+
+        std::vector<char *> link_lists(linkLists_, linkLists_ + n_elements);
+        std::vector<int> element_levels(element_levels_.begin(), element_levels_.begin() + n_elements);
+        for (size_t i = 0; i < n_elements; i++) {
+            linkLists_[i] = link_lists[order[i]];
+            element_levels_[i] = element_levels[order[i]];
+        }
+
+        for (size_t i = 0; i < n_elements; i++) {
+            for (int level = 0; level <= element_levels_[i]; level++) {
+                linklistsizeint *ll = get_linklist_at_level(i, level);
+                const size_t size = getListCount(ll);
+                tableint *datal = (tableint *) (ll + 1);
+                for (size_t j = 0; j < size; j++) datal[j] = new_ids[datal[j]];
+            }
+        }
+
+        label_lookup_.forEach([&new_ids](labeltype, tableint &id) { id = new_ids[id]; });
+        std::unordered_set<tableint> deleted;
+        for (tableint id : deleted_elements) deleted.insert(new_ids[id]);
+        deleted_elements.swap(deleted);
+        enterpoint_node_ = new_ids[enterpoint_node_];
+    }
+
+
+    // Moves the row of each element in order[i] to the i-th row.
+    void permuteRows(char *base, size_t stride, size_t row_size, const std::vector<tableint> &order) {
+        std::vector<char> rows(order.size() * row_size);
+        for (size_t i = 0; i < order.size(); i++) memcpy(rows.data() + i * row_size, base + order[i] * stride, row_size);
+        for (size_t i = 0; i < order.size(); i++) memcpy(base + i * stride, rows.data() + i * row_size, row_size);
+    }
+
     size_t indexFileSize() const {
         size_t size = 0;
         size += sizeof(offsetLevel0_);
@@ -684,7 +1342,10 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
     void saveIndex(const std::string &location) {
-        std::ofstream output(location, std::ios::binary);
+        // Truncating the file the base layer is mapped from would remove the pages under the mapping,
+        // so the index is written to a temporary file that then replaces it.
+        const std::string path = level0_mmap_addr_ ? location + ".tmp" : location;
+        std::ofstream output(path, std::ios::binary);
         std::streampos position;
 
         writeBinaryPOD(output, offsetLevel0_);
@@ -702,7 +1363,11 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         writeBinaryPOD(output, mult_);
         writeBinaryPOD(output, ef_construction_);
 
-        output.write(data_level0_memory_, cur_element_count * size_data_per_element_);
+        if (split_layout_) {
+            writeSplitLevel0(output);
+        } else {
+            output.write(data_level0_memory_, cur_element_count * size_data_per_element_);
+        }
 
         for (size_t i = 0; i < cur_element_count; i++) {
             unsigned int linkListSize = element_levels_[i] > 0 ? size_links_per_element_ * element_levels_[i] : 0;
@@ -710,11 +1375,150 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             if (linkListSize)
                 output.write(linkLists_[i], linkListSize);
         }
+        if (space_)
+            space_->save_state(output);
+        output.close();
+        if (path != location && std::rename(path.c_str(), location.c_str()) != 0)
+            throw std::runtime_error("Cannot replace index file");
+    }
+
+
+    /*
+    * Hashes the header and the upper layer link lists with FNV-1a. They are read into memory by loadIndex even if
+    * the base layer is mapped, so that a label index can be checked against the loaded index without reading
+    * the records of the base layer.
+    */
+    uint64_t indexChecksum() const {
+        uint64_t hash = 0xcbf29ce484222325;
+        auto update = [&hash](const void *data, size_t size) {
+            const unsigned char *bytes = (const unsigned char *) data;
+            for (size_t i = 0; i < size; i++) hash = (hash ^ bytes[i]) * 0x100000001b3;
+        };
+        const size_t n_elements = cur_element_count;
+        update(&n_elements, sizeof(n_elements));
+        update(&size_data_per_element_, sizeof(size_data_per_element_));
+        update(&maxlevel_, sizeof(maxlevel_));
+        update(&enterpoint_node_, sizeof(enterpoint_node_));
+        update(&maxM_, sizeof(maxM_));
+        update(&maxM0_, sizeof(maxM0_));
+        update(&M_, sizeof(M_));
+        update(&mult_, sizeof(mult_));
+        update(&ef_construction_, sizeof(ef_construction_));
+        for (size_t i = 0; i < n_elements; i++) {
+            const unsigned int linkListSize = element_levels_[i] > 0 ? size_links_per_element_ * element_levels_[i] : 0;
+            update(&linkListSize, sizeof(linkListSize));
+            if (linkListSize) update(linkLists_[i], linkListSize);
+        }
+        return hash;
+    }
+
+
+    // Identifies the index file that a label index was saved with.
+    struct IndexFingerprint {
+        uint64_t file_size;
+        int64_t modified_time;
+        uint64_t checksum;
+
+        bool operator==(const IndexFingerprint &other) const {
+            return file_size == other.file_size && modified_time == other.modified_time && checksum == other.checksum;
+        }
+    };
+
+    IndexFingerprint indexFingerprint(const std::string &index_location) const {
+        struct stat st;
+        if (stat(index_location.c_str(), &st) != 0)
+            throw std::runtime_error("Cannot open file");
+        return {(uint64_t) st.st_size, (int64_t) st.st_mtime, indexChecksum()};
+    }
+
+
+    /*
+    * Saves label_lookup_ and the internal ids of the deleted elements to a file apart from the index, so that the index
+    * file keeps the format read by the other versions of hnswlib. loadIndex can read the table back as it is instead of
+    * reading the label and the delete mark from every record of the base layer, which would bring the whole base layer
+    * into memory even if it is mapped. The file records the fingerprint of the index file saved at index_location,
+    * since the index file can be saved again without it.
+    */
+    void saveLabelIndex(const std::string &location, const std::string &index_location) const {
+        const IndexFingerprint fingerprint = indexFingerprint(index_location);
+        std::ofstream output(location, std::ios::binary);
+        if (!output.is_open())
+            throw std::runtime_error("Cannot open file");
+
+        std::vector<tableint> deleted_ids;
+        for (size_t i = 0; i < cur_element_count; i++) {
+            if (isMarkedDeleted(i)) deleted_ids.push_back(i);
+        }
+        const uint64_t magic = LABEL_INDEX_MAGIC;
+        const size_t n_elements = cur_element_count;
+        const size_t n_deleted = deleted_ids.size();
+        writeBinaryPOD(output, magic);
+        writeBinaryPOD(output, fingerprint);
+        writeBinaryPOD(output, n_elements);
+        writeBinaryPOD(output, n_deleted);
+        output.write((const char *) deleted_ids.data(), n_deleted * sizeof(tableint));
+        label_lookup_.save(output);
         output.close();
     }
 
 
-    void loadIndex(const std::string &location, SpaceInterface<dist_t> *s, size_t max_elements_i = 0) {
+    /*
+    * Reads the file saved by saveLabelIndex into label_lookup_ and deleted_elements after the elements are loaded from
+    * the index file at index_location. Returns false without reading the table if the file is missing or was saved with
+    * another index file, so that the labels are read from the records instead.
+    */
+    bool loadLabelIndex(const std::string &location, const std::string &index_location) {
+        std::ifstream input(location, std::ios::binary);
+        if (!input.is_open())
+            return false;
+
+        input.seekg(0, input.end);
+        const std::streamoff total_filesize = input.tellg();
+        input.seekg(0, input.beg);
+        const std::streamoff header_size = sizeof(uint64_t) + sizeof(IndexFingerprint) + 2 * sizeof(size_t);
+        if (total_filesize < header_size)
+            return false;
+        uint64_t magic;
+        IndexFingerprint fingerprint;
+        size_t n_elements, n_deleted;
+        readBinaryPOD(input, magic);
+        readBinaryPOD(input, fingerprint);
+        readBinaryPOD(input, n_elements);
+        readBinaryPOD(input, n_deleted);
+        if (magic != LABEL_INDEX_MAGIC || !(fingerprint == indexFingerprint(index_location)) ||
+            n_elements != cur_element_count)
+            return false;
+
+        const char *corrupted = "Label index seems to be corrupted";
+        if (n_deleted > n_elements || total_filesize - header_size < (std::streamoff) (n_deleted * sizeof(tableint)))
+            throw std::runtime_error(corrupted);
+        std::vector<tableint> deleted_ids(n_deleted);
+        input.read((char *) deleted_ids.data(), n_deleted * sizeof(tableint));
+        for (tableint id : deleted_ids) {
+            if (id >= cur_element_count)
+                throw std::runtime_error(corrupted);
+        }
+        const std::streamoff table_size = total_filesize - header_size - (std::streamoff) (n_deleted * sizeof(tableint));
+        // Every element keeps its label until it is replaced, so that the table holds one label per element.
+        if (!label_lookup_.load(input, table_size, cur_element_count) || label_lookup_.size() != cur_element_count ||
+            input.tellg() != total_filesize)
+            throw std::runtime_error(corrupted);
+        input.close();
+
+        num_deleted_ = n_deleted;
+        if (allow_replace_deleted_) deleted_elements.insert(deleted_ids.begin(), deleted_ids.end());
+        return true;
+    }
+
+
+    /*
+    * Loads the index saved by saveIndex. If use_mmap is true, the base layer is mapped from the file (see mapLevel0),
+    * which is available only for the interleaved layout without huge pages. If label_index_location is given,
+    * the labels are read from the file saved by saveLabelIndex instead of the records of the elements, unless
+    * the file does not match the index file.
+    */
+    void loadIndex(const std::string &location, SpaceInterface<dist_t> *s, size_t max_elements_i = 0, bool split_layout = false,
+                   bool huge_pages = false, bool use_mmap = false, const std::string &label_index_location = std::string()) {
         std::ifstream input(location, std::ios::binary);
 
         if (!input.is_open())
@@ -746,13 +1550,17 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         readBinaryPOD(input, mult_);
         readBinaryPOD(input, ef_construction_);
 
+        space_ = s;
         data_size_ = s->get_data_size();
         fstdistfunc_ = s->get_dist_func();
+        query_fstdistfunc_ = s->get_query_dist_func();
+        query_batch_fstdistfunc_ = s->get_query_batch_dist_func();
         dist_func_param_ = s->get_dist_func_param();
 
         auto pos = input.tellg();
 
         /// Optional - check if index is ok:
+        size_t link_lists_size = 0;
         input.seekg(cur_element_count * size_data_per_element_, input.cur);
         for (size_t i = 0; i < cur_element_count; i++) {
             if (input.tellg() < 0 || input.tellg() >= total_filesize) {
@@ -763,11 +1571,12 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             readBinaryPOD(input, linkListSize);
             if (linkListSize != 0) {
                 input.seekg(linkListSize, input.cur);
+                link_lists_size += (linkListSize + sizeof(tableint) - 1) / sizeof(tableint) * sizeof(tableint);
             }
         }
 
         // throw exception if it either corrupted or old index
-        if (input.tellg() != total_filesize)
+        if (input.tellg() + (std::streamoff) s->get_state_size() != total_filesize)
             throw std::runtime_error("Index seems to be corrupted or unsupported");
 
         input.clear();
@@ -775,15 +1584,25 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
         input.seekg(pos, input.beg);
 
-        data_level0_memory_ = (char *) malloc(max_elements * size_data_per_element_);
-        if (data_level0_memory_ == nullptr)
-            throw std::runtime_error("Not enough memory: loadIndex failed to allocate level0");
-        input.read(data_level0_memory_, cur_element_count * size_data_per_element_);
+        size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
+        split_layout_ = split_layout;
+        huge_pages_ = huge_pages;
+        if (split_layout_ && size_data_per_element_ != size_links_level0_ + data_size_ + sizeof(labeltype))
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        if (use_mmap && !split_layout_ && !huge_pages_ && mapLevel0(location, (size_t) pos, max_elements)) {
+            input.seekg(cur_element_count * size_data_per_element_, input.cur);
+        } else {
+            if (!allocateLevel0(max_elements))
+                throw std::runtime_error("Not enough memory: loadIndex failed to allocate level0");
+            if (split_layout_) {
+                readSplitLevel0(input);
+            } else {
+                input.read(data_level0_memory_, cur_element_count * size_data_per_element_);
+            }
+        }
 
         size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
-
-        size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
-        std::vector<std::mutex>(max_elements).swap(link_list_locks_);
+        std::vector<SpinLock>(max_elements).swap(link_list_locks_);
         std::vector<std::mutex>(MAX_LABEL_OPERATION_LOCKS).swap(label_op_locks_);
 
         visited_list_pool_.reset(new VisitedListPool(1, max_elements));
@@ -792,10 +1611,12 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         if (linkLists_ == nullptr)
             throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklists");
         element_levels_ = std::vector<int>(max_elements);
+        link_list_arena_.setHugePages(huge_pages_);
+        if (link_lists_size > 0 && !link_list_arena_.reserve(link_lists_size))
+            throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklists");
         revSize_ = 1.0 / mult_;
         ef_ = 10;
         for (size_t i = 0; i < cur_element_count; i++) {
-            label_lookup_[getExternalLabel(i)] = i;
             unsigned int linkListSize;
             readBinaryPOD(input, linkListSize);
             if (linkListSize == 0) {
@@ -803,17 +1624,25 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 linkLists_[i] = nullptr;
             } else {
                 element_levels_[i] = linkListSize / size_links_per_element_;
-                linkLists_[i] = (char *) malloc(linkListSize);
+                linkLists_[i] = link_list_arena_.allocate(linkListSize);
                 if (linkLists_[i] == nullptr)
                     throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklist");
                 input.read(linkLists_[i], linkListSize);
             }
         }
+        s->load_state(input);
 
-        for (size_t i = 0; i < cur_element_count; i++) {
-            if (isMarkedDeleted(i)) {
-                num_deleted_ += 1;
-                if (allow_replace_deleted_) deleted_elements.insert(i);
+        label_lookup_.clear();
+        deleted_elements.clear();
+        num_deleted_ = 0;
+        if (label_index_location.empty() || !loadLabelIndex(label_index_location, location)) {
+            label_lookup_.reserve(cur_element_count);
+            for (size_t i = 0; i < cur_element_count; i++) {
+                label_lookup_.insert(getExternalLabel(i), i);
+                if (isMarkedDeleted(i)) {
+                    num_deleted_ += 1;
+                    if (allow_replace_deleted_) deleted_elements.insert(i);
+                }
             }
         }
 
@@ -825,16 +1654,18 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
     template<typename data_t>
     std::vector<data_t> getDataByLabel(labeltype label) const {
-        // lock all operations with element by label
-        std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
-
-        std::unique_lock <std::mutex> lock_table(label_lookup_lock);
-        auto search = label_lookup_.find(label);
-        if (search == label_lookup_.end() || isMarkedDeleted(search->second)) {
+        // lock all operations with element by label unless the index is read-only
+        std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label), std::defer_lock);
+        std::unique_lock <std::mutex> lock_table(label_lookup_.getLock(label), std::defer_lock);
+        if (!read_only_) {
+            lock_label.lock();
+            lock_table.lock();
+        }
+        tableint internalId;
+        if (!label_lookup_.find(label, internalId) || isMarkedDeleted(internalId)) {
             throw std::runtime_error("Label not found");
         }
-        tableint internalId = search->second;
-        lock_table.unlock();
+        if (lock_table.owns_lock()) lock_table.unlock();
 
         char* data_ptrv = getDataByInternalId(internalId);
         size_t dim = *((size_t *) dist_func_param_);
@@ -848,19 +1679,38 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
+    // Copies the stored vector of the given label as is, in the storage format of the space.
+    void getRawDataByLabel(labeltype label, void *data) const {
+        // lock all operations with element by label unless the index is read-only
+        std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label), std::defer_lock);
+        std::unique_lock <std::mutex> lock_table(label_lookup_.getLock(label), std::defer_lock);
+        if (!read_only_) {
+            lock_label.lock();
+            lock_table.lock();
+        }
+        tableint internalId;
+        if (!label_lookup_.find(label, internalId) || isMarkedDeleted(internalId)) {
+            throw std::runtime_error("Label not found");
+        }
+        if (lock_table.owns_lock()) lock_table.unlock();
+
+        memcpy(data, getDataByInternalId(internalId), data_size_);
+    }
+
+
     /*
     * Marks an element with the given label deleted, does NOT really change the current graph.
     */
     void markDelete(labeltype label) {
+        checkWritable();
         // lock all operations with element by label
         std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
 
-        std::unique_lock <std::mutex> lock_table(label_lookup_lock);
-        auto search = label_lookup_.find(label);
-        if (search == label_lookup_.end()) {
+        std::unique_lock <std::mutex> lock_table(label_lookup_.getLock(label));
+        tableint internalId;
+        if (!label_lookup_.find(label, internalId)) {
             throw std::runtime_error("Label not found");
         }
-        tableint internalId = search->second;
         lock_table.unlock();
 
         markDeletedInternal(internalId);
@@ -894,15 +1744,15 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     *  because elements marked as deleted can be completely removed by addPoint
     */
     void unmarkDelete(labeltype label) {
+        checkWritable();
         // lock all operations with element by label
         std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
 
-        std::unique_lock <std::mutex> lock_table(label_lookup_lock);
-        auto search = label_lookup_.find(label);
-        if (search == label_lookup_.end()) {
+        std::unique_lock <std::mutex> lock_table(label_lookup_.getLock(label));
+        tableint internalId;
+        if (!label_lookup_.find(label, internalId)) {
             throw std::runtime_error("Label not found");
         }
-        tableint internalId = search->second;
         lock_table.unlock();
 
         unmarkDeletedInternal(internalId);
@@ -938,13 +1788,28 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
+    /*
+    * The searches read the link lists without locks, so the count is loaded with acquire ordering and stored with
+    * release ordering: a search that reads a count also sees the entries written before it.
+    */
     unsigned short int getListCount(linklistsizeint * ptr) const {
-        return *((unsigned short int *)ptr);
+#if defined(__GNUC__)
+        return __atomic_load_n((unsigned short int *) ptr, __ATOMIC_ACQUIRE);
+#else
+        const unsigned short int size = *((volatile unsigned short int *) ptr);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return size;
+#endif
     }
 
 
     void setListCount(linklistsizeint * ptr, unsigned short int size) const {
-        *((unsigned short int*)(ptr))=*((unsigned short int *)&size);
+#if defined(__GNUC__)
+        __atomic_store_n((unsigned short int *) ptr, size, __ATOMIC_RELEASE);
+#else
+        std::atomic_thread_fence(std::memory_order_release);
+        *((volatile unsigned short int *) ptr) = size;
+#endif
     }
 
 
@@ -953,6 +1818,15 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     * If replacement of deleted elements is enabled: replaces previously deleted point if any, updating it with new point
     */
     void addPoint(const void *data_point, labeltype label, bool replace_deleted = false) {
+        addPoint(data_point, nullptr, label, replace_deleted);
+    }
+
+
+    /*
+    * Adds point along with its full precision vector, which is kept for re-ranking if enableRerank was called.
+    */
+    void addPoint(const void *data_point, const void *rerank_point, labeltype label, bool replace_deleted = false) {
+        checkWritable();
         if ((allow_replace_deleted_ == false) && (replace_deleted == true)) {
             throw std::runtime_error("Replacement of deleted elements is disabled in constructor");
         }
@@ -960,7 +1834,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         // lock all operations with element by label
         std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
         if (!replace_deleted) {
-            addPoint(data_point, label, -1);
+            addPoint(data_point, label, -1, rerank_point);
             return;
         }
         // check if there is vacant place
@@ -976,26 +1850,31 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         // if there is no vacant place then add or update point
         // else add point to vacant place
         if (!is_vacant_place) {
-            addPoint(data_point, label, -1);
+            addPoint(data_point, label, -1, rerank_point);
         } else {
             // we assume that there are no concurrent operations on deleted element
             labeltype label_replaced = getExternalLabel(internal_id_replaced);
             setExternalLabel(internal_id_replaced, label);
 
-            std::unique_lock <std::mutex> lock_table(label_lookup_lock);
+            std::unique_lock <std::mutex> lock_table_replaced(label_lookup_.getLock(label_replaced));
             label_lookup_.erase(label_replaced);
-            label_lookup_[label] = internal_id_replaced;
+            lock_table_replaced.unlock();
+            std::unique_lock <std::mutex> lock_table(label_lookup_.getLock(label));
+            label_lookup_.insert(label, internal_id_replaced);
             lock_table.unlock();
 
             unmarkDeletedInternal(internal_id_replaced);
-            updatePoint(data_point, internal_id_replaced, 1.0);
+            updatePoint(data_point, internal_id_replaced, 1.0, rerank_point);
         }
     }
 
 
-    void updatePoint(const void *dataPoint, tableint internalId, float updateNeighborProbability) {
+    void updatePoint(const void *dataPoint, tableint internalId, float updateNeighborProbability,
+                     const void *rerankPoint = nullptr) {
         // update the feature vector associated with existing point with new vector
         memcpy(getDataByInternalId(internalId), dataPoint, data_size_);
+        if (rerank_data_ && rerankPoint)
+            memcpy(rerank_data_ + internalId * rerank_data_size_, rerankPoint, rerank_data_size_);
 
         int maxLevelCopy = maxlevel_;
         tableint entryPointCopy = enterpoint_node_;
@@ -1054,16 +1933,16 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 getNeighborsByHeuristic2(candidates, layer == 0 ? maxM0_ : maxM_);
 
                 {
-                    std::unique_lock <std::mutex> lock(link_list_locks_[neigh]);
+                    std::unique_lock <SpinLock> lock(link_list_locks_[neigh]);
                     linklistsizeint *ll_cur;
                     ll_cur = get_linklist_at_level(neigh, layer);
                     size_t candSize = candidates.size();
-                    setListCount(ll_cur, candSize);
                     tableint *data = (tableint *) (ll_cur + 1);
                     for (size_t idx = 0; idx < candSize; idx++) {
                         data[idx] = candidates.top().second;
                         candidates.pop();
                     }
+                    setListCount(ll_cur, candSize);
                 }
             }
         }
@@ -1086,7 +1965,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 while (changed) {
                     changed = false;
                     unsigned int *data;
-                    std::unique_lock <std::mutex> lock(link_list_locks_[currObj]);
+                    std::unique_lock <SpinLock> lock(link_list_locks_[currObj]);
                     data = get_linklist_at_level(currObj, level);
                     int size = getListCount(data);
                     tableint *datal = (tableint *) (data + 1);
@@ -1141,7 +2020,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
 
     std::vector<tableint> getConnectionsWithLock(tableint internalId, int level) {
-        std::unique_lock <std::mutex> lock(link_list_locks_[internalId]);
+        std::unique_lock <SpinLock> lock(link_list_locks_[internalId]);
         unsigned int *data = get_linklist_at_level(internalId, level);
         int size = getListCount(data);
         std::vector<tableint> result(size);
@@ -1151,15 +2030,30 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
-    tableint addPoint(const void *data_point, labeltype label, int level) {
+    // Descends the upper layers greedily and returns the ef closest candidates found on the bottom layer.
+    std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
+    searchCandidates(const void *query_data, size_t ef, BaseFilterFunctor* isIdAllowed) const {
+        VisitedListHandle vl_handle(visited_list_pool_.get());
+        VisitedList *vl = vl_handle.get();
+        const tableint currObj = searchUpperLayers(query_data, prepareNeighborBuffers(vl));
+
+        bool bare_bone_search = !num_deleted_ && !isIdAllowed;
+        if (bare_bone_search) {
+            return searchBaseLayerST<true>(vl, currObj, query_data, ef, isIdAllowed);
+        }
+        return searchBaseLayerST<false>(vl, currObj, query_data, ef, isIdAllowed);
+    }
+
+
+    tableint addPoint(const void *data_point, labeltype label, int level, const void *rerank_point = nullptr) {
+        checkWritable();
         tableint cur_c = 0;
         {
             // Checking if the element with the same label already exists
             // if so, updating it *instead* of creating a new element.
-            std::unique_lock <std::mutex> lock_table(label_lookup_lock);
-            auto search = label_lookup_.find(label);
-            if (search != label_lookup_.end()) {
-                tableint existingInternalId = search->second;
+            std::unique_lock <std::mutex> lock_table(label_lookup_.getLock(label));
+            tableint existingInternalId;
+            if (label_lookup_.find(label, existingInternalId)) {
                 if (allow_replace_deleted_) {
                     if (isMarkedDeleted(existingInternalId)) {
                         throw std::runtime_error("Can't use addPoint to update deleted elements if replacement of deleted elements is enabled.");
@@ -1170,21 +2064,24 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 if (isMarkedDeleted(existingInternalId)) {
                     unmarkDeletedInternal(existingInternalId);
                 }
-                updatePoint(data_point, existingInternalId, 1.0);
+                updatePoint(data_point, existingInternalId, 1.0, rerank_point);
 
                 return existingInternalId;
             }
 
-            if (cur_element_count >= max_elements_) {
-                throw std::runtime_error("The number of elements exceeds the specified limit");
-            }
+            // The threads adding the labels of other shards may take the ids at the same time.
+            size_t count = cur_element_count;
+            do {
+                if (count >= max_elements_) {
+                    throw std::runtime_error("The number of elements exceeds the specified limit");
+                }
+            } while (!cur_element_count.compare_exchange_weak(count, count + 1));
 
-            cur_c = cur_element_count;
-            cur_element_count++;
-            label_lookup_[label] = cur_c;
+            cur_c = count;
+            label_lookup_.insert(label, cur_c);
         }
 
-        std::unique_lock <std::mutex> lock_el(link_list_locks_[cur_c]);
+        std::unique_lock <SpinLock> lock_el(link_list_locks_[cur_c]);
         int curlevel = getRandomLevel(mult_);
         if (level > 0)
             curlevel = level;
@@ -1198,17 +2095,19 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         tableint currObj = enterpoint_node_;
         tableint enterpoint_copy = enterpoint_node_;
 
-        memset(data_level0_memory_ + cur_c * size_data_per_element_ + offsetLevel0_, 0, size_data_per_element_);
+        memset(get_linklist0(cur_c), 0, size_links_level0_);
 
         // Initialisation of the data and label
         memcpy(getExternalLabeLp(cur_c), &label, sizeof(labeltype));
         memcpy(getDataByInternalId(cur_c), data_point, data_size_);
+        if (rerank_data_ && rerank_point)
+            memcpy(rerank_data_ + cur_c * rerank_data_size_, rerank_point, rerank_data_size_);
 
         if (curlevel) {
-            linkLists_[cur_c] = (char *) malloc(size_links_per_element_ * curlevel + 1);
+            linkLists_[cur_c] = link_list_arena_.allocate(size_links_per_element_ * curlevel);
             if (linkLists_[cur_c] == nullptr)
                 throw std::runtime_error("Not enough memory: addPoint failed to allocate linklist");
-            memset(linkLists_[cur_c], 0, size_links_per_element_ * curlevel + 1);
+            memset(linkLists_[cur_c], 0, size_links_per_element_ * curlevel);
         }
 
         if ((signed)currObj != -1) {
@@ -1219,7 +2118,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                     while (changed) {
                         changed = false;
                         unsigned int *data;
-                        std::unique_lock <std::mutex> lock(link_list_locks_[currObj]);
+                        std::unique_lock <SpinLock> lock(link_list_locks_[currObj]);
                         data = get_linklist(currObj, level);
                         int size = getListCount(data);
 
@@ -1273,45 +2172,8 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         std::priority_queue<std::pair<dist_t, labeltype >> result;
         if (cur_element_count == 0) return result;
 
-        tableint currObj = enterpoint_node_;
-        dist_t curdist = fstdistfunc_(query_data, getDataByInternalId(enterpoint_node_), dist_func_param_);
-
-        for (int level = maxlevel_; level > 0; level--) {
-            bool changed = true;
-            while (changed) {
-                changed = false;
-                unsigned int *data;
-
-                data = (unsigned int *) get_linklist(currObj, level);
-                int size = getListCount(data);
-                metric_hops++;
-                metric_distance_computations+=size;
-
-                tableint *datal = (tableint *) (data + 1);
-                for (int i = 0; i < size; i++) {
-                    tableint cand = datal[i];
-                    if (cand < 0 || cand > max_elements_)
-                        throw std::runtime_error("cand error");
-                    dist_t d = fstdistfunc_(query_data, getDataByInternalId(cand), dist_func_param_);
-
-                    if (d < curdist) {
-                        curdist = d;
-                        currObj = cand;
-                        changed = true;
-                    }
-                }
-            }
-        }
-
-        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
-        bool bare_bone_search = !num_deleted_ && !isIdAllowed;
-        if (bare_bone_search) {
-            top_candidates = searchBaseLayerST<true>(
-                    currObj, query_data, std::max(ef_, k), isIdAllowed);
-        } else {
-            top_candidates = searchBaseLayerST<false>(
-                    currObj, query_data, std::max(ef_, k), isIdAllowed);
-        }
+        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates =
+            searchCandidates(query_data, std::max(ef_, k), isIdAllowed);
 
         while (top_candidates.size() > k) {
             top_candidates.pop();
@@ -1325,6 +2187,36 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
+    /*
+    * Two-stage search: traverses the graph with the (compressed) query_data, then re-ranks
+    * the max(ef, k) candidates found by exact distances between rerank_query and the vectors
+    * stored by enableRerank. Falls back to searchKnn if re-ranking is not enabled.
+    */
+    std::priority_queue<std::pair<dist_t, labeltype >>
+    searchKnnReranked(const void *query_data, const void *rerank_query, size_t k, BaseFilterFunctor* isIdAllowed = nullptr) const {
+        if (rerank_data_ == nullptr) return searchKnn(query_data, k, isIdAllowed);
+
+        std::priority_queue<std::pair<dist_t, labeltype >> result;
+        if (cur_element_count == 0) return result;
+
+        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates =
+            searchCandidates(query_data, std::max(ef_, k), isIdAllowed);
+
+        while (top_candidates.size() > 0) {
+            const tableint id = top_candidates.top().second;
+            const dist_t dist = rerank_fstdistfunc_(rerank_query, rerank_data_ + id * rerank_data_size_, rerank_dist_func_param_);
+            top_candidates.pop();
+            if (result.size() < k) {
+                result.emplace(dist, getExternalLabel(id));
+            } else if (dist < result.top().first) {
+                result.pop();
+                result.emplace(dist, getExternalLabel(id));
+            }
+        }
+        return result;
+    }
+
+
     std::vector<std::pair<dist_t, labeltype >>
     searchStopConditionClosest(
         const void *query_data,
@@ -1333,38 +2225,13 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         std::vector<std::pair<dist_t, labeltype >> result;
         if (cur_element_count == 0) return result;
 
-        tableint currObj = enterpoint_node_;
-        dist_t curdist = fstdistfunc_(query_data, getDataByInternalId(enterpoint_node_), dist_func_param_);
-
-        for (int level = maxlevel_; level > 0; level--) {
-            bool changed = true;
-            while (changed) {
-                changed = false;
-                unsigned int *data;
-
-                data = (unsigned int *) get_linklist(currObj, level);
-                int size = getListCount(data);
-                metric_hops++;
-                metric_distance_computations+=size;
-
-                tableint *datal = (tableint *) (data + 1);
-                for (int i = 0; i < size; i++) {
-                    tableint cand = datal[i];
-                    if (cand < 0 || cand > max_elements_)
-                        throw std::runtime_error("cand error");
-                    dist_t d = fstdistfunc_(query_data, getDataByInternalId(cand), dist_func_param_);
-
-                    if (d < curdist) {
-                        curdist = d;
-                        currObj = cand;
-                        changed = true;
-                    }
-                }
-            }
-        }
-
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
-        top_candidates = searchBaseLayerST<false>(currObj, query_data, 0, isIdAllowed, &stop_condition);
+        {
+            VisitedListHandle vl_handle(visited_list_pool_.get());
+            VisitedList *vl = vl_handle.get();
+            const tableint currObj = searchUpperLayers(query_data, prepareNeighborBuffers(vl));
+            top_candidates = searchBaseLayerST<false>(vl, currObj, query_data, 0, isIdAllowed, &stop_condition);
+        }
 
         size_t sz = top_candidates.size();
         result.resize(sz);
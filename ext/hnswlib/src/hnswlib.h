@@ -20,6 +20,49 @@
 #endif
 #endif
 
+// With GCC and Clang on x86, the AVX, AVX2/FMA, and AVX-512 kernels are compiled with per-function
+// target attributes even if the compiler flags do not enable them, and are chosen at runtime.
+#if defined(USE_SSE) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define USE_RUNTIME_DISPATCH
+#ifndef USE_AVX
+#define USE_AVX
+#endif
+#ifndef USE_AVX512
+#define USE_AVX512
+#endif
+#define USE_AVX2
+#define USE_F16C
+#define HNSWLIB_TARGET_AVX __attribute__((target("avx")))
+#define HNSWLIB_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define HNSWLIB_TARGET_F16C __attribute__((target("avx2,fma,f16c")))
+#define HNSWLIB_TARGET_AVX512 __attribute__((target("avx512f")))
+#if defined(__x86_64__)
+#define USE_POPCNT
+#define USE_AVX512VPOPCNTDQ
+#endif
+#define HNSWLIB_TARGET_POPCNT __attribute__((target("popcnt")))
+#define HNSWLIB_TARGET_AVX512VPOPCNTDQ __attribute__((target("avx512f,avx512vpopcntdq")))
+#else
+#if defined(USE_AVX) && defined(__AVX2__) && defined(__FMA__)
+#define USE_AVX2
+#if defined(__F16C__)
+#define USE_F16C
+#endif
+#endif
+#if defined(__POPCNT__) && (defined(__x86_64__) || defined(_M_X64))
+#define USE_POPCNT
+#if defined(USE_AVX512) && defined(__AVX512VPOPCNTDQ__)
+#define USE_AVX512VPOPCNTDQ
+#endif
+#endif
+#define HNSWLIB_TARGET_AVX
+#define HNSWLIB_TARGET_AVX2
+#define HNSWLIB_TARGET_F16C
+#define HNSWLIB_TARGET_AVX512
+#define HNSWLIB_TARGET_POPCNT
+#define HNSWLIB_TARGET_AVX512VPOPCNTDQ
+#endif
+
 #if defined(USE_AVX) || defined(USE_SSE)
 #ifdef _MSC_VER
 #include <intrin.h>
@@ -86,6 +129,35 @@ static bool AVXCapable() {
     return HW_AVX && avxSupported;
 }
 
+static bool AVX2Capable() {
+    if (!AVXCapable()) return false;
+
+    int cpuInfo[4];
+
+    // CPU support
+    cpuid(cpuInfo, 0, 0);
+    int nIds = cpuInfo[0];
+
+    bool HW_AVX2 = false;
+    if (nIds >= 0x00000007) {  //  AVX2
+        cpuid(cpuInfo, 0x00000007, 0);
+        HW_AVX2 = (cpuInfo[1] & ((int)1 << 5)) != 0;
+    }
+
+    cpuid(cpuInfo, 0x00000001, 0);
+    bool HW_FMA = (cpuInfo[2] & ((int)1 << 12)) != 0;
+
+    return HW_AVX2 && HW_FMA;
+}
+
+static bool F16CCapable() {
+    if (!AVXCapable()) return false;
+
+    int cpuInfo[4];
+    cpuid(cpuInfo, 0x00000001, 0);
+    return (cpuInfo[2] & ((int)1 << 29)) != 0;
+}
+
 static bool AVX512Capable() {
     if (!AVXCapable()) return false;
 
@@ -114,6 +186,32 @@ static bool AVX512Capable() {
     }
     return HW_AVX512F && avx512Supported;
 }
+
+#if defined(USE_AVX2)
+// Sums each of the four vectors horizontally, and returns the four sums in this order.
+HNSWLIB_TARGET_AVX2
+static inline __m128
+HorizontalSum4AVX2(__m256 a, __m256 b, __m256 c, __m256 d) {
+    const __m256 ab = _mm256_hadd_ps(a, b);
+    const __m256 cd = _mm256_hadd_ps(c, d);
+    const __m256 abcd = _mm256_hadd_ps(ab, cd);
+    return _mm_add_ps(_mm256_castps256_ps128(abcd), _mm256_extractf128_ps(abcd, 1));
+}
+#endif
+
+static bool POPCNTCapable() {
+    int cpuInfo[4];
+    cpuid(cpuInfo, 0x00000001, 0);
+    return (cpuInfo[2] & ((int)1 << 23)) != 0;
+}
+
+static bool AVX512VPOPCNTDQCapable() {
+    if (!AVX512Capable()) return false;
+
+    int cpuInfo[4];
+    cpuid(cpuInfo, 0x00000007, 0);
+    return (cpuInfo[2] & ((int)1 << 14)) != 0;
+}
 #endif
 
 #include <queue>
@@ -170,6 +268,11 @@ static void readBinaryPOD(std::istream &in, T &podRef) {
 template<typename MTYPE>
 using DISTFUNC = MTYPE(*)(const void *, const void *, const void *);
 
+// Computes the distances from the query given as the first argument to the n vectors given as the second argument,
+// and stores them into the last argument. The third argument is the number of the vectors.
+template<typename MTYPE>
+using BATCHDISTFUNC = void(*)(const void *, const void *const *, size_t, const void *, MTYPE *);
+
 template<typename MTYPE>
 class SpaceInterface {
  public:
@@ -180,6 +283,40 @@ class SpaceInterface {
 
     virtual void *get_dist_func_param() = 0;
 
+    // Spaces storing vectors in a format other than the float array given by users override the following
+    // to convert vectors before they are passed to addPoint and searchKnn.
+    virtual bool is_encoded() { return false; }
+
+    virtual void encode(const float *src, void *dst) { memcpy(dst, src, get_data_size()); }
+
+    virtual void decode(const void *src, float *dst) { memcpy(dst, src, get_data_size()); }
+
+    // Spaces computing distances from a query in another format than the stored vectors, such as a lookup table
+    // prepared once per query, override the following. The search methods pass the query converted by
+    // encode_query to the distance function returned by get_query_dist_func as its first argument.
+    virtual size_t get_query_size() { return get_data_size(); }
+
+    virtual void encode_query(const float *src, void *dst) { encode(src, dst); }
+
+    virtual DISTFUNC<MTYPE> get_query_dist_func() { return get_dist_func(); }
+
+    // Spaces having a kernel that computes the distances from a query to several vectors at once, loading the query
+    // only once for them, override the following. The kernel takes the same query and parameter as the function
+    // returned by get_query_dist_func. The search methods call that function for each vector if it returns nullptr.
+    virtual BATCHDISTFUNC<MTYPE> get_query_batch_dist_func() { return nullptr; }
+
+    // Spaces learning parameters from data, such as quantizers, override the following
+    // so that the parameters are learned from sample vectors, and saved to and loaded from the end of index files.
+    virtual bool is_trained() { return true; }
+
+    virtual void train(const float *samples, size_t n) { }
+
+    virtual size_t get_state_size() { return 0; }
+
+    virtual void save_state(std::ostream &output) { }
+
+    virtual void load_state(std::istream &input) { }
+
     virtual ~SpaceInterface() {}
 };
 
@@ -223,6 +360,11 @@ AlgorithmInterface<dist_t>::searchKnnCloserFirst(const void* query_data, size_t
 
 #include "space_l2.h"
 #include "space_ip.h"
+#include "space_cosine.h"
+#include "space_hamming.h"
+#include "space_half.h"
+#include "space_sq8.h"
+#include "space_pq.h"
 #include "stop_condition.h"
 #include "bruteforce.h"
 #include "hnswalg.h"
@@ -0,0 +1,265 @@
+#pragma once
+
+#include "hnswlib.h"
+#include <iostream>
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+
+namespace hnswlib {
+
+/*
+* Maps the labels to the internal ids with open addressing instead of the nodes of std::unordered_map.
+* The labels and the ids are stored in two flat arrays probed linearly, which takes 12 bytes per slot,
+* and the deleted entries are removed by shifting the following entries back, so that no tombstones remain.
+*
+* The table is split into shards by the hash of the label, and each shard has its own lock, so that the operations
+* on different labels rarely wait for each other. The methods do not lock by themselves: the operations on a label
+* must hold the lock returned by getLock for it, and the methods over all labels such as reserve and clear
+* must not run concurrently with other operations. forEach locks each shard while visiting it, so that it can run
+* concurrently with the operations on labels.
+*/
+template<typename id_t>
+class LabelLookupTable {
+    static const size_t N_SHARDS = 64;
+    static const size_t MIN_CAPACITY = 16;
+    static const labeltype EMPTY_KEY = ~((labeltype) 0);  // marks empty slots
+
+    struct Shard {
+        mutable std::mutex lock;
+        std::vector<labeltype> keys;
+        std::vector<id_t> ids;
+        size_t size = 0;  // the number of used slots
+        // The label equal to EMPTY_KEY cannot be stored in the slots, so it is kept apart.
+        bool has_empty_key = false;
+        id_t empty_key_id = 0;
+    };
+
+    Shard shards_[N_SHARDS];
+
+    bool loadFailed() {
+        clear();
+        return false;
+    }
+
+    // The finalizer of MurmurHash3, which spreads sequential labels over all bits.
+    static inline uint64_t hash(labeltype label) {
+        uint64_t h = (uint64_t) label;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    // The lower bits of the hash select the shard, and the remaining bits select the slot in the shard.
+    static inline size_t homeSlot(uint64_t h, size_t mask) {
+        return (size_t) (h / N_SHARDS) & mask;
+    }
+
+    static void rehash(Shard &shard, size_t capacity) {
+        const labeltype empty_key = EMPTY_KEY;
+        std::vector<labeltype> keys(capacity, empty_key);
+        std::vector<id_t> ids(capacity);
+        const size_t mask = capacity - 1;
+        for (size_t i = 0; i < shard.keys.size(); i++) {
+            if (shard.keys[i] == EMPTY_KEY) continue;
+            size_t j = homeSlot(hash(shard.keys[i]), mask);
+            while (keys[j] != EMPTY_KEY) j = (j + 1) & mask;
+            keys[j] = shard.keys[i];
+            ids[j] = shard.ids[i];
+        }
+        shard.keys.swap(keys);
+        shard.ids.swap(ids);
+    }
+
+    // Returns the smallest capacity that keeps the load factor of the given number of entries at most 3/4.
+    static size_t capacityFor(size_t n_entries) {
+        size_t capacity = MIN_CAPACITY;
+        while (capacity * 3 < n_entries * 4) capacity *= 2;
+        return capacity;
+    }
+
+ public:
+    std::mutex &getLock(labeltype label) const {
+        return shards_[hash(label) % N_SHARDS].lock;
+    }
+
+    bool find(labeltype label, id_t &id) const {
+        const uint64_t h = hash(label);
+        const Shard &shard = shards_[h % N_SHARDS];
+        if (label == EMPTY_KEY) {
+            if (shard.has_empty_key) id = shard.empty_key_id;
+            return shard.has_empty_key;
+        }
+        if (shard.keys.empty()) return false;
+        const size_t mask = shard.keys.size() - 1;
+        for (size_t i = homeSlot(h, mask);; i = (i + 1) & mask) {
+            if (shard.keys[i] == label) {
+                id = shard.ids[i];
+                return true;
+            }
+            if (shard.keys[i] == EMPTY_KEY) return false;
+        }
+    }
+
+    // Inserts the label, or assigns the id to it if it exists.
+    void insert(labeltype label, id_t id) {
+        const uint64_t h = hash(label);
+        Shard &shard = shards_[h % N_SHARDS];
+        if (label == EMPTY_KEY) {
+            shard.has_empty_key = true;
+            shard.empty_key_id = id;
+            return;
+        }
+        if ((shard.size + 1) * 4 > shard.keys.size() * 3) rehash(shard, capacityFor(shard.size + 1));
+        const size_t mask = shard.keys.size() - 1;
+        for (size_t i = homeSlot(h, mask);; i = (i + 1) & mask) {
+            if (shard.keys[i] == label) {
+                shard.ids[i] = id;
+                return;
+            }
+            if (shard.keys[i] == EMPTY_KEY) {
+                shard.keys[i] = label;
+                shard.ids[i] = id;
+                shard.size++;
+                return;
+            }
+        }
+    }
+
+    bool erase(labeltype label) {
+        const uint64_t h = hash(label);
+        Shard &shard = shards_[h % N_SHARDS];
+        if (label == EMPTY_KEY) {
+            const bool existed = shard.has_empty_key;
+            shard.has_empty_key = false;
+            return existed;
+        }
+        if (shard.keys.empty()) return false;
+        const size_t mask = shard.keys.size() - 1;
+        size_t i = homeSlot(h, mask);
+        while (shard.keys[i] != label) {
+            if (shard.keys[i] == EMPTY_KEY) return false;
+            i = (i + 1) & mask;
+        }
+        // Moves back the following entries of the cluster whose home slots are not between the hole and them,
+        // so that the probes for them do not stop at the hole.
+        for (size_t j = (i + 1) & mask; shard.keys[j] != EMPTY_KEY; j = (j + 1) & mask) {
+            const size_t k = homeSlot(hash(shard.keys[j]), mask);
+            const bool reachable = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+            if (reachable) continue;
+            shard.keys[i] = shard.keys[j];
+            shard.ids[i] = shard.ids[j];
+            i = j;
+        }
+        shard.keys[i] = EMPTY_KEY;
+        shard.size--;
+        return true;
+    }
+
+    // Allocates the slots for the given number of labels in advance, assuming that they spread evenly over the shards.
+    void reserve(size_t n_labels) {
+        const size_t n_shard_labels = n_labels / N_SHARDS + n_labels / N_SHARDS / 8 + 1;
+        const size_t capacity = capacityFor(n_shard_labels);
+        for (Shard &shard : shards_) {
+            if (shard.keys.size() < capacity) rehash(shard, capacity);
+        }
+    }
+
+    void clear() {
+        for (Shard &shard : shards_) {
+            std::vector<labeltype>().swap(shard.keys);
+            std::vector<id_t>().swap(shard.ids);
+            shard.size = 0;
+            shard.has_empty_key = false;
+        }
+    }
+
+    size_t size() const {
+        size_t n_labels = 0;
+        for (const Shard &shard : shards_) n_labels += shard.size + (shard.has_empty_key ? 1 : 0);
+        return n_labels;
+    }
+
+    /*
+    * Writes the slots of the shards as they are, so that load can read them back into the arrays without hashing
+    * the labels again.
+    */
+    void save(std::ostream &output) const {
+        const size_t n_shards = N_SHARDS;
+        writeBinaryPOD(output, n_shards);
+        for (const Shard &shard : shards_) {
+            const size_t capacity = shard.keys.size();
+            const unsigned char has_empty_key = shard.has_empty_key ? 1 : 0;
+            writeBinaryPOD(output, capacity);
+            writeBinaryPOD(output, shard.size);
+            writeBinaryPOD(output, has_empty_key);
+            writeBinaryPOD(output, shard.empty_key_id);
+            output.write((const char *) shard.keys.data(), capacity * sizeof(labeltype));
+            output.write((const char *) shard.ids.data(), capacity * sizeof(id_t));
+        }
+    }
+
+    /*
+    * Reads the slots written by save from at most size bytes of the input. Returns false if they do not form
+    * a table of ids less than n_ids, in which case the table is left empty.
+    */
+    bool load(std::istream &input, std::streamoff size, size_t n_ids) {
+        clear();
+        const std::streamoff shard_header_size = 2 * sizeof(size_t) + sizeof(unsigned char) + sizeof(id_t);
+        size_t n_shards = 0;
+        if (size < (std::streamoff) sizeof(n_shards)) return false;
+        readBinaryPOD(input, n_shards);
+        size -= sizeof(n_shards);
+        if (n_shards != N_SHARDS) return false;
+        for (Shard &shard : shards_) {
+            if (size < shard_header_size) return loadFailed();
+            size_t capacity, n_used;
+            unsigned char has_empty_key;
+            readBinaryPOD(input, capacity);
+            readBinaryPOD(input, n_used);
+            readBinaryPOD(input, has_empty_key);
+            readBinaryPOD(input, shard.empty_key_id);
+            size -= shard_header_size;
+            // The probes stop only at an empty slot, so that a full shard would make them loop forever.
+            const bool valid_capacity = capacity == 0 || (capacity >= MIN_CAPACITY && (capacity & (capacity - 1)) == 0);
+            if (!valid_capacity || n_used * 4 > capacity * 3 || has_empty_key > 1 ||
+                (has_empty_key && shard.empty_key_id >= n_ids) ||
+                capacity > (size_t) size / (sizeof(labeltype) + sizeof(id_t)))
+                return loadFailed();
+            shard.keys.resize(capacity);
+            shard.ids.resize(capacity);
+            input.read((char *) shard.keys.data(), capacity * sizeof(labeltype));
+            input.read((char *) shard.ids.data(), capacity * sizeof(id_t));
+            size -= capacity * (sizeof(labeltype) + sizeof(id_t));
+            size_t n_keys = 0;
+            for (size_t i = 0; i < capacity; i++) {
+                if (shard.keys[i] == EMPTY_KEY) continue;
+                if (shard.ids[i] >= n_ids) return loadFailed();
+                n_keys++;
+            }
+            if (n_keys != n_used) return loadFailed();
+            shard.size = n_used;
+            shard.has_empty_key = has_empty_key == 1;
+        }
+        return !input.fail();
+    }
+
+    // Calls f(label, id) for each label, where id is a reference that can be assigned.
+    // f is called with the lock of the shard held, so it must not operate on the labels.
+    template<typename F>
+    void forEach(F f) {
+        for (Shard &shard : shards_) {
+            std::unique_lock <std::mutex> lock(shard.lock);
+            for (size_t i = 0; i < shard.keys.size(); i++) {
+                if (shard.keys[i] != EMPTY_KEY) f(shard.keys[i], shard.ids[i]);
+            }
+            const labeltype empty_key = EMPTY_KEY;
+            if (shard.has_empty_key) f(empty_key, shard.empty_key_id);
+        }
+    }
+};
+
+}  // namespace hnswlib
@@ -0,0 +1,116 @@
+#pragma once
+#include "hnswlib.h"
+#include <cmath>
+
+namespace hnswlib {
+
+typedef float (*SQRNORMFUNC)(const float *, size_t);
+
+static float
+SqrNorm(const float *pVect, size_t qty) {
+    float res = 0;
+    for (size_t i = 0; i < qty; i++) {
+        res += pVect[i] * pVect[i];
+    }
+    return res;
+}
+
+#if defined(USE_AVX2)
+
+HNSWLIB_TARGET_AVX2
+static float
+SqrNormAVX2(const float *pVect, size_t qty) {
+    float PORTABLE_ALIGN32 TmpRes[8];
+
+    __m256 sum1 = _mm256_setzero_ps();
+    __m256 sum2 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= qty; i += 16) {
+        const __m256 v1 = _mm256_loadu_ps(pVect + i);
+        const __m256 v2 = _mm256_loadu_ps(pVect + i + 8);
+        sum1 = _mm256_fmadd_ps(v1, v1, sum1);
+        sum2 = _mm256_fmadd_ps(v2, v2, sum2);
+    }
+    for (; i + 8 <= qty; i += 8) {
+        const __m256 v = _mm256_loadu_ps(pVect + i);
+        sum1 = _mm256_fmadd_ps(v, v, sum1);
+    }
+
+    _mm256_store_ps(TmpRes, _mm256_add_ps(sum1, sum2));
+    float res = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
+    for (; i < qty; i++) {
+        res += pVect[i] * pVect[i];
+    }
+    return res;
+}
+
+#endif
+
+#if defined(USE_AVX512)
+
+HNSWLIB_TARGET_AVX512
+static float
+SqrNormAVX512(const float *pVect, size_t qty) {
+    __m512 sum = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= qty; i += 16) {
+        const __m512 v = _mm512_loadu_ps(pVect + i);
+        sum = _mm512_fmadd_ps(v, v, sum);
+    }
+
+    float res = _mm512_reduce_add_ps(sum);
+    for (; i < qty; i++) {
+        res += pVect[i] * pVect[i];
+    }
+    return res;
+}
+
+#endif
+
+static SQRNORMFUNC
+GetSqrNormFunc() {
+#if defined(USE_AVX512)
+    if (AVX512Capable())
+        return SqrNormAVX512;
+#endif
+#if defined(USE_AVX2)
+    if (AVX2Capable())
+        return SqrNormAVX2;
+#endif
+    return SqrNorm;
+}
+
+// Returns the factor scaling the vector to unit length. Zero vectors are left as they are,
+// as they have no direction and dividing them by zero would turn them into NaNs.
+static inline float
+InverseNorm(const float *pVect, size_t qty, SQRNORMFUNC sqrnormfunc) {
+    const float norm = std::sqrt(sqrnormfunc(pVect, qty));
+    return norm > 0.0f ? 1.0f / norm : 1.0f;
+}
+
+// Stores vectors normalized to unit length, so that the inner product distance between them
+// is the cosine distance. The vectors are normalized once when they are encoded, and
+// the distance is computed by the inner product kernels without the norms.
+class CosineSpace : public InnerProductSpace {
+    SQRNORMFUNC sqrnormfunc_;
+    size_t dim_;
+
+ public:
+    CosineSpace() : InnerProductSpace(), sqrnormfunc_(nullptr), dim_(0) { }
+
+    CosineSpace(size_t dim) : InnerProductSpace(dim), sqrnormfunc_(GetSqrNormFunc()), dim_(dim) { }
+
+    bool is_encoded() {
+        return true;
+    }
+
+    void encode(const float *src, void *dst) {
+        const float scale = InverseNorm(src, dim_, sqrnormfunc_);
+        float *vec = (float *) dst;
+        for (size_t i = 0; i < dim_; i++) vec[i] = src[i] * scale;
+    }
+
+    ~CosineSpace() {}
+};
+
+}  // namespace hnswlib
@@ -0,0 +1,316 @@
+#pragma once
+#include "hnswlib.h"
+
+namespace hnswlib {
+
+// Conversions between float and the 16-bit floating point formats, IEEE 754 half precision (fp16)
+// and bfloat16 (bf16). Both round to nearest even.
+static inline uint16_t
+FloatToFp16(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const uint16_t sign = (bits >> 16) & 0x8000;
+    const uint32_t abs_bits = bits & 0x7FFFFFFF;
+
+    if (abs_bits >= 0x7F800000) {  // inf or nan
+        return sign | 0x7C00 | (abs_bits > 0x7F800000 ? 0x0200 : 0);
+    }
+    if (abs_bits >= 0x477FF000) {  // overflows to inf after rounding
+        return sign | 0x7C00;
+    }
+    if (abs_bits < 0x38800000) {  // subnormal or zero in fp16
+        if (abs_bits < 0x33000000) return sign;
+        const uint32_t exponent = abs_bits >> 23;
+        const uint32_t mantissa = (abs_bits & 0x007FFFFF) | 0x00800000;
+        const uint32_t shift = 126 - exponent;
+        uint32_t half = mantissa >> shift;
+        const uint32_t rest = mantissa & ((1U << shift) - 1);
+        const uint32_t halfway = 1U << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1))) half++;
+        return sign | (uint16_t) half;
+    }
+    uint32_t half = ((abs_bits - 0x38000000) >> 13);
+    const uint32_t rest = abs_bits & 0x1FFF;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+    return sign | (uint16_t) half;
+}
+
+static inline float
+Fp16ToFloat(uint16_t value) {
+    const uint32_t sign = (uint32_t) (value & 0x8000) << 16;
+    const uint32_t exponent = (value >> 10) & 0x1F;
+    uint32_t mantissa = value & 0x03FF;
+    uint32_t bits;
+
+    if (exponent == 0x1F) {
+        bits = sign | 0x7F800000 | (mantissa << 13);
+    } else if (exponent != 0) {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else if (mantissa != 0) {
+        uint32_t e = 113;
+        while ((mantissa & 0x0400) == 0) {
+            mantissa <<= 1;
+            e--;
+        }
+        bits = sign | (e << 23) | ((mantissa & 0x03FF) << 13);
+    } else {
+        bits = sign;
+    }
+
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+static inline uint16_t
+FloatToBf16(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if ((bits & 0x7FFFFFFF) > 0x7F800000) return (uint16_t) ((bits >> 16) | 0x0040);  // quiet nan
+    bits += 0x7FFF + ((bits >> 16) & 1);
+    return (uint16_t) (bits >> 16);
+}
+
+static inline float
+Bf16ToFloat(uint16_t value) {
+    const uint32_t bits = (uint32_t) value << 16;
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+template<bool IsBf16>
+static inline float
+HalfToFloat(uint16_t value) {
+    return IsBf16 ? Bf16ToFloat(value) : Fp16ToFloat(value);
+}
+
+template<bool IsBf16>
+static float
+L2SqrHalf(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+    const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+
+    float res = 0;
+    for (size_t i = 0; i < qty; i++) {
+        float t = HalfToFloat<IsBf16>(pVect1[i]) - HalfToFloat<IsBf16>(pVect2[i]);
+        res += t * t;
+    }
+    return res;
+}
+
+template<bool IsBf16>
+static float
+InnerProductHalf(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+    const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+
+    float res = 0;
+    for (size_t i = 0; i < qty; i++) {
+        res += HalfToFloat<IsBf16>(pVect1[i]) * HalfToFloat<IsBf16>(pVect2[i]);
+    }
+    return res;
+}
+
+template<bool IsBf16>
+static float
+InnerProductDistanceHalf(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    return 1.0f - InnerProductHalf<IsBf16>(pVect1v, pVect2v, qty_ptr);
+}
+
+#if defined(USE_F16C)
+
+// Loads eight 16-bit values and widens them to float.
+template<bool IsBf16>
+HNSWLIB_TARGET_F16C
+static inline __m256
+LoadHalf8(const uint16_t *p) {
+    const __m128i v = _mm_loadu_si128((const __m128i *) p);
+    if (IsBf16) return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(v), 16));
+    return _mm256_cvtph_ps(v);
+}
+
+template<bool IsBf16>
+HNSWLIB_TARGET_F16C
+static float
+L2SqrHalfAVX2(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+    const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    float PORTABLE_ALIGN32 TmpRes[8];
+    size_t qty8 = qty >> 3 << 3;
+
+    __m256 sum = _mm256_setzero_ps();
+    for (size_t i = 0; i < qty8; i += 8) {
+        __m256 diff = _mm256_sub_ps(LoadHalf8<IsBf16>(pVect1 + i), LoadHalf8<IsBf16>(pVect2 + i));
+        sum = _mm256_fmadd_ps(diff, diff, sum);
+    }
+
+    _mm256_store_ps(TmpRes, sum);
+    float res = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
+    size_t qty_left = qty - qty8;
+    return res + L2SqrHalf<IsBf16>(pVect1 + qty8, pVect2 + qty8, &qty_left);
+}
+
+template<bool IsBf16>
+HNSWLIB_TARGET_F16C
+static float
+InnerProductHalfAVX2(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+    const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    float PORTABLE_ALIGN32 TmpRes[8];
+    size_t qty8 = qty >> 3 << 3;
+
+    __m256 sum = _mm256_setzero_ps();
+    for (size_t i = 0; i < qty8; i += 8) {
+        sum = _mm256_fmadd_ps(LoadHalf8<IsBf16>(pVect1 + i), LoadHalf8<IsBf16>(pVect2 + i), sum);
+    }
+
+    _mm256_store_ps(TmpRes, sum);
+    float res = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
+    size_t qty_left = qty - qty8;
+    return res + InnerProductHalf<IsBf16>(pVect1 + qty8, pVect2 + qty8, &qty_left);
+}
+
+template<bool IsBf16>
+static float
+InnerProductDistanceHalfAVX2(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    return 1.0f - InnerProductHalfAVX2<IsBf16>(pVect1v, pVect2v, qty_ptr);
+}
+
+#endif
+
+#if defined(USE_AVX512)
+
+// Loads sixteen 16-bit values and widens them to float.
+template<bool IsBf16>
+HNSWLIB_TARGET_AVX512
+static inline __m512
+LoadHalf16(const uint16_t *p) {
+    const __m256i v = _mm256_loadu_si256((const __m256i *) p);
+    if (IsBf16) return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(v), 16));
+    return _mm512_cvtph_ps(v);
+}
+
+template<bool IsBf16>
+HNSWLIB_TARGET_AVX512
+static float
+L2SqrHalfAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+    const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    float PORTABLE_ALIGN64 TmpRes[16];
+    size_t qty16 = qty >> 4 << 4;
+
+    __m512 sum = _mm512_setzero_ps();
+    for (size_t i = 0; i < qty16; i += 16) {
+        __m512 diff = _mm512_sub_ps(LoadHalf16<IsBf16>(pVect1 + i), LoadHalf16<IsBf16>(pVect2 + i));
+        sum = _mm512_fmadd_ps(diff, diff, sum);
+    }
+
+    _mm512_store_ps(TmpRes, sum);
+    float res = 0;
+    for (size_t i = 0; i < 16; i++) res += TmpRes[i];
+    size_t qty_left = qty - qty16;
+    return res + L2SqrHalf<IsBf16>(pVect1 + qty16, pVect2 + qty16, &qty_left);
+}
+
+template<bool IsBf16>
+HNSWLIB_TARGET_AVX512
+static float
+InnerProductHalfAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+    const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    float PORTABLE_ALIGN64 TmpRes[16];
+    size_t qty16 = qty >> 4 << 4;
+
+    __m512 sum = _mm512_setzero_ps();
+    for (size_t i = 0; i < qty16; i += 16) {
+        sum = _mm512_fmadd_ps(LoadHalf16<IsBf16>(pVect1 + i), LoadHalf16<IsBf16>(pVect2 + i), sum);
+    }
+
+    _mm512_store_ps(TmpRes, sum);
+    float res = 0;
+    for (size_t i = 0; i < 16; i++) res += TmpRes[i];
+    size_t qty_left = qty - qty16;
+    return res + InnerProductHalf<IsBf16>(pVect1 + qty16, pVect2 + qty16, &qty_left);
+}
+
+template<bool IsBf16>
+static float
+InnerProductDistanceHalfAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    return 1.0f - InnerProductHalfAVX512<IsBf16>(pVect1v, pVect2v, qty_ptr);
+}
+
+#endif
+
+// Stores each element of vectors in 16 bits, and computes the distances after widening them to float.
+// Vectors given to addPoint and searchKnn have to be converted with encode beforehand.
+// If IsCosine is true, the vectors are normalized to unit length before they are converted.
+template<bool IsBf16, bool IsInnerProduct, bool IsCosine = false>
+class HalfSpace : public SpaceInterface<float> {
+    DISTFUNC<float> fstdistfunc_;
+    SQRNORMFUNC sqrnormfunc_;
+    size_t data_size_;
+    size_t dim_;
+
+ public:
+    HalfSpace() : fstdistfunc_(nullptr), sqrnormfunc_(nullptr), data_size_(0), dim_(0) { }
+
+    HalfSpace(size_t dim) {
+        fstdistfunc_ = IsInnerProduct ? InnerProductDistanceHalf<IsBf16> : L2SqrHalf<IsBf16>;
+#if defined(USE_F16C)
+        if (AVX2Capable() && F16CCapable())
+            fstdistfunc_ = IsInnerProduct ? InnerProductDistanceHalfAVX2<IsBf16> : L2SqrHalfAVX2<IsBf16>;
+#endif
+#if defined(USE_AVX512)
+        if (AVX512Capable())
+            fstdistfunc_ = IsInnerProduct ? InnerProductDistanceHalfAVX512<IsBf16> : L2SqrHalfAVX512<IsBf16>;
+#endif
+        sqrnormfunc_ = GetSqrNormFunc();
+        dim_ = dim;
+        data_size_ = dim * sizeof(uint16_t);
+    }
+
+    size_t get_data_size() {
+        return data_size_;
+    }
+
+    DISTFUNC<float> get_dist_func() {
+        return fstdistfunc_;
+    }
+
+    void *get_dist_func_param() {
+        return &dim_;
+    }
+
+    bool is_encoded() {
+        return true;
+    }
+
+    void encode(const float *src, void *dst) {
+        uint16_t *codes = (uint16_t *) dst;
+        const float scale = IsCosine ? InverseNorm(src, dim_, sqrnormfunc_) : 1.0f;
+        for (size_t i = 0; i < dim_; i++) codes[i] = IsBf16 ? FloatToBf16(src[i] * scale) : FloatToFp16(src[i] * scale);
+    }
+
+    void decode(const void *src, float *dst) {
+        const uint16_t *codes = (const uint16_t *) src;
+        for (size_t i = 0; i < dim_; i++) dst[i] = HalfToFloat<IsBf16>(codes[i]);
+    }
+
+    ~HalfSpace() {}
+};
+
+typedef HalfSpace<false, false> L2SpaceFp16;
+typedef HalfSpace<false, true> InnerProductSpaceFp16;
+typedef HalfSpace<true, false> L2SpaceBf16;
+typedef HalfSpace<true, true> InnerProductSpaceBf16;
+typedef HalfSpace<false, true, true> CosineSpaceFp16;
+typedef HalfSpace<true, true, true> CosineSpaceBf16;
+
+}  // namespace hnswlib
@@ -0,0 +1,147 @@
+#pragma once
+#include "hnswlib.h"
+
+namespace hnswlib {
+
+// Counts the set bits of a 64-bit word without the popcnt instruction.
+static inline size_t
+PopCount64(uint64_t x) {
+#if defined(__GNUC__)
+    return (size_t) __builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (size_t) ((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// The vectors are packed bits stored in 64-bit words, and qty_ptr points to the number of the words.
+static float
+Hamming(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint64_t *pVect1 = (const uint64_t *) pVect1v;
+    const uint64_t *pVect2 = (const uint64_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+
+    size_t res = 0;
+    for (size_t i = 0; i < qty; i++) {
+        res += PopCount64(pVect1[i] ^ pVect2[i]);
+    }
+    return (float) res;
+}
+
+#if defined(USE_POPCNT)
+
+HNSWLIB_TARGET_POPCNT
+static float
+HammingPOPCNT(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint64_t *pVect1 = (const uint64_t *) pVect1v;
+    const uint64_t *pVect2 = (const uint64_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+
+    // Independent counters let the popcnt instructions of the unrolled words run in parallel.
+    uint64_t res1 = 0, res2 = 0, res3 = 0, res4 = 0;
+    size_t i = 0;
+    for (; i + 4 <= qty; i += 4) {
+        res1 += _mm_popcnt_u64(pVect1[i] ^ pVect2[i]);
+        res2 += _mm_popcnt_u64(pVect1[i + 1] ^ pVect2[i + 1]);
+        res3 += _mm_popcnt_u64(pVect1[i + 2] ^ pVect2[i + 2]);
+        res4 += _mm_popcnt_u64(pVect1[i + 3] ^ pVect2[i + 3]);
+    }
+    for (; i < qty; i++) {
+        res1 += _mm_popcnt_u64(pVect1[i] ^ pVect2[i]);
+    }
+    return (float) (res1 + res2 + res3 + res4);
+}
+
+#endif
+
+#if defined(USE_AVX512VPOPCNTDQ)
+
+// Counts the bits of eight words at once, and loads the remaining words with a mask.
+HNSWLIB_TARGET_AVX512VPOPCNTDQ
+static float
+HammingAVX512VPOPCNTDQ(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint64_t *pVect1 = (const uint64_t *) pVect1v;
+    const uint64_t *pVect2 = (const uint64_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+
+    __m512i sum = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 8 <= qty; i += 8) {
+        const __m512i v1 = _mm512_loadu_si512((const void *) (pVect1 + i));
+        const __m512i v2 = _mm512_loadu_si512((const void *) (pVect2 + i));
+        sum = _mm512_add_epi64(sum, _mm512_popcnt_epi64(_mm512_xor_si512(v1, v2)));
+    }
+    if (i < qty) {
+        const __mmask8 mask = (__mmask8) ((1U << (qty - i)) - 1);
+        const __m512i v1 = _mm512_maskz_loadu_epi64(mask, (const void *) (pVect1 + i));
+        const __m512i v2 = _mm512_maskz_loadu_epi64(mask, (const void *) (pVect2 + i));
+        sum = _mm512_add_epi64(sum, _mm512_popcnt_epi64(_mm512_xor_si512(v1, v2)));
+    }
+    return (float) _mm512_reduce_add_epi64(sum);
+}
+
+#endif
+
+// Stores binary codes as packed bits, and the distance is the number of differing bits.
+// The dimensionality is the number of bits. The float vectors given to encode have one element
+// per bit, and the elements greater than zero are set bits, so that both 0/1 and -1/+1 codes work.
+class HammingSpace : public SpaceInterface<float> {
+    DISTFUNC<float> fstdistfunc_;
+    size_t data_size_;
+    size_t dim_;
+    size_t n_words_;
+
+ public:
+    HammingSpace() : fstdistfunc_(nullptr), data_size_(0), dim_(0), n_words_(0) { }
+
+    HammingSpace(size_t dim) {
+        fstdistfunc_ = Hamming;
+#if defined(USE_POPCNT)
+        if (POPCNTCapable())
+            fstdistfunc_ = HammingPOPCNT;
+#endif
+#if defined(USE_AVX512VPOPCNTDQ)
+        if (AVX512VPOPCNTDQCapable())
+            fstdistfunc_ = HammingAVX512VPOPCNTDQ;
+#endif
+        dim_ = dim;
+        n_words_ = (dim + 63) / 64;
+        data_size_ = n_words_ * sizeof(uint64_t);
+    }
+
+    size_t get_data_size() {
+        return data_size_;
+    }
+
+    DISTFUNC<float> get_dist_func() {
+        return fstdistfunc_;
+    }
+
+    void *get_dist_func_param() {
+        return &n_words_;
+    }
+
+    bool is_encoded() {
+        return true;
+    }
+
+    // The padding bits of the last word are left unset, so they never count as differing bits.
+    void encode(const float *src, void *dst) {
+        uint64_t *words = (uint64_t *) dst;
+        memset(words, 0, data_size_);
+        for (size_t i = 0; i < dim_; i++) {
+            if (src[i] > 0.0f) words[i / 64] |= (uint64_t) 1 << (i % 64);
+        }
+    }
+
+    void decode(const void *src, float *dst) {
+        const uint64_t *words = (const uint64_t *) src;
+        for (size_t i = 0; i < dim_; i++) dst[i] = (float) ((words[i / 64] >> (i % 64)) & 1);
+    }
+
+    ~HammingSpace() {}
+};
+
+}  // namespace hnswlib
@@ -1,5 +1,6 @@
 #pragma once
 #include "hnswlib.h"
+#include <algorithm>
 
 namespace hnswlib {
 
@@ -18,9 +19,90 @@ InnerProductDistance(const void *pVect1, const void *pVect2, const void *qty_ptr
     return 1.0f - InnerProduct(pVect1, pVect2, qty_ptr);
 }
 
+#if defined(USE_AVX2)
+
+HNSWLIB_TARGET_AVX2
+static float
+InnerProductSIMD4ExtAVX2(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    float PORTABLE_ALIGN32 TmpRes[8];
+    float *pVect1 = (float *) pVect1v;
+    float *pVect2 = (float *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+
+    size_t qty16 = qty / 16;
+    size_t qty4 = qty / 4;
+
+    const float *pEnd1 = pVect1 + 16 * qty16;
+    const float *pEnd2 = pVect1 + 4 * qty4;
+
+    __m256 sum256_1 = _mm256_setzero_ps();
+    __m256 sum256_2 = _mm256_setzero_ps();
+
+    while (pVect1 < pEnd1) {
+        sum256_1 = _mm256_fmadd_ps(_mm256_loadu_ps(pVect1), _mm256_loadu_ps(pVect2), sum256_1);
+        sum256_2 = _mm256_fmadd_ps(_mm256_loadu_ps(pVect1 + 8), _mm256_loadu_ps(pVect2 + 8), sum256_2);
+        pVect1 += 16;
+        pVect2 += 16;
+    }
+
+    __m256 sum256 = _mm256_add_ps(sum256_1, sum256_2);
+    __m128 sum_prod = _mm_add_ps(_mm256_extractf128_ps(sum256, 0), _mm256_extractf128_ps(sum256, 1));
+
+    while (pVect1 < pEnd2) {
+        sum_prod = _mm_fmadd_ps(_mm_loadu_ps(pVect1), _mm_loadu_ps(pVect2), sum_prod);
+        pVect1 += 4;
+        pVect2 += 4;
+    }
+
+    _mm_store_ps(TmpRes, sum_prod);
+    float sum = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
+    return sum;
+}
+
+static float
+InnerProductDistanceSIMD4ExtAVX2(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    return 1.0f - InnerProductSIMD4ExtAVX2(pVect1v, pVect2v, qty_ptr);
+}
+
+HNSWLIB_TARGET_AVX2
+static float
+InnerProductSIMD16ExtAVX2(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    float PORTABLE_ALIGN32 TmpRes[8];
+    float *pVect1 = (float *) pVect1v;
+    float *pVect2 = (float *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+
+    size_t qty16 = qty / 16;
+
+    const float *pEnd1 = pVect1 + 16 * qty16;
+
+    __m256 sum256_1 = _mm256_setzero_ps();
+    __m256 sum256_2 = _mm256_setzero_ps();
+
+    while (pVect1 < pEnd1) {
+        sum256_1 = _mm256_fmadd_ps(_mm256_loadu_ps(pVect1), _mm256_loadu_ps(pVect2), sum256_1);
+        sum256_2 = _mm256_fmadd_ps(_mm256_loadu_ps(pVect1 + 8), _mm256_loadu_ps(pVect2 + 8), sum256_2);
+        pVect1 += 16;
+        pVect2 += 16;
+    }
+
+    _mm256_store_ps(TmpRes, _mm256_add_ps(sum256_1, sum256_2));
+    float sum = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
+
+    return sum;
+}
+
+static float
+InnerProductDistanceSIMD16ExtAVX2(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    return 1.0f - InnerProductSIMD16ExtAVX2(pVect1v, pVect2v, qty_ptr);
+}
+
+#endif
+
 #if defined(USE_AVX)
 
 // Favor using AVX if available.
+HNSWLIB_TARGET_AVX
 static float
 InnerProductSIMD4ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     float PORTABLE_ALIGN32 TmpRes[8];
@@ -143,6 +225,7 @@ InnerProductDistanceSIMD4ExtSSE(const void *pVect1v, const void *pVect2v, const
 
 #if defined(USE_AVX512)
 
+HNSWLIB_TARGET_AVX512
 static float
 InnerProductSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     float PORTABLE_ALIGN64 TmpRes[16];
@@ -207,6 +290,7 @@ InnerProductDistanceSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, co
 
 #if defined(USE_AVX)
 
+HNSWLIB_TARGET_AVX
 static float
 InnerProductSIMD16ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     float PORTABLE_ALIGN32 TmpRes[8];
@@ -339,31 +423,175 @@ InnerProductDistanceSIMD4ExtResiduals(const void *pVect1v, const void *pVect2v,
 }
 #endif
 
+#if defined(USE_AVX2)
+
+// Computes the distances to four vectors at a time, so that each block of the query is loaded once for them,
+// and prefetches the next four vectors while computing. The last group is filled up with the last vector,
+// and the last block of the vectors is loaded with a mask. If Dim is not zero, it is the number of dimensions
+// known at compile time, so that the compiler can unroll the loops.
+template<size_t Dim>
+HNSWLIB_TARGET_AVX2
+static void
+InnerProductDistanceBatchAVX2(const void *pQueryv, const void *const *pVects, size_t n, const void *qty_ptr, float *res) {
+    const float *pQuery = (const float *) pQueryv;
+    const size_t qty = Dim > 0 ? Dim : *((size_t *) qty_ptr);
+    const size_t qty8 = qty >> 3 << 3;
+    const __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32((int) (qty - qty8)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    float PORTABLE_ALIGN32 TmpRes[4];
+
+    for (size_t j = 0; j < n; j += 4) {
+        const float *pVect0 = (const float *) pVects[j];
+        const float *pVect1 = (const float *) pVects[std::min(j + 1, n - 1)];
+        const float *pVect2 = (const float *) pVects[std::min(j + 2, n - 1)];
+        const float *pVect3 = (const float *) pVects[std::min(j + 3, n - 1)];
+        for (size_t k = j + 4; k < j + 8 && k < n; k++) _mm_prefetch((const char *) pVects[k], _MM_HINT_T0);
+
+        __m256 sum0 = _mm256_setzero_ps();
+        __m256 sum1 = _mm256_setzero_ps();
+        __m256 sum2 = _mm256_setzero_ps();
+        __m256 sum3 = _mm256_setzero_ps();
+        for (size_t i = 0; i < qty8; i += 8) {
+            const __m256 q = _mm256_loadu_ps(pQuery + i);
+            sum0 = _mm256_fmadd_ps(q, _mm256_loadu_ps(pVect0 + i), sum0);
+            sum1 = _mm256_fmadd_ps(q, _mm256_loadu_ps(pVect1 + i), sum1);
+            sum2 = _mm256_fmadd_ps(q, _mm256_loadu_ps(pVect2 + i), sum2);
+            sum3 = _mm256_fmadd_ps(q, _mm256_loadu_ps(pVect3 + i), sum3);
+        }
+        if (qty8 < qty) {
+            const __m256 q = _mm256_maskload_ps(pQuery + qty8, mask);
+            sum0 = _mm256_fmadd_ps(q, _mm256_maskload_ps(pVect0 + qty8, mask), sum0);
+            sum1 = _mm256_fmadd_ps(q, _mm256_maskload_ps(pVect1 + qty8, mask), sum1);
+            sum2 = _mm256_fmadd_ps(q, _mm256_maskload_ps(pVect2 + qty8, mask), sum2);
+            sum3 = _mm256_fmadd_ps(q, _mm256_maskload_ps(pVect3 + qty8, mask), sum3);
+        }
+
+        const __m128 dists = _mm_sub_ps(_mm_set1_ps(1.0f), HorizontalSum4AVX2(sum0, sum1, sum2, sum3));
+        if (j + 4 <= n) {
+            _mm_storeu_ps(res + j, dists);
+        } else {
+            _mm_store_ps(TmpRes, dists);
+            for (size_t k = j; k < n; k++) res[k] = TmpRes[k - j];
+        }
+    }
+}
+
+#endif
+
+#if defined(USE_AVX512)
+
+// Computes the distances in the same way as InnerProductDistanceBatchAVX2 with 512-bit registers.
+template<size_t Dim>
+HNSWLIB_TARGET_AVX512
+static void
+InnerProductDistanceBatchAVX512(const void *pQueryv, const void *const *pVects, size_t n, const void *qty_ptr, float *res) {
+    const float *pQuery = (const float *) pQueryv;
+    const size_t qty = Dim > 0 ? Dim : *((size_t *) qty_ptr);
+    const size_t qty16 = qty >> 4 << 4;
+    const __mmask16 mask = (__mmask16) ((1U << (qty - qty16)) - 1);
+    float TmpRes[4];
+
+    for (size_t j = 0; j < n; j += 4) {
+        const float *pVect0 = (const float *) pVects[j];
+        const float *pVect1 = (const float *) pVects[std::min(j + 1, n - 1)];
+        const float *pVect2 = (const float *) pVects[std::min(j + 2, n - 1)];
+        const float *pVect3 = (const float *) pVects[std::min(j + 3, n - 1)];
+        for (size_t k = j + 4; k < j + 8 && k < n; k++) _mm_prefetch((const char *) pVects[k], _MM_HINT_T0);
+
+        __m512 sum0 = _mm512_setzero_ps();
+        __m512 sum1 = _mm512_setzero_ps();
+        __m512 sum2 = _mm512_setzero_ps();
+        __m512 sum3 = _mm512_setzero_ps();
+        for (size_t i = 0; i < qty16; i += 16) {
+            const __m512 q = _mm512_loadu_ps(pQuery + i);
+            sum0 = _mm512_fmadd_ps(q, _mm512_loadu_ps(pVect0 + i), sum0);
+            sum1 = _mm512_fmadd_ps(q, _mm512_loadu_ps(pVect1 + i), sum1);
+            sum2 = _mm512_fmadd_ps(q, _mm512_loadu_ps(pVect2 + i), sum2);
+            sum3 = _mm512_fmadd_ps(q, _mm512_loadu_ps(pVect3 + i), sum3);
+        }
+        if (mask) {
+            const __m512 q = _mm512_maskz_loadu_ps(mask, pQuery + qty16);
+            sum0 = _mm512_fmadd_ps(q, _mm512_maskz_loadu_ps(mask, pVect0 + qty16), sum0);
+            sum1 = _mm512_fmadd_ps(q, _mm512_maskz_loadu_ps(mask, pVect1 + qty16), sum1);
+            sum2 = _mm512_fmadd_ps(q, _mm512_maskz_loadu_ps(mask, pVect2 + qty16), sum2);
+            sum3 = _mm512_fmadd_ps(q, _mm512_maskz_loadu_ps(mask, pVect3 + qty16), sum3);
+        }
+
+        TmpRes[0] = 1.0f - _mm512_reduce_add_ps(sum0);
+        TmpRes[1] = 1.0f - _mm512_reduce_add_ps(sum1);
+        TmpRes[2] = 1.0f - _mm512_reduce_add_ps(sum2);
+        TmpRes[3] = 1.0f - _mm512_reduce_add_ps(sum3);
+        for (size_t k = j; k < n && k < j + 4; k++) res[k] = TmpRes[k - j];
+    }
+}
+
+#endif
+
+// Returns the batch kernel for the given number of dimensions, specialized for the common dimensions
+// of embedding models, or nullptr if the CPU does not support the kernels.
+static BATCHDISTFUNC<float>
+GetInnerProductDistanceBatchFunc(size_t dim) {
+#if defined(USE_AVX512)
+    if (AVX512Capable()) {
+        switch (dim) {
+        case 128: return InnerProductDistanceBatchAVX512<128>;
+        case 384: return InnerProductDistanceBatchAVX512<384>;
+        case 768: return InnerProductDistanceBatchAVX512<768>;
+        case 1536: return InnerProductDistanceBatchAVX512<1536>;
+        default: return InnerProductDistanceBatchAVX512<0>;
+        }
+    }
+#endif
+#if defined(USE_AVX2)
+    if (AVX2Capable()) {
+        switch (dim) {
+        case 128: return InnerProductDistanceBatchAVX2<128>;
+        case 384: return InnerProductDistanceBatchAVX2<384>;
+        case 768: return InnerProductDistanceBatchAVX2<768>;
+        case 1536: return InnerProductDistanceBatchAVX2<1536>;
+        default: return InnerProductDistanceBatchAVX2<0>;
+        }
+    }
+#endif
+    return nullptr;
+}
+
 class InnerProductSpace : public SpaceInterface<float> {
     DISTFUNC<float> fstdistfunc_;
+    BATCHDISTFUNC<float> batchdistfunc_;
     size_t data_size_;
     size_t dim_;
 
  public:
-    InnerProductSpace() : data_size_(0), dim_(0) { }
+    InnerProductSpace() : batchdistfunc_(nullptr), data_size_(0), dim_(0) { }
 
     InnerProductSpace(size_t dim) {
         fstdistfunc_ = InnerProductDistance;
+        batchdistfunc_ = GetInnerProductDistanceBatchFunc(dim);
 #if defined(USE_AVX) || defined(USE_SSE) || defined(USE_AVX512)
     #if defined(USE_AVX512)
         if (AVX512Capable()) {
             InnerProductSIMD16Ext = InnerProductSIMD16ExtAVX512;
             InnerProductDistanceSIMD16Ext = InnerProductDistanceSIMD16ExtAVX512;
-        } else if (AVXCapable()) {
-            InnerProductSIMD16Ext = InnerProductSIMD16ExtAVX;
-            InnerProductDistanceSIMD16Ext = InnerProductDistanceSIMD16ExtAVX;
-        }
-    #elif defined(USE_AVX)
+        } else
+    #endif
+    #if defined(USE_AVX2)
+        if (AVX2Capable()) {
+            InnerProductSIMD16Ext = InnerProductSIMD16ExtAVX2;
+            InnerProductDistanceSIMD16Ext = InnerProductDistanceSIMD16ExtAVX2;
+        } else
+    #endif
+    #if defined(USE_AVX)
         if (AVXCapable()) {
             InnerProductSIMD16Ext = InnerProductSIMD16ExtAVX;
             InnerProductDistanceSIMD16Ext = InnerProductDistanceSIMD16ExtAVX;
         }
     #endif
+    #if defined(USE_AVX2)
+        if (AVX2Capable()) {
+            InnerProductSIMD4Ext = InnerProductSIMD4ExtAVX2;
+            InnerProductDistanceSIMD4Ext = InnerProductDistanceSIMD4ExtAVX2;
+        } else
+    #endif
     #if defined(USE_AVX)
         if (AVXCapable()) {
             InnerProductSIMD4Ext = InnerProductSIMD4ExtAVX;
@@ -396,6 +624,10 @@ class InnerProductSpace : public SpaceInterface<float> {
         return &dim_;
     }
 
+    BATCHDISTFUNC<float> get_query_batch_dist_func() {
+        return batchdistfunc_;
+    }
+
 ~InnerProductSpace() {}
 };
 
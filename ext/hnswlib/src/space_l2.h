@@ -1,5 +1,6 @@
 #pragma once
 #include "hnswlib.h"
+#include <algorithm>
 
 namespace hnswlib {
 
@@ -22,6 +23,7 @@ L2Sqr(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
 #if defined(USE_AVX512)
 
 // Favor using AVX512 if available.
+HNSWLIB_TARGET_AVX512
 static float
 L2SqrSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     float *pVect1 = (float *) pVect1v;
@@ -41,8 +43,7 @@ L2SqrSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void *qty_p
         v2 = _mm512_loadu_ps(pVect2);
         pVect2 += 16;
         diff = _mm512_sub_ps(v1, v2);
-        // sum = _mm512_fmadd_ps(diff, diff, sum);
-        sum = _mm512_add_ps(sum, _mm512_mul_ps(diff, diff));
+        sum = _mm512_fmadd_ps(diff, diff, sum);
     }
 
     _mm512_store_ps(TmpRes, sum);
@@ -54,9 +55,42 @@ L2SqrSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void *qty_p
 }
 #endif
 
+#if defined(USE_AVX2)
+
+HNSWLIB_TARGET_AVX2
+static float
+L2SqrSIMD16ExtAVX2(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    float *pVect1 = (float *) pVect1v;
+    float *pVect2 = (float *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    float PORTABLE_ALIGN32 TmpRes[8];
+    size_t qty16 = qty >> 4;
+
+    const float *pEnd1 = pVect1 + (qty16 << 4);
+
+    __m256 diff1, diff2;
+    __m256 sum1 = _mm256_setzero_ps();
+    __m256 sum2 = _mm256_setzero_ps();
+
+    while (pVect1 < pEnd1) {
+        diff1 = _mm256_sub_ps(_mm256_loadu_ps(pVect1), _mm256_loadu_ps(pVect2));
+        diff2 = _mm256_sub_ps(_mm256_loadu_ps(pVect1 + 8), _mm256_loadu_ps(pVect2 + 8));
+        pVect1 += 16;
+        pVect2 += 16;
+        sum1 = _mm256_fmadd_ps(diff1, diff1, sum1);
+        sum2 = _mm256_fmadd_ps(diff2, diff2, sum2);
+    }
+
+    _mm256_store_ps(TmpRes, _mm256_add_ps(sum1, sum2));
+    return TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
+}
+
+#endif
+
 #if defined(USE_AVX)
 
 // Favor using AVX if available.
+HNSWLIB_TARGET_AVX
 static float
 L2SqrSIMD16ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     float *pVect1 = (float *) pVect1v;
@@ -205,23 +239,178 @@ L2SqrSIMD4ExtResiduals(const void *pVect1v, const void *pVect2v, const void *qty
 }
 #endif
 
+#if defined(USE_AVX2)
+
+// Computes the distances to four vectors at a time, so that each block of the query is loaded once for them,
+// and prefetches the next four vectors while computing. The last group is filled up with the last vector,
+// and the last block of the vectors is loaded with a mask. If Dim is not zero, it is the number of dimensions
+// known at compile time, so that the compiler can unroll the loops.
+template<size_t Dim>
+HNSWLIB_TARGET_AVX2
+static void
+L2SqrBatchAVX2(const void *pQueryv, const void *const *pVects, size_t n, const void *qty_ptr, float *res) {
+    const float *pQuery = (const float *) pQueryv;
+    const size_t qty = Dim > 0 ? Dim : *((size_t *) qty_ptr);
+    const size_t qty8 = qty >> 3 << 3;
+    const __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32((int) (qty - qty8)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    float PORTABLE_ALIGN32 TmpRes[4];
+
+    for (size_t j = 0; j < n; j += 4) {
+        const float *pVect0 = (const float *) pVects[j];
+        const float *pVect1 = (const float *) pVects[std::min(j + 1, n - 1)];
+        const float *pVect2 = (const float *) pVects[std::min(j + 2, n - 1)];
+        const float *pVect3 = (const float *) pVects[std::min(j + 3, n - 1)];
+        for (size_t k = j + 4; k < j + 8 && k < n; k++) _mm_prefetch((const char *) pVects[k], _MM_HINT_T0);
+
+        __m256 sum0 = _mm256_setzero_ps();
+        __m256 sum1 = _mm256_setzero_ps();
+        __m256 sum2 = _mm256_setzero_ps();
+        __m256 sum3 = _mm256_setzero_ps();
+        for (size_t i = 0; i < qty8; i += 8) {
+            const __m256 q = _mm256_loadu_ps(pQuery + i);
+            const __m256 diff0 = _mm256_sub_ps(q, _mm256_loadu_ps(pVect0 + i));
+            const __m256 diff1 = _mm256_sub_ps(q, _mm256_loadu_ps(pVect1 + i));
+            const __m256 diff2 = _mm256_sub_ps(q, _mm256_loadu_ps(pVect2 + i));
+            const __m256 diff3 = _mm256_sub_ps(q, _mm256_loadu_ps(pVect3 + i));
+            sum0 = _mm256_fmadd_ps(diff0, diff0, sum0);
+            sum1 = _mm256_fmadd_ps(diff1, diff1, sum1);
+            sum2 = _mm256_fmadd_ps(diff2, diff2, sum2);
+            sum3 = _mm256_fmadd_ps(diff3, diff3, sum3);
+        }
+        if (qty8 < qty) {
+            const __m256 q = _mm256_maskload_ps(pQuery + qty8, mask);
+            const __m256 diff0 = _mm256_sub_ps(q, _mm256_maskload_ps(pVect0 + qty8, mask));
+            const __m256 diff1 = _mm256_sub_ps(q, _mm256_maskload_ps(pVect1 + qty8, mask));
+            const __m256 diff2 = _mm256_sub_ps(q, _mm256_maskload_ps(pVect2 + qty8, mask));
+            const __m256 diff3 = _mm256_sub_ps(q, _mm256_maskload_ps(pVect3 + qty8, mask));
+            sum0 = _mm256_fmadd_ps(diff0, diff0, sum0);
+            sum1 = _mm256_fmadd_ps(diff1, diff1, sum1);
+            sum2 = _mm256_fmadd_ps(diff2, diff2, sum2);
+            sum3 = _mm256_fmadd_ps(diff3, diff3, sum3);
+        }
+
+        const __m128 dists = HorizontalSum4AVX2(sum0, sum1, sum2, sum3);
+        if (j + 4 <= n) {
+            _mm_storeu_ps(res + j, dists);
+        } else {
+            _mm_store_ps(TmpRes, dists);
+            for (size_t k = j; k < n; k++) res[k] = TmpRes[k - j];
+        }
+    }
+}
+
+#endif
+
+#if defined(USE_AVX512)
+
+// Computes the distances in the same way as L2SqrBatchAVX2 with 512-bit registers.
+template<size_t Dim>
+HNSWLIB_TARGET_AVX512
+static void
+L2SqrBatchAVX512(const void *pQueryv, const void *const *pVects, size_t n, const void *qty_ptr, float *res) {
+    const float *pQuery = (const float *) pQueryv;
+    const size_t qty = Dim > 0 ? Dim : *((size_t *) qty_ptr);
+    const size_t qty16 = qty >> 4 << 4;
+    const __mmask16 mask = (__mmask16) ((1U << (qty - qty16)) - 1);
+    float TmpRes[4];
+
+    for (size_t j = 0; j < n; j += 4) {
+        const float *pVect0 = (const float *) pVects[j];
+        const float *pVect1 = (const float *) pVects[std::min(j + 1, n - 1)];
+        const float *pVect2 = (const float *) pVects[std::min(j + 2, n - 1)];
+        const float *pVect3 = (const float *) pVects[std::min(j + 3, n - 1)];
+        for (size_t k = j + 4; k < j + 8 && k < n; k++) _mm_prefetch((const char *) pVects[k], _MM_HINT_T0);
+
+        __m512 sum0 = _mm512_setzero_ps();
+        __m512 sum1 = _mm512_setzero_ps();
+        __m512 sum2 = _mm512_setzero_ps();
+        __m512 sum3 = _mm512_setzero_ps();
+        for (size_t i = 0; i < qty16; i += 16) {
+            const __m512 q = _mm512_loadu_ps(pQuery + i);
+            const __m512 diff0 = _mm512_sub_ps(q, _mm512_loadu_ps(pVect0 + i));
+            const __m512 diff1 = _mm512_sub_ps(q, _mm512_loadu_ps(pVect1 + i));
+            const __m512 diff2 = _mm512_sub_ps(q, _mm512_loadu_ps(pVect2 + i));
+            const __m512 diff3 = _mm512_sub_ps(q, _mm512_loadu_ps(pVect3 + i));
+            sum0 = _mm512_fmadd_ps(diff0, diff0, sum0);
+            sum1 = _mm512_fmadd_ps(diff1, diff1, sum1);
+            sum2 = _mm512_fmadd_ps(diff2, diff2, sum2);
+            sum3 = _mm512_fmadd_ps(diff3, diff3, sum3);
+        }
+        if (mask) {
+            const __m512 q = _mm512_maskz_loadu_ps(mask, pQuery + qty16);
+            const __m512 diff0 = _mm512_sub_ps(q, _mm512_maskz_loadu_ps(mask, pVect0 + qty16));
+            const __m512 diff1 = _mm512_sub_ps(q, _mm512_maskz_loadu_ps(mask, pVect1 + qty16));
+            const __m512 diff2 = _mm512_sub_ps(q, _mm512_maskz_loadu_ps(mask, pVect2 + qty16));
+            const __m512 diff3 = _mm512_sub_ps(q, _mm512_maskz_loadu_ps(mask, pVect3 + qty16));
+            sum0 = _mm512_fmadd_ps(diff0, diff0, sum0);
+            sum1 = _mm512_fmadd_ps(diff1, diff1, sum1);
+            sum2 = _mm512_fmadd_ps(diff2, diff2, sum2);
+            sum3 = _mm512_fmadd_ps(diff3, diff3, sum3);
+        }
+
+        TmpRes[0] = _mm512_reduce_add_ps(sum0);
+        TmpRes[1] = _mm512_reduce_add_ps(sum1);
+        TmpRes[2] = _mm512_reduce_add_ps(sum2);
+        TmpRes[3] = _mm512_reduce_add_ps(sum3);
+        for (size_t k = j; k < n && k < j + 4; k++) res[k] = TmpRes[k - j];
+    }
+}
+
+#endif
+
+// Returns the batch kernel for the given number of dimensions, specialized for the common dimensions
+// of embedding models, or nullptr if the CPU does not support the kernels.
+static BATCHDISTFUNC<float>
+GetL2SqrBatchFunc(size_t dim) {
+#if defined(USE_AVX512)
+    if (AVX512Capable()) {
+        switch (dim) {
+        case 128: return L2SqrBatchAVX512<128>;
+        case 384: return L2SqrBatchAVX512<384>;
+        case 768: return L2SqrBatchAVX512<768>;
+        case 1536: return L2SqrBatchAVX512<1536>;
+        default: return L2SqrBatchAVX512<0>;
+        }
+    }
+#endif
+#if defined(USE_AVX2)
+    if (AVX2Capable()) {
+        switch (dim) {
+        case 128: return L2SqrBatchAVX2<128>;
+        case 384: return L2SqrBatchAVX2<384>;
+        case 768: return L2SqrBatchAVX2<768>;
+        case 1536: return L2SqrBatchAVX2<1536>;
+        default: return L2SqrBatchAVX2<0>;
+        }
+    }
+#endif
+    return nullptr;
+}
+
 class L2Space : public SpaceInterface<float> {
     DISTFUNC<float> fstdistfunc_;
+    BATCHDISTFUNC<float> batchdistfunc_;
     size_t data_size_;
     size_t dim_;
 
  public:
-    L2Space() : data_size_(0), dim_(0) { }
+    L2Space() : batchdistfunc_(nullptr), data_size_(0), dim_(0) { }
 
     L2Space(size_t dim) {
         fstdistfunc_ = L2Sqr;
+        batchdistfunc_ = GetL2SqrBatchFunc(dim);
 #if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
     #if defined(USE_AVX512)
         if (AVX512Capable())
             L2SqrSIMD16Ext = L2SqrSIMD16ExtAVX512;
-        else if (AVXCapable())
-            L2SqrSIMD16Ext = L2SqrSIMD16ExtAVX;
-    #elif defined(USE_AVX)
+        else
+    #endif
+    #if defined(USE_AVX2)
+        if (AVX2Capable())
+            L2SqrSIMD16Ext = L2SqrSIMD16ExtAVX2;
+        else
+    #endif
+    #if defined(USE_AVX)
         if (AVXCapable())
             L2SqrSIMD16Ext = L2SqrSIMD16ExtAVX;
     #endif
@@ -251,6 +440,10 @@ class L2Space : public SpaceInterface<float> {
         return &dim_;
     }
 
+    BATCHDISTFUNC<float> get_query_batch_dist_func() {
+        return batchdistfunc_;
+    }
+
     ~L2Space() {}
 };
 
@@ -293,6 +486,34 @@ static int L2SqrI(const void* __restrict pVect1, const void* __restrict pVect2,
     return (res);
 }
 
+#if defined(USE_AVX2)
+
+// Widens the bytes to 16-bit integers, and sums the squared differences in pairs into 32-bit integers.
+HNSWLIB_TARGET_AVX2
+static int
+L2SqrIAVX2(const void *__restrict pVect1, const void *__restrict pVect2, const void *__restrict qty_ptr) {
+    size_t qty = *((size_t *) qty_ptr);
+    const unsigned char *a = (const unsigned char *) pVect1;
+    const unsigned char *b = (const unsigned char *) pVect2;
+    int PORTABLE_ALIGN32 TmpRes[8];
+
+    __m256i sum = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 16 <= qty; i += 16) {
+        const __m256i va = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (a + i)));
+        const __m256i vb = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (b + i)));
+        const __m256i diff = _mm256_sub_epi16(va, vb);
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(diff, diff));
+    }
+
+    _mm256_store_si256((__m256i *) TmpRes, sum);
+    int res = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
+    for (; i < qty; i++) res += (a[i] - b[i]) * (a[i] - b[i]);
+    return res;
+}
+
+#endif
+
 class L2SpaceI : public SpaceInterface<int> {
     DISTFUNC<int> fstdistfunc_;
     size_t data_size_;
@@ -305,6 +526,10 @@ class L2SpaceI : public SpaceInterface<int> {
         } else {
             fstdistfunc_ = L2SqrI;
         }
+    #if defined(USE_AVX2)
+        if (AVX2Capable())
+            fstdistfunc_ = L2SqrIAVX2;
+    #endif
         dim_ = dim;
         data_size_ = dim * sizeof(unsigned char);
     }
@@ -0,0 +1,350 @@
+#pragma once
+#include "hnswlib.h"
+#include <algorithm>
+#include <limits>
+#include <random>
+
+namespace hnswlib {
+
+// The number of centroids of each sub-quantizer, so that a sub-vector is stored as a byte.
+static const size_t PQ_N_CENTROIDS = 256;
+
+// Parameters of the distance functions between product-quantized vectors. The table holds the squared
+// distances between the centroids of each sub-quantizer: table[(j * 256 + code_a) * 256 + code_b].
+struct PQDistParam {
+    size_t n_subvectors;
+    const float *table;
+};
+
+// Symmetric distance between two codes, used to build the graph.
+static float
+L2SqrPQ(const void *pVect1v, const void *pVect2v, const void *param_ptr) {
+    const PQDistParam *param = (const PQDistParam *) param_ptr;
+    const uint8_t *pVect1 = (const uint8_t *) pVect1v;
+    const uint8_t *pVect2 = (const uint8_t *) pVect2v;
+
+    float res = 0;
+    for (size_t j = 0; j < param->n_subvectors; j++) {
+        res += param->table[(j * PQ_N_CENTROIDS + pVect1[j]) * PQ_N_CENTROIDS + pVect2[j]];
+    }
+    return res;
+}
+
+// Asymmetric distance between a query given as the lookup table of its squared distances to
+// the centroids, lut[j * 256 + code], and a code.
+static float
+L2SqrPQLookup(const void *pVect1v, const void *pVect2v, const void *param_ptr) {
+    const PQDistParam *param = (const PQDistParam *) param_ptr;
+    const float *lut = (const float *) pVect1v;
+    const uint8_t *pVect2 = (const uint8_t *) pVect2v;
+
+    float res = 0;
+    for (size_t j = 0; j < param->n_subvectors; j++) {
+        res += lut[j * PQ_N_CENTROIDS + pVect2[j]];
+    }
+    return res;
+}
+
+#if defined(USE_AVX2)
+
+// Gathers the table entries of eight sub-vectors at once.
+HNSWLIB_TARGET_AVX2
+static float
+L2SqrPQAVX2(const void *pVect1v, const void *pVect2v, const void *param_ptr) {
+    const PQDistParam *param = (const PQDistParam *) param_ptr;
+    const uint8_t *pVect1 = (const uint8_t *) pVect1v;
+    const uint8_t *pVect2 = (const uint8_t *) pVect2v;
+    const size_t qty = param->n_subvectors;
+    float PORTABLE_ALIGN32 TmpRes[8];
+
+    const __m256i step = _mm256_set1_epi32(8 * PQ_N_CENTROIDS * PQ_N_CENTROIDS);
+    __m256i offset = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                                        _mm256_set1_epi32(PQ_N_CENTROIDS * PQ_N_CENTROIDS));
+    __m256 sum = _mm256_setzero_ps();
+    size_t j = 0;
+    for (; j + 8 <= qty; j += 8) {
+        const __m256i c1 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (pVect1 + j)));
+        const __m256i c2 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (pVect2 + j)));
+        const __m256i idx = _mm256_add_epi32(offset, _mm256_add_epi32(_mm256_slli_epi32(c1, 8), c2));
+        sum = _mm256_add_ps(sum, _mm256_i32gather_ps(param->table, idx, 4));
+        offset = _mm256_add_epi32(offset, step);
+    }
+
+    _mm256_store_ps(TmpRes, sum);
+    float res = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
+    for (; j < qty; j++) {
+        res += param->table[(j * PQ_N_CENTROIDS + pVect1[j]) * PQ_N_CENTROIDS + pVect2[j]];
+    }
+    return res;
+}
+
+HNSWLIB_TARGET_AVX2
+static float
+L2SqrPQLookupAVX2(const void *pVect1v, const void *pVect2v, const void *param_ptr) {
+    const PQDistParam *param = (const PQDistParam *) param_ptr;
+    const float *lut = (const float *) pVect1v;
+    const uint8_t *pVect2 = (const uint8_t *) pVect2v;
+    const size_t qty = param->n_subvectors;
+    float PORTABLE_ALIGN32 TmpRes[8];
+
+    const __m256i step = _mm256_set1_epi32(8 * PQ_N_CENTROIDS);
+    __m256i offset = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(PQ_N_CENTROIDS));
+    __m256 sum = _mm256_setzero_ps();
+    size_t j = 0;
+    for (; j + 8 <= qty; j += 8) {
+        const __m256i c = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (pVect2 + j)));
+        sum = _mm256_add_ps(sum, _mm256_i32gather_ps(lut, _mm256_add_epi32(offset, c), 4));
+        offset = _mm256_add_epi32(offset, step);
+    }
+
+    _mm256_store_ps(TmpRes, sum);
+    float res = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
+    for (; j < qty; j++) {
+        res += lut[j * PQ_N_CENTROIDS + pVect2[j]];
+    }
+    return res;
+}
+
+#endif
+
+#if defined(USE_AVX512)
+
+HNSWLIB_TARGET_AVX512
+static float
+L2SqrPQLookupAVX512(const void *pVect1v, const void *pVect2v, const void *param_ptr) {
+    const PQDistParam *param = (const PQDistParam *) param_ptr;
+    const float *lut = (const float *) pVect1v;
+    const uint8_t *pVect2 = (const uint8_t *) pVect2v;
+    const size_t qty = param->n_subvectors;
+
+    const __m512i step = _mm512_set1_epi32(16 * PQ_N_CENTROIDS);
+    __m512i offset = _mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15),
+                                        _mm512_set1_epi32(PQ_N_CENTROIDS));
+    __m512 sum = _mm512_setzero_ps();
+    size_t j = 0;
+    for (; j + 16 <= qty; j += 16) {
+        const __m512i c = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *) (pVect2 + j)));
+        sum = _mm512_add_ps(sum, _mm512_i32gather_ps(_mm512_add_epi32(offset, c), lut, 4));
+        offset = _mm512_add_epi32(offset, step);
+    }
+
+    float res = _mm512_reduce_add_ps(sum);
+    for (; j < qty; j++) {
+        res += lut[j * PQ_N_CENTROIDS + pVect2[j]];
+    }
+    return res;
+}
+
+#endif
+
+// Splits float vectors into sub-vectors of equal length and stores each of them as the index of the nearest
+// centroid learned by k-means, so that a vector takes one byte per sub-vector. The distance between stored
+// vectors is the squared Euclidean distance between their centroids, and the distance from a query is computed
+// with a lookup table of the distances from the query sub-vectors to all centroids, prepared by encode_query.
+class L2SpacePQ : public SpaceInterface<float> {
+    DISTFUNC<float> fstdistfunc_;
+    DISTFUNC<float> lookupdistfunc_;
+    size_t data_size_;
+    size_t dim_;
+    size_t n_subvectors_;
+    size_t sub_dim_;
+    bool trained_;
+    std::vector<float> centroids_;  // centroids_[(j * 256 + code) * sub_dim_ + i]
+    std::vector<float> table_;
+    PQDistParam param_;
+
+    // The k-means runs on a subset of the samples, as the centroids hardly improve with more samples.
+    static const size_t MAX_TRAIN_SAMPLES = 32 * PQ_N_CENTROIDS;
+    static const size_t N_TRAIN_ITERATIONS = 16;
+
+    static float sqr_dist(const float *a, const float *b, size_t n) {
+        float res = 0;
+        for (size_t i = 0; i < n; i++) {
+            const float t = a[i] - b[i];
+            res += t * t;
+        }
+        return res;
+    }
+
+    size_t nearest_centroid(size_t j, const float *sub_vec) const {
+        const float *centroids = centroids_.data() + j * PQ_N_CENTROIDS * sub_dim_;
+        size_t best = 0;
+        float best_dist = std::numeric_limits<float>::max();
+        for (size_t c = 0; c < PQ_N_CENTROIDS; c++) {
+            const float dist = sqr_dist(sub_vec, centroids + c * sub_dim_, sub_dim_);
+            if (dist < best_dist) {
+                best_dist = dist;
+                best = c;
+            }
+        }
+        return best;
+    }
+
+    void update_table() {
+        for (size_t j = 0; j < n_subvectors_; j++) {
+            const float *centroids = centroids_.data() + j * PQ_N_CENTROIDS * sub_dim_;
+            float *table = table_.data() + j * PQ_N_CENTROIDS * PQ_N_CENTROIDS;
+            for (size_t a = 0; a < PQ_N_CENTROIDS; a++) {
+                for (size_t b = 0; b < PQ_N_CENTROIDS; b++) {
+                    table[a * PQ_N_CENTROIDS + b] = sqr_dist(centroids + a * sub_dim_, centroids + b * sub_dim_, sub_dim_);
+                }
+            }
+        }
+    }
+
+ public:
+    L2SpacePQ() : fstdistfunc_(nullptr), lookupdistfunc_(nullptr), data_size_(0), dim_(0), n_subvectors_(0), sub_dim_(0),
+                  trained_(false), param_({0, nullptr}) { }
+
+    L2SpacePQ(size_t dim, size_t n_subvectors) {
+        if (n_subvectors == 0 || dim % n_subvectors != 0)
+            throw std::runtime_error("The dimensionality must be divisible by the number of sub-vectors");
+        fstdistfunc_ = L2SqrPQ;
+        lookupdistfunc_ = L2SqrPQLookup;
+#if defined(USE_AVX2)
+        if (AVX2Capable()) {
+            fstdistfunc_ = L2SqrPQAVX2;
+            lookupdistfunc_ = L2SqrPQLookupAVX2;
+        }
+#endif
+#if defined(USE_AVX512)
+        if (AVX512Capable())
+            lookupdistfunc_ = L2SqrPQLookupAVX512;
+#endif
+        dim_ = dim;
+        n_subvectors_ = n_subvectors;
+        sub_dim_ = dim / n_subvectors;
+        data_size_ = n_subvectors * sizeof(uint8_t);
+        trained_ = false;
+        centroids_.assign(n_subvectors * PQ_N_CENTROIDS * sub_dim_, 0.0f);
+        table_.assign(n_subvectors * PQ_N_CENTROIDS * PQ_N_CENTROIDS, 0.0f);
+        param_.n_subvectors = n_subvectors_;
+        param_.table = table_.data();
+    }
+
+    // Learns the centroids of each sub-quantizer with k-means on n sample vectors stored in a row-major array.
+    // If there are fewer samples than centroids, the samples are used as the centroids as they are.
+    void train(const float *samples, size_t n) {
+        if (n == 0) return;
+        std::mt19937 rng(42);
+        std::vector<size_t> ids(n);
+        for (size_t i = 0; i < n; i++) ids[i] = i;
+        std::shuffle(ids.begin(), ids.end(), rng);
+        if (ids.size() > MAX_TRAIN_SAMPLES) ids.resize(MAX_TRAIN_SAMPLES);
+        const size_t n_samples = ids.size();
+
+        std::vector<size_t> assignments(n_samples);
+        std::vector<size_t> counts(PQ_N_CENTROIDS);
+        for (size_t j = 0; j < n_subvectors_; j++) {
+            float *centroids = centroids_.data() + j * PQ_N_CENTROIDS * sub_dim_;
+            for (size_t c = 0; c < PQ_N_CENTROIDS; c++) {
+                const float *sub_vec = samples + ids[c % n_samples] * dim_ + j * sub_dim_;
+                std::copy(sub_vec, sub_vec + sub_dim_, centroids + c * sub_dim_);
+            }
+            if (n_samples <= PQ_N_CENTROIDS) continue;
+
+            for (size_t iter = 0; iter < N_TRAIN_ITERATIONS; iter++) {
+                for (size_t s = 0; s < n_samples; s++) {
+                    assignments[s] = nearest_centroid(j, samples + ids[s] * dim_ + j * sub_dim_);
+                }
+                std::fill(centroids, centroids + PQ_N_CENTROIDS * sub_dim_, 0.0f);
+                std::fill(counts.begin(), counts.end(), 0);
+                for (size_t s = 0; s < n_samples; s++) {
+                    const float *sub_vec = samples + ids[s] * dim_ + j * sub_dim_;
+                    float *centroid = centroids + assignments[s] * sub_dim_;
+                    for (size_t i = 0; i < sub_dim_; i++) centroid[i] += sub_vec[i];
+                    counts[assignments[s]]++;
+                }
+                for (size_t c = 0; c < PQ_N_CENTROIDS; c++) {
+                    float *centroid = centroids + c * sub_dim_;
+                    if (counts[c] == 0) {
+                        // Moves an empty cluster onto a random sample to keep all codes in use.
+                        const float *sub_vec = samples + ids[rng() % n_samples] * dim_ + j * sub_dim_;
+                        std::copy(sub_vec, sub_vec + sub_dim_, centroid);
+                        continue;
+                    }
+                    for (size_t i = 0; i < sub_dim_; i++) centroid[i] /= counts[c];
+                }
+            }
+        }
+        update_table();
+        trained_ = true;
+    }
+
+    bool is_trained() {
+        return trained_;
+    }
+
+    size_t get_n_subvectors() const {
+        return n_subvectors_;
+    }
+
+    size_t get_data_size() {
+        return data_size_;
+    }
+
+    DISTFUNC<float> get_dist_func() {
+        return fstdistfunc_;
+    }
+
+    void *get_dist_func_param() {
+        return &param_;
+    }
+
+    bool is_encoded() {
+        return true;
+    }
+
+    void encode(const float *src, void *dst) {
+        uint8_t *codes = (uint8_t *) dst;
+        for (size_t j = 0; j < n_subvectors_; j++) codes[j] = (uint8_t) nearest_centroid(j, src + j * sub_dim_);
+    }
+
+    void decode(const void *src, float *dst) {
+        const uint8_t *codes = (const uint8_t *) src;
+        for (size_t j = 0; j < n_subvectors_; j++) {
+            const float *centroid = centroids_.data() + (j * PQ_N_CENTROIDS + codes[j]) * sub_dim_;
+            std::copy(centroid, centroid + sub_dim_, dst + j * sub_dim_);
+        }
+    }
+
+    size_t get_query_size() {
+        return n_subvectors_ * PQ_N_CENTROIDS * sizeof(float);
+    }
+
+    void encode_query(const float *src, void *dst) {
+        float *lut = (float *) dst;
+        for (size_t j = 0; j < n_subvectors_; j++) {
+            const float *centroids = centroids_.data() + j * PQ_N_CENTROIDS * sub_dim_;
+            for (size_t c = 0; c < PQ_N_CENTROIDS; c++) {
+                lut[j * PQ_N_CENTROIDS + c] = sqr_dist(src + j * sub_dim_, centroids + c * sub_dim_, sub_dim_);
+            }
+        }
+    }
+
+    DISTFUNC<float> get_query_dist_func() {
+        return lookupdistfunc_;
+    }
+
+    size_t get_state_size() {
+        return sizeof(uint8_t) + centroids_.size() * sizeof(float);
+    }
+
+    void save_state(std::ostream &output) {
+        const uint8_t trained = trained_ ? 1 : 0;
+        writeBinaryPOD(output, trained);
+        output.write((const char *) centroids_.data(), centroids_.size() * sizeof(float));
+    }
+
+    void load_state(std::istream &input) {
+        uint8_t trained;
+        readBinaryPOD(input, trained);
+        input.read((char *) centroids_.data(), centroids_.size() * sizeof(float));
+        update_table();
+        trained_ = trained != 0;
+    }
+
+    ~L2SpacePQ() {}
+};
+
+}  // namespace hnswlib
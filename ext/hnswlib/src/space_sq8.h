@@ -0,0 +1,223 @@
+#pragma once
+#include "hnswlib.h"
+#include <algorithm>
+#include <cmath>
+
+namespace hnswlib {
+
+// Parameters of the distance function between scalar-quantized vectors.
+// The weights are the squared quantization steps of each dimension.
+struct SQ8DistParam {
+    size_t dim;
+    const float *weights;
+};
+
+static float
+L2SqrSQ8(const void *pVect1v, const void *pVect2v, const void *param_ptr) {
+    const SQ8DistParam *param = (const SQ8DistParam *) param_ptr;
+    const uint8_t *pVect1 = (const uint8_t *) pVect1v;
+    const uint8_t *pVect2 = (const uint8_t *) pVect2v;
+
+    float res = 0;
+    for (size_t i = 0; i < param->dim; i++) {
+        const float t = (float) ((int) pVect1[i] - (int) pVect2[i]);
+        res += param->weights[i] * t * t;
+    }
+    return res;
+}
+
+#if defined(USE_AVX2)
+
+// Widens the codes to 32-bit integers and accumulates the weighted squared differences in float.
+HNSWLIB_TARGET_AVX2
+static float
+L2SqrSQ8AVX2(const void *pVect1v, const void *pVect2v, const void *param_ptr) {
+    const SQ8DistParam *param = (const SQ8DistParam *) param_ptr;
+    const uint8_t *pVect1 = (const uint8_t *) pVect1v;
+    const uint8_t *pVect2 = (const uint8_t *) pVect2v;
+    const float *pWeight = param->weights;
+    const size_t qty = param->dim;
+    float PORTABLE_ALIGN32 TmpRes[8];
+
+    __m256 sum1 = _mm256_setzero_ps();
+    __m256 sum2 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= qty; i += 16) {
+        const __m128i v1 = _mm_loadu_si128((const __m128i *) (pVect1 + i));
+        const __m128i v2 = _mm_loadu_si128((const __m128i *) (pVect2 + i));
+        const __m256 diff1 = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_cvtepu8_epi32(v1), _mm256_cvtepu8_epi32(v2)));
+        const __m256 diff2 = _mm256_cvtepi32_ps(
+            _mm256_sub_epi32(_mm256_cvtepu8_epi32(_mm_srli_si128(v1, 8)), _mm256_cvtepu8_epi32(_mm_srli_si128(v2, 8))));
+        sum1 = _mm256_fmadd_ps(_mm256_mul_ps(diff1, diff1), _mm256_loadu_ps(pWeight + i), sum1);
+        sum2 = _mm256_fmadd_ps(_mm256_mul_ps(diff2, diff2), _mm256_loadu_ps(pWeight + i + 8), sum2);
+    }
+    for (; i + 8 <= qty; i += 8) {
+        const __m128i v1 = _mm_loadl_epi64((const __m128i *) (pVect1 + i));
+        const __m128i v2 = _mm_loadl_epi64((const __m128i *) (pVect2 + i));
+        const __m256 diff = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_cvtepu8_epi32(v1), _mm256_cvtepu8_epi32(v2)));
+        sum1 = _mm256_fmadd_ps(_mm256_mul_ps(diff, diff), _mm256_loadu_ps(pWeight + i), sum1);
+    }
+
+    _mm256_store_ps(TmpRes, _mm256_add_ps(sum1, sum2));
+    float res = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
+    for (; i < qty; i++) {
+        const float t = (float) ((int) pVect1[i] - (int) pVect2[i]);
+        res += pWeight[i] * t * t;
+    }
+    return res;
+}
+
+#endif
+
+#if defined(USE_AVX512)
+
+HNSWLIB_TARGET_AVX512
+static float
+L2SqrSQ8AVX512(const void *pVect1v, const void *pVect2v, const void *param_ptr) {
+    const SQ8DistParam *param = (const SQ8DistParam *) param_ptr;
+    const uint8_t *pVect1 = (const uint8_t *) pVect1v;
+    const uint8_t *pVect2 = (const uint8_t *) pVect2v;
+    const float *pWeight = param->weights;
+    const size_t qty = param->dim;
+
+    __m512 sum = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= qty; i += 16) {
+        const __m512i v1 = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *) (pVect1 + i)));
+        const __m512i v2 = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *) (pVect2 + i)));
+        const __m512 diff = _mm512_cvtepi32_ps(_mm512_sub_epi32(v1, v2));
+        sum = _mm512_fmadd_ps(_mm512_mul_ps(diff, diff), _mm512_loadu_ps(pWeight + i), sum);
+    }
+
+    float res = _mm512_reduce_add_ps(sum);
+    for (; i < qty; i++) {
+        const float t = (float) ((int) pVect1[i] - (int) pVect2[i]);
+        res += pWeight[i] * t * t;
+    }
+    return res;
+}
+
+#endif
+
+// Stores each dimension of float vectors as an 8-bit code, using the range of the dimension learned
+// from sample vectors: x ~ min + code * step. The distance is the squared Euclidean distance between
+// the reconstructed vectors, so that it is comparable to the one of L2Space.
+class L2SpaceSQ8 : public SpaceInterface<float> {
+    DISTFUNC<float> fstdistfunc_;
+    size_t data_size_;
+    size_t dim_;
+    bool trained_;
+    std::vector<float> mins_;
+    std::vector<float> steps_;
+    std::vector<float> weights_;
+    SQ8DistParam param_;
+
+ public:
+    L2SpaceSQ8() : fstdistfunc_(nullptr), data_size_(0), dim_(0), trained_(false), param_({0, nullptr}) { }
+
+    L2SpaceSQ8(size_t dim) : mins_(dim, 0.0f), steps_(dim, 0.0f), weights_(dim, 0.0f) {
+        fstdistfunc_ = L2SqrSQ8;
+#if defined(USE_AVX2)
+        if (AVX2Capable())
+            fstdistfunc_ = L2SqrSQ8AVX2;
+#endif
+#if defined(USE_AVX512)
+        if (AVX512Capable())
+            fstdistfunc_ = L2SqrSQ8AVX512;
+#endif
+        dim_ = dim;
+        data_size_ = dim * sizeof(uint8_t);
+        trained_ = false;
+        param_.dim = dim_;
+        param_.weights = weights_.data();
+    }
+
+    // Learns the range of each dimension from n sample vectors stored in a row-major array.
+    void train(const float *samples, size_t n) {
+        if (n == 0) return;
+        std::vector<float> maxs(samples, samples + dim_);
+        std::copy(samples, samples + dim_, mins_.begin());
+        for (size_t j = 1; j < n; j++) {
+            const float *vec = samples + j * dim_;
+            for (size_t i = 0; i < dim_; i++) {
+                mins_[i] = std::min(mins_[i], vec[i]);
+                maxs[i] = std::max(maxs[i], vec[i]);
+            }
+        }
+        for (size_t i = 0; i < dim_; i++) {
+            steps_[i] = (maxs[i] - mins_[i]) / 255.0f;
+            weights_[i] = steps_[i] * steps_[i];
+        }
+        trained_ = true;
+    }
+
+    bool is_trained() {
+        return trained_;
+    }
+
+    const std::vector<float> &get_mins() const {
+        return mins_;
+    }
+
+    const std::vector<float> &get_steps() const {
+        return steps_;
+    }
+
+    size_t get_data_size() {
+        return data_size_;
+    }
+
+    DISTFUNC<float> get_dist_func() {
+        return fstdistfunc_;
+    }
+
+    void *get_dist_func_param() {
+        return &param_;
+    }
+
+    bool is_encoded() {
+        return true;
+    }
+
+    // Values out of the learned range are clamped to the nearest end of the range.
+    void encode(const float *src, void *dst) {
+        uint8_t *codes = (uint8_t *) dst;
+        for (size_t i = 0; i < dim_; i++) {
+            if (steps_[i] <= 0.0f) {
+                codes[i] = 0;
+                continue;
+            }
+            const float code = std::round((src[i] - mins_[i]) / steps_[i]);
+            codes[i] = (uint8_t) std::min(255.0f, std::max(0.0f, code));
+        }
+    }
+
+    void decode(const void *src, float *dst) {
+        const uint8_t *codes = (const uint8_t *) src;
+        for (size_t i = 0; i < dim_; i++) dst[i] = mins_[i] + codes[i] * steps_[i];
+    }
+
+    size_t get_state_size() {
+        return sizeof(uint8_t) + 2 * dim_ * sizeof(float);
+    }
+
+    void save_state(std::ostream &output) {
+        const uint8_t trained = trained_ ? 1 : 0;
+        writeBinaryPOD(output, trained);
+        output.write((const char *) mins_.data(), dim_ * sizeof(float));
+        output.write((const char *) steps_.data(), dim_ * sizeof(float));
+    }
+
+    void load_state(std::istream &input) {
+        uint8_t trained;
+        readBinaryPOD(input, trained);
+        input.read((char *) mins_.data(), dim_ * sizeof(float));
+        input.read((char *) steps_.data(), dim_ * sizeof(float));
+        for (size_t i = 0; i < dim_; i++) weights_[i] = steps_[i] * steps_[i];
+        trained_ = trained != 0;
+    }
+
+    ~L2SpaceSQ8() {}
+};
+
+}  // namespace hnswlib
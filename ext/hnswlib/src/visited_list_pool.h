@@ -1,25 +1,62 @@
 #pragma once
 
+#include <atomic>
 #include <mutex>
 #include <string.h>
 #include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
 
 namespace hnswlib {
 typedef unsigned short int vl_type;
 
+// The number of elements from which the visited lists are bitmaps, which can be lowered to test them.
+#ifndef HNSWLIB_VISITED_BITMAP_MIN_ELEMENTS
+#define HNSWLIB_VISITED_BITMAP_MIN_ELEMENTS (1U << 22)
+#endif
+
+/*
+* Marks the elements visited by a search. Below BITMAP_MIN_ELEMENTS, each element has a tag that is
+* compared with the tag of the current search, so that reset only increments the tag. For larger indexes,
+* a tag array would take 2 bytes per element in every thread, so a bitmap taking 1 bit per element is used
+* instead, and reset clears only the words the search touched, as a search visits few of the elements.
+*/
 class VisitedList {
  public:
+    static const unsigned int BITMAP_MIN_ELEMENTS = HNSWLIB_VISITED_BITMAP_MIN_ELEMENTS;
+
     vl_type curV;
-    vl_type *mass;
+    vl_type *mass;  // tags of the elements, or nullptr if the bitmap is used
+    uint64_t *bits;  // bitmap of the elements, or nullptr if the tags are used
     unsigned int numelements;
+    std::vector<unsigned int> touched_words;  // indices of the non-zero words of the bitmap
+    // Scratch space of the search using the list for the ids and the distances of the neighbors of a node,
+    // which is kept with the list so that the searches do not allocate it on every call.
+    std::vector<unsigned int> neighbor_ids;
+    std::vector<uint64_t> neighbor_dists;  // distances of the type of the index, aligned to 8 bytes
 
-    VisitedList(int numelements1) {
-        curV = -1;
+    VisitedList(int numelements1) : curV(-1), mass(nullptr), bits(nullptr) {
         numelements = numelements1;
-        mass = new vl_type[numelements];
+        if (numelements < BITMAP_MIN_ELEMENTS) {
+            mass = new vl_type[numelements];
+        } else {
+            bits = new uint64_t[numWords()]();
+        }
     }
 
     void reset() {
+        if (bits) {
+            // Clearing the whole bitmap is faster once the search has touched a large part of it.
+            if (touched_words.size() > numWords() / 16) {
+                memset(bits, 0, sizeof(uint64_t) * numWords());
+            } else {
+                for (unsigned int word : touched_words) bits[word] = 0;
+            }
+            touched_words.clear();
+            return;
+        }
         curV++;
         if (curV == 0) {
             memset(mass, 0, sizeof(vl_type) * numelements);
@@ -27,7 +64,35 @@ class VisitedList {
         }
     }
 
-    ~VisitedList() { delete[] mass; }
+    // Marks the element visited, and returns whether it had been visited.
+    inline bool testAndSet(unsigned int id) {
+        if (mass) {
+            if (mass[id] == curV) return true;
+            mass[id] = curV;
+            return false;
+        }
+        uint64_t &word = bits[id >> 6];
+        const uint64_t bit = (uint64_t) 1 << (id & 63);
+        if (word & bit) return true;
+        if (word == 0) touched_words.push_back(id >> 6);
+        word |= bit;
+        return false;
+    }
+
+    // Returns the address of the mark of the element to be prefetched.
+    inline const char *address(unsigned int id) const {
+        return mass ? (const char *) (mass + id) : (const char *) (bits + (id >> 6));
+    }
+
+    ~VisitedList() {
+        delete[] mass;
+        delete[] bits;
+    }
+
+ private:
+    size_t numWords() const {
+        return ((size_t) numelements + 63) / 64;
+    }
 };
 ///////////////////////////////////////////////////////////
 //
@@ -35,27 +100,94 @@ class VisitedList {
 //
 /////////////////////////////////////////////////////////
 
+/*
+* Each thread keeps the lists it released in a small cache of its own, so that the searches of a thread usually
+* reuse its list without taking the lock of the pool. The lists are owned by the pool that created them, and the
+* cache only refers to them with the unique id of the pool, so that the entries of a destroyed or resized pool are
+* never used. When a thread exits or evicts a list from its cache, the list goes back to its pool if the pool still
+* exists, so that short-lived threads such as those of a parallel insertion leave their lists for the next ones.
+*/
 class VisitedListPool {
-    std::deque<VisitedList *> pool;
+    static const size_t THREAD_CACHE_SIZE = 4;
+
+    struct ThreadCache {
+        uint64_t pool_ids[THREAD_CACHE_SIZE] = {};
+        VisitedList *lists[THREAD_CACHE_SIZE] = {};
+        uint64_t last_used[THREAD_CACHE_SIZE] = {};
+        uint64_t n_uses = 0;
+
+        ~ThreadCache() {
+            for (size_t i = 0; i < THREAD_CACHE_SIZE; i++) {
+                if (lists[i] != nullptr) returnToPool(pool_ids[i], lists[i]);
+            }
+        }
+    };
+
+    std::deque<VisitedList *> pool;  // the lists not used by any thread nor cached by any thread
+    std::vector<std::unique_ptr<VisitedList>> lists_;  // all the lists created by the pool
     std::mutex poolguard;
     int numelements;
+    uint64_t id_;
+
+    static uint64_t nextPoolId() {
+        static std::atomic<uint64_t> next_id{1};
+        return next_id++;
+    }
+
+    static ThreadCache &threadCache() {
+        static thread_local ThreadCache cache;
+        return cache;
+    }
+
+    // The live pools by id, which the threads look up to return their cached lists.
+    static std::mutex &registryLock() {
+        static std::mutex lock;
+        return lock;
+    }
+
+    static std::unordered_map<uint64_t, VisitedListPool *> &registry() {
+        static std::unordered_map<uint64_t, VisitedListPool *> pools;
+        return pools;
+    }
+
+    static void returnToPool(uint64_t pool_id, VisitedList *vl) {
+        std::unique_lock <std::mutex> registry_lock(registryLock());
+        auto found = registry().find(pool_id);
+        if (found == registry().end()) return;  // the list has been freed with its pool
+        VisitedListPool *owner = found->second;
+        std::unique_lock <std::mutex> lock(owner->poolguard);
+        owner->pool.push_front(vl);
+    }
 
  public:
-    VisitedListPool(int initmaxpools, int numelements1) {
+    VisitedListPool(int initmaxpools, int numelements1) : id_(nextPoolId()) {
         numelements = numelements1;
-        for (int i = 0; i < initmaxpools; i++)
-            pool.push_front(new VisitedList(numelements));
+        for (int i = 0; i < initmaxpools; i++) {
+            lists_.emplace_back(new VisitedList(numelements));
+            pool.push_front(lists_.back().get());
+        }
+        std::unique_lock <std::mutex> registry_lock(registryLock());
+        registry()[id_] = this;
     }
 
     VisitedList *getFreeVisitedList() {
-        VisitedList *rez;
-        {
+        VisitedList *rez = nullptr;
+        ThreadCache &cache = threadCache();
+        for (size_t i = 0; i < THREAD_CACHE_SIZE; i++) {
+            if (cache.lists[i] != nullptr && cache.pool_ids[i] == id_) {
+                rez = cache.lists[i];
+                cache.lists[i] = nullptr;
+                break;
+            }
+        }
+        if (rez == nullptr) {
             std::unique_lock <std::mutex> lock(poolguard);
             if (pool.size() > 0) {
                 rez = pool.front();
                 pool.pop_front();
             } else {
-                rez = new VisitedList(numelements);
+                lists_.emplace_back(new VisitedList(numelements));
+                rez = lists_.back().get();
             }
         }
         rez->reset();
@@ -63,16 +195,54 @@ class VisitedListPool {
     }
 
     void releaseVisitedList(VisitedList *vl) {
-        std::unique_lock <std::mutex> lock(poolguard);
-        pool.push_front(vl);
+        ThreadCache &cache = threadCache();
+        // Takes an empty slot, or evicts the least recently used list of another pool. If the other slots
+        // hold the lists of this pool, which happens only with nested searches, the list goes back to the pool.
+        size_t slot = THREAD_CACHE_SIZE;
+        for (size_t i = 0; i < THREAD_CACHE_SIZE; i++) {
+            if (cache.lists[i] == nullptr) {
+                slot = i;
+                break;
+            }
+            if (cache.pool_ids[i] != id_ && (slot == THREAD_CACHE_SIZE || cache.last_used[i] < cache.last_used[slot]))
+                slot = i;
+        }
+        if (slot == THREAD_CACHE_SIZE) {
+            std::unique_lock <std::mutex> lock(poolguard);
+            pool.push_front(vl);
+            return;
+        }
+        if (cache.lists[slot] != nullptr) returnToPool(cache.pool_ids[slot], cache.lists[slot]);
+        cache.lists[slot] = vl;
+        cache.pool_ids[slot] = id_;
+        cache.last_used[slot] = ++cache.n_uses;
     }
 
     ~VisitedListPool() {
-        while (pool.size()) {
-            VisitedList *rez = pool.front();
-            pool.pop_front();
-            delete rez;
-        }
+        // After the pool is unregistered, no thread returns a list to it, and the lists are freed with lists_.
+        std::unique_lock <std::mutex> registry_lock(registryLock());
+        registry().erase(id_);
     }
 };
+
+// Takes a list from the pool and releases it when going out of scope, also if the search throws an exception.
+class VisitedListHandle {
+ public:
+    explicit VisitedListHandle(VisitedListPool *pool) : pool_(pool), list_(pool->getFreeVisitedList()) {}
+
+    ~VisitedListHandle() {
+        pool_->releaseVisitedList(list_);
+    }
+
+    VisitedListHandle(const VisitedListHandle &) = delete;
+    VisitedListHandle &operator=(const VisitedListHandle &) = delete;
+
+    VisitedList *get() const {
+        return list_;
+    }
+
+ private:
+    VisitedListPool *pool_;
+    VisitedList *list_;
+};
 }  // namespace hnswlib
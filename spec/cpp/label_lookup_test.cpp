@@ -0,0 +1,119 @@
+// Tests the label lookup table against std::unordered_map. Prints the failures and exits with 1.
+#include "hnswlib.h"
+#include "label_lookup.h"
+
+#include <cstdio>
+#include <random>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+typedef hnswlib::LabelLookupTable<unsigned int> Table;
+
+static int n_failures = 0;
+
+static void check(bool cond, const char *message) {
+  if (cond) return;
+  if (n_failures < 10) fprintf(stderr, "failed: %s\n", message);  // the checks in loops would flood the output
+  n_failures++;
+}
+
+// Checks that the table holds exactly the labels of the reference, through find and forEach.
+static void check_same(Table &table, const std::unordered_map<hnswlib::labeltype, unsigned int> &expected, const char *message) {
+  bool same = table.size() == expected.size();
+  for (const auto &entry : expected) {
+    unsigned int id;
+    same = same && table.find(entry.first, id) && id == entry.second;
+  }
+  size_t n_visited = 0;
+  table.forEach([&](hnswlib::labeltype label, unsigned int &id) {
+    auto found = expected.find(label);
+    same = same && found != expected.end() && found->second == id;
+    n_visited++;
+  });
+  check(same && n_visited == expected.size(), message);
+}
+
+// The label with all bits set marks the empty slots, so it is kept apart from the slots.
+static void test_max_label() {
+  Table table;
+  const hnswlib::labeltype max_label = ~((hnswlib::labeltype) 0);
+  unsigned int id = 0;
+  check(!table.find(max_label, id), "max label is not found in an empty table");
+  table.insert(max_label, 7);
+  table.insert(0, 8);
+  check(table.find(max_label, id) && id == 7, "max label is found");
+  check(table.find(0, id) && id == 8, "label 0 is found next to max label");
+  check(table.size() == 2, "max label is counted");
+  table.insert(max_label, 9);
+  check(table.find(max_label, id) && id == 9 && table.size() == 2, "max label is reassigned");
+  check(table.erase(max_label) && !table.find(max_label, id), "max label is erased");
+  check(!table.erase(max_label) && table.size() == 1, "max label is erased only once");
+}
+
+// Keeps 12 labels per shard on average, which fills many shards of 16 slots to three quarters, so that the clusters
+// often wrap around the end of the slots, and the erasures shift back the entries across the end.
+static void test_churn() {
+  Table table;
+  std::unordered_map<hnswlib::labeltype, unsigned int> expected;
+  std::mt19937_64 rng(42);
+  std::vector<hnswlib::labeltype> labels;
+  for (unsigned int id = 0; id < 64 * 12; id++) {
+    const hnswlib::labeltype label = rng();
+    table.insert(label, id);
+    expected[label] = id;
+    labels.push_back(label);
+  }
+  check_same(table, expected, "inserted labels are found");
+  for (int n = 0; n < 100000; n++) {
+    const size_t i = rng() % labels.size();
+    check(table.erase(labels[i]), "stored label is erased");
+    expected.erase(labels[i]);
+    unsigned int id;
+    check(!table.find(labels[i], id), "erased label is not found");
+    labels[i] = rng() % 4 == 0 ? rng() % 1024 : rng();  // small labels as well as spread ones
+    if (expected.count(labels[i])) labels[i] = rng();
+    table.insert(labels[i], n);
+    expected[labels[i]] = n;
+  }
+  check_same(table, expected, "labels are found after many erasures");
+}
+
+static void test_save_and_load() {
+  Table table;
+  std::unordered_map<hnswlib::labeltype, unsigned int> expected;
+  for (unsigned int id = 0; id < 1000; id++) {
+    table.insert(id * 7919, id);
+    expected[id * 7919] = id;
+  }
+  table.insert(~((hnswlib::labeltype) 0), 1000);
+  expected[~((hnswlib::labeltype) 0)] = 1000;
+  std::stringstream stream;
+  table.save(stream);
+  const std::string saved = stream.str();
+
+  Table loaded;
+  std::stringstream input(saved);
+  check(loaded.load(input, saved.size(), 1001), "saved table is loaded");
+  check_same(loaded, expected, "loaded table has the saved labels");
+  loaded.insert(1, 1001);
+  check(loaded.erase(7919) && loaded.size() == 1001, "loaded table is updatable");
+
+  std::stringstream large_ids(saved);
+  check(!loaded.load(large_ids, saved.size(), 1000) && loaded.size() == 0, "ids out of range are rejected");
+  std::stringstream truncated(saved.substr(0, saved.size() - 1));
+  check(!loaded.load(truncated, saved.size() - 1, 1001) && loaded.size() == 0, "truncated table is rejected");
+  std::string bad_capacity = saved;
+  bad_capacity[sizeof(size_t)] = 3;  // the capacity of the first shard
+  std::stringstream bad_capacity_input(bad_capacity);
+  check(!loaded.load(bad_capacity_input, bad_capacity.size(), 1001), "capacity not a power of two is rejected");
+}
+
+int main() {
+  test_max_label();
+  test_churn();
+  test_save_and_load();
+  if (n_failures > 0) return 1;
+  printf("ok\n");
+  return 0;
+}
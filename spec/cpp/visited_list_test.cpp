@@ -0,0 +1,116 @@
+// Tests the visited lists with the bitmap threshold lowered by HNSWLIB_VISITED_BITMAP_MIN_ELEMENTS,
+// so that the bitmap used for large indexes is exercised with small ones. Prints the failures and exits with 1.
+#include "hnswlib.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+static int n_failures = 0;
+
+static void check(bool cond, const char *message) {
+  if (cond) return;
+  fprintf(stderr, "failed: %s\n", message);
+  n_failures++;
+}
+
+// Compares testAndSet with flags over sparse and dense rounds, which reset by clearing the touched words
+// and by clearing the whole bitmap respectively.
+static void test_visited_list(int n_elements) {
+  hnswlib::VisitedList vl(n_elements);
+  std::mt19937 rng(42);
+  std::vector<unsigned int> marked;
+  for (int round = 0; round < 300; round++) {
+    vl.reset();
+    // The elements marked in the previous round are unvisited after reset.
+    for (const unsigned int id : marked) {
+      if (vl.testAndSet(id)) {
+        check(false, "reset clears the marks of the previous round");
+        return;
+      }
+    }
+    vl.reset();
+    marked.clear();
+    std::vector<char> visited(n_elements, 0);
+    const int n_marks = round % 3 == 0 ? n_elements * 2 : 10;
+    for (int i = 0; i < n_marks; i++) {
+      const unsigned int id = rng() % n_elements;
+      if (vl.testAndSet(id) != (visited[id] != 0)) {
+        check(false, "testAndSet returns whether the element has been visited");
+        return;
+      }
+      if (!visited[id]) marked.push_back(id);
+      visited[id] = 1;
+    }
+  }
+  vl.reset();
+  for (int id = 0; id < n_elements; id++) check(!vl.testAndSet(id), "reset clears all the marks");
+}
+
+static void test_pool() {
+  hnswlib::VisitedListPool pool(1, 1000);
+  // The list cached by an exited thread goes back to the pool.
+  hnswlib::VisitedList *used = nullptr;
+  std::thread thread([&] {
+    used = pool.getFreeVisitedList();
+    pool.releaseVisitedList(used);
+  });
+  thread.join();
+  hnswlib::VisitedList *reused = pool.getFreeVisitedList();
+  check(reused == used, "the list of an exited thread is reused");
+  check(!reused->testAndSet(0), "the reused list is reset");
+  pool.releaseVisitedList(reused);
+
+  // The cached lists of a destroyed pool are never handed out by another pool.
+  for (int i = 0; i < 8; i++) {
+    hnswlib::VisitedListPool other(1, 100 + i);
+    hnswlib::VisitedList *vl = other.getFreeVisitedList();
+    check(vl->numelements == (unsigned int)(100 + i), "a pool hands out its own lists");
+    other.releaseVisitedList(vl);
+  }
+}
+
+// Searches an index whose visited lists are bitmaps, and checks that the results match the exact neighbors.
+static void test_search() {
+  const size_t dim = 4;
+  const size_t n_elements = 500;
+  hnswlib::L2Space space(dim);
+  hnswlib::HierarchicalNSW<float> index(&space, n_elements, 8, 100);
+  index.setEf(n_elements);
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> uniform;
+  std::vector<float> data(n_elements * dim);
+  for (float &v : data) v = uniform(rng);
+  for (size_t i = 0; i < n_elements; i++) index.addPoint(data.data() + i * dim, i);
+
+  size_t n_found = 0;
+  const size_t n_queries = 20, k = 10;
+  for (size_t q = 0; q < n_queries; q++) {
+    std::vector<float> query(dim);
+    for (float &v : query) v = uniform(rng);
+    std::vector<std::pair<float, size_t>> exact;
+    for (size_t i = 0; i < n_elements; i++) {
+      exact.emplace_back(space.get_dist_func()(query.data(), data.data() + i * dim, space.get_dist_func_param()), i);
+    }
+    std::sort(exact.begin(), exact.end());
+    std::set<size_t> expected;
+    for (size_t i = 0; i < k; i++) expected.insert(exact[i].second);
+    auto result = index.searchKnn(query.data(), k);
+    for (; !result.empty(); result.pop()) n_found += expected.count(result.top().second);
+  }
+  check(n_found >= n_queries * k * 99 / 100, "the search finds the exact neighbors");
+}
+
+int main() {
+  check(hnswlib::VisitedList::BITMAP_MIN_ELEMENTS < 1000, "the bitmap threshold is lowered");
+  test_visited_list(50);
+  test_visited_list(1 << 16);
+  test_pool();
+  test_search();
+  if (n_failures > 0) return 1;
+  printf("ok\n");
+  return 0;
+}
@@ -13,9 +13,22 @@ RSpec.describe Hnswlib::BruteforceSearch do
       expect(index.add_point([1, 2, 3], 0)).to be(true)
     end
 
+    it 'adds new point given as packed float32 string', :aggregate_failures do
+      expect(index.add_point([1, 2, 3].pack('f*'), 0)).to be(true)
+      expect(index.search_knn([1, 2, 3].pack('f*'), 1)).to match([[0], [0.0]])
+    end
+
     context 'when given non-array object to 1st argument' do
       it 'raises ArgumentError' do
-        expect { index.add_point('[1, 2, 3]', 0) }.to raise_error(ArgumentError, /Expect point vector to be Ruby Array/)
+        expect { index.add_point({ a: 1 }, 0) }.to raise_error(ArgumentError, /Expect point vector to be Ruby Array/)
+      end
+    end
+
+    context 'when given packed string with mis-matched sizes to 1st argument' do
+      it 'raises ArgumentError' do
+        expect do
+          index.add_point('[1, 2, 3]', 0)
+        end.to raise_error(ArgumentError, /Buffer size does not match to index dimensionality/)
       end
     end
 
@@ -86,6 +99,30 @@ RSpec.describe Hnswlib::BruteforceSearch do
           expect(index.search_knn([1, 2, 3], 4, filter: filter)[0]).to match([1, 3])
         end
       end
+
+      context 'when given label filter' do
+        let(:filter) { Hnswlib::LabelFilter.new([1, 3]) }
+
+        it 'returns filtered serch results' do
+          expect(index.search_knn([1, 2, 3], 4, filter: filter)[0]).to match([1, 3])
+        end
+      end
+
+      context 'when given label filter with deny option' do
+        let(:filter) { Hnswlib::LabelFilter.new([1, 3], deny: true) }
+
+        it 'returns filtered serch results' do
+          expect(index.search_knn([1, 2, 3], 4, filter: filter)[0]).to match([0, 2])
+        end
+      end
+
+      context 'when the index is changed during the search' do
+        let(:filter) { proc { index.init_index(max_elements: 10) } }
+
+        it 'raises RuntimeError' do
+          expect { index.search_knn([1, 2, 3], 4, filter: filter) }.to raise_error(RuntimeError, /another thread/)
+        end
+      end
     end
 
     context "when space is 'ip'" do
@@ -103,6 +140,7 @@ RSpec.describe Hnswlib::BruteforceSearch do
       let(:result) { index.search_knn([1, 2, 2.5], 2) }
 
       it 'searches nearest neighbors based on cosine distance', :aggregate_failures do
+        expect(index.search_knn([1, 2, 2.5].pack('f*'), 2)[0]).to match([0, 2])
         expect(result[0]).to match([0, 2])
         expect(result[1]).to be_within(1e-6).of([0.00397616, 0.0238129])
       end
@@ -0,0 +1,30 @@
+# frozen_string_literal: true
+
+RSpec.describe Hnswlib::CosineSpace do
+  let(:dim) { 3 }
+  let(:space) { described_class.new(dim) }
+
+  describe '#distance' do
+    it 'calculates one minus cosine similarity between two arrays', :aggregate_failures do
+      expect(space.distance([1, 2, 3], [4, 5, 6])).to be_within(1e-6).of(0.0253681)
+      expect(space.distance([1, 2, 3], [2, 4, 6])).to be_within(1e-6).of(0)
+      expect(space.distance([1, 0, 0], [0, 1, 0])).to be_within(1e-6).of(1)
+    end
+
+    it 'does not return NaN for a zero vector' do
+      expect(space.distance([0, 0, 0], [1, 2, 3])).to be_within(1e-6).of(1)
+    end
+
+    context 'when given an array with a length different from the number of dimensions' do
+      it 'raises ArgumentError' do
+        expect { space.distance([1, 2, 3, 4], [3, 4, 5]) }.to raise_error(ArgumentError, /Array size does not match to space dimensionality/)
+      end
+    end
+  end
+
+  describe '#dim' do
+    it 'returns the number of dimensions' do
+      expect(space.dim).to eq(dim)
+    end
+  end
+end
@@ -0,0 +1,58 @@
+# frozen_string_literal: true
+
+[Hnswlib::L2SpaceFp16, Hnswlib::L2SpaceBf16].each do |klass|
+  RSpec.describe klass do
+    let(:dim) { 3 }
+    let(:space) { described_class.new(dim) }
+
+    describe '#initialize' do
+      context 'when given a non-integer number of dimensions' do
+        it 'raises TypeError and leaves the object to be freed by GC', :aggregate_failures do
+          expect { described_class.new('x') }.to raise_error(TypeError)
+          expect { GC.start }.not_to raise_error
+        end
+      end
+    end
+
+    describe '#distance' do
+      it 'calculates squared Euclidean distance between two arrays', :aggregate_failures do
+        expect(space.distance([1, 2, 3], [3, 4, 5])).to be_within(1e-6).of(12)
+        expect(space.distance([0.1, 0.2, 0.3], [0.3, 0.4, 0.5])).to be_within(1e-2).of(0.12)
+      end
+
+      context 'when given an array with a length different from the number of dimensions' do
+        it 'raises ArgumentError' do
+          expect do
+            space.distance([1, 2, 3, 4], [3, 4, 5])
+          end.to raise_error(ArgumentError, /Array size does not match to space dimensionality/)
+        end
+      end
+
+      context 'when given a non-array argument' do
+        it 'raises ArgumentError' do
+          expect { space.distance(nil, [3, 4, 5]) }.to raise_error(ArgumentError, /Expect input vector to be Ruby Array/)
+        end
+      end
+    end
+
+    describe '#dim' do
+      it 'returns the number of dimensions' do
+        expect(space.dim).to eq(dim)
+      end
+    end
+  end
+end
+
+[Hnswlib::InnerProductSpaceFp16, Hnswlib::InnerProductSpaceBf16].each do |klass|
+  RSpec.describe klass do
+    let(:dim) { 3 }
+    let(:space) { described_class.new(dim) }
+
+    describe '#distance' do
+      it 'calculates 1 subtract inner product between two arrays', :aggregate_failures do
+        expect(space.distance([1, 2, 3], [3, 4, 5])).to be_within(1e-6).of(-25)
+        expect(space.distance([0.1, 0.2, 0.3], [0.3, 0.4, 0.5])).to be_within(1e-2).of(0.74)
+      end
+    end
+  end
+end
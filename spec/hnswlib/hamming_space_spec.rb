@@ -0,0 +1,31 @@
+# frozen_string_literal: true
+
+RSpec.describe Hnswlib::HammingSpace do
+  let(:dim) { 130 }
+  let(:space) { described_class.new(dim) }
+  let(:arr_a) { Array.new(dim) { |i| i % 3 == 0 ? 1 : 0 } }
+  let(:arr_b) { Array.new(dim) { |i| i.even? ? 1 : 0 } }
+
+  describe '#distance' do
+    it 'calculates the number of differing bits between two arrays', :aggregate_failures do
+      expect(space.distance(arr_a, arr_b)).to eq(arr_a.zip(arr_b).count { |a, b| a != b })
+      expect(space.distance(arr_a, arr_a)).to eq(0)
+    end
+
+    it 'regards the elements greater than zero as set bits' do
+      expect(space.distance(arr_a.map { |v| v.zero? ? -1 : 1 }, arr_a)).to eq(0)
+    end
+
+    context 'when given an array with a length different from the number of dimensions' do
+      it 'raises ArgumentError' do
+        expect { space.distance([1, 0], arr_b) }.to raise_error(ArgumentError, /Array size does not match to space dimensionality/)
+      end
+    end
+  end
+
+  describe '#dim' do
+    it 'returns the number of dimensions' do
+      expect(space.dim).to eq(dim)
+    end
+  end
+end
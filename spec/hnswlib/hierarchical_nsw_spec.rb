@@ -15,9 +15,22 @@ RSpec.describe Hnswlib::HierarchicalNSW do
       expect(index.add_point([1, 2, 3], 0)).to be(true)
     end
 
+    it 'adds new point given as packed float32 string', :aggregate_failures do
+      expect(index.add_point([1, 2, 3].pack('f*'), 0)).to be(true)
+      expect(index.search_knn([1, 2, 3].pack('f*'), 1)).to match([[0], [0.0]])
+    end
+
     context 'when given non-array object to 1st argument' do
       it 'raises ArgumentError' do
-        expect { index.add_point('[1, 2, 3]', 0) }.to raise_error(ArgumentError, /Expect point vector to be Ruby Array/)
+        expect { index.add_point({ a: 1 }, 0) }.to raise_error(ArgumentError, /Expect point vector to be Ruby Array/)
+      end
+    end
+
+    context 'when given packed string with mis-matched sizes to 1st argument' do
+      it 'raises ArgumentError' do
+        expect do
+          index.add_point('[1, 2, 3]', 0)
+        end.to raise_error(ArgumentError, /Buffer size does not match to index dimensionality/)
       end
     end
 
@@ -53,6 +66,73 @@ RSpec.describe Hnswlib::HierarchicalNSW do
     end
   end
 
+  describe '#add_items' do
+    let(:max_elements) { 100 }
+    let(:mat) { Array.new(max_elements) { |n| [n, n + 1, n + 2] } }
+    let(:labels) { Array.new(max_elements) { |n| n } }
+
+    it 'adds new points', :aggregate_failures do
+      expect(index.add_items(mat, labels, num_threads: 2)).to be(true)
+      expect(index.current_count).to eq(max_elements)
+      expect(index.get_point(42)).to match([42, 43, 44])
+      expect(index.search_knn([42, 43, 44], 1)).to match([[42], [0.0]])
+    end
+
+    it 'adds new points given as packed float32 string', :aggregate_failures do
+      expect(index.add_items(mat.flatten.pack('f*'), labels)).to be(true)
+      expect(index.get_point(42)).to match([42, 43, 44])
+    end
+
+    context 'when given labels with a length different from the number of items' do
+      it 'raises ArgumentError' do
+        expect do
+          index.add_items(mat, labels[1..])
+        end.to raise_error(ArgumentError, /The number of items does not match to the number of labels/)
+      end
+    end
+
+    context 'when given array with mis-matched sizes to 1st argument' do
+      it 'raises ArgumentError' do
+        expect do
+          index.add_items([[1] * (dim + 1)], [0])
+        end.to raise_error(ArgumentError, /Array size does not match to index dimensionality/)
+      end
+    end
+
+    context 'when the number of items exceeds the limit' do
+      it 'raises RuntimeError' do
+        expect do
+          index.add_items(mat + [[1, 2, 3]], labels + [max_elements])
+        end.to raise_error(RuntimeError, /The number of elements exceeds the specified limit/)
+      end
+    end
+
+    context 'when the thread adding items is interrupted' do
+      let(:max_elements) { 2000 }
+      let(:mat) { Array.new(max_elements * dim) { |n| (n * 7919 % 1000) / 10.0 }.pack('f*') }
+      let(:adding) do
+        # resize_index refuses to change the index while add_items runs without the GVL.
+        lambda do
+          index.resize_index(max_elements)
+          false
+        rescue RuntimeError
+          true
+        end
+      end
+
+      it 'leaves the index changeable' do
+        items = mat
+        ids = labels
+        thread = Thread.new { index.add_items(items, ids) }
+        thread.report_on_exception = false
+        Thread.pass until adding.call || !thread.alive?
+        thread.raise(Interrupt)
+        expect { thread.join }.to raise_error(Interrupt)
+        expect { index.resize_index(max_elements + 1) }.not_to raise_error
+      end
+    end
+  end
+
   describe '#get_point' do
     before do
       index.add_point([1, 2, 3], 0)
@@ -63,6 +143,15 @@ RSpec.describe Hnswlib::HierarchicalNSW do
       expect(index.get_point(0)).to match([1, 2, 3])
     end
 
+    context "when space is 'l2_fp16'" do
+      let(:space) { 'l2_fp16' }
+
+      it 'returns specified point converted from half precision' do
+        index.add_point([0.1, 0.2, 0.3], 2)
+        expect(index.get_point(2)).to match([be_within(1e-4).of(0.1), be_within(1e-4).of(0.2), be_within(1e-4).of(0.3)])
+      end
+    end
+
     context 'when specifying non-existent label' do
       it 'raises RuntimeError' do
         expect { index.get_point(2) }.to raise_error(RuntimeError, /Label not found/)
@@ -80,6 +169,21 @@ RSpec.describe Hnswlib::HierarchicalNSW do
       expect(index.get_ids).to contain_exactly(0, 2)
     end
 
+    context 'when given the largest label' do
+      let(:max_label) { (2**64) - 1 }
+
+      it 'stores the label apart from the other labels', :aggregate_failures do
+        index.add_point([3, 4, 5], max_label)
+        expect(index.get_ids).to contain_exactly(0, 2, max_label)
+        expect(index.get_point(max_label)).to match([3, 4, 5])
+        expect(index.search_knn([3, 4, 5], 1)).to match([[max_label], [0.0]])
+        index.mark_deleted(max_label)
+        expect(index.search_knn([3, 4, 5], 1).first).to match([2])
+        index.unmark_deleted(max_label)
+        expect(index.search_knn([3, 4, 5], 1).first).to match([max_label])
+      end
+    end
+
     context 'when index is empty' do
       let(:empty_index) { described_class.new(space: space, dim: dim) }
 
@@ -101,6 +205,13 @@ RSpec.describe Hnswlib::HierarchicalNSW do
       index.mark_deleted(0)
       expect(index.search_knn([1, 2, 3], 1).first).to match([1])
     end
+
+    it 'keeps the label of the deleted point', :aggregate_failures do
+      index.mark_deleted(0)
+      expect(index.get_ids).to contain_exactly(0, 1, 2)
+      expect { index.get_point(0) }.to raise_error(RuntimeError, /Label not found/)
+      expect { index.mark_deleted(0) }.to raise_error(RuntimeError)
+    end
   end
 
   describe '#unmark_deleted' do
@@ -114,6 +225,8 @@ RSpec.describe Hnswlib::HierarchicalNSW do
     it 'unmarks deleted stored point', :aggregate_failures do
       index.unmark_deleted(0)
       expect(index.search_knn([1, 2, 3], 1).first).to match([0])
+      expect(index.get_point(0)).to match([1, 2, 3])
+      expect(index.get_ids).to contain_exactly(0, 1, 2)
     end
   end
 
@@ -139,6 +252,66 @@ RSpec.describe Hnswlib::HierarchicalNSW do
     end
   end
 
+  describe '#set_read_only' do
+    before do
+      index.add_point([1, 2, 5], 0)
+      index.add_point([1, 2, 4], 1)
+      index.add_point([1, 2, 3], 2)
+      index.set_read_only(true)
+    end
+
+    it 'rejects modifications and keeps reads available', :aggregate_failures do
+      expect(index.read_only?).to be(true)
+      expect(index.search_knn([1, 2, 3], 2)).to match([[2, 1], [0.0, 1.0]])
+      expect(index.get_point(1)).to match([1, 2, 4])
+      expect { index.add_point([1, 2, 2], 3) }.to raise_error(RuntimeError, 'The index is read-only')
+      expect { index.add_items([[1, 2, 2]], [3]) }.to raise_error(RuntimeError, 'The index is read-only')
+      expect { index.mark_deleted(0) }.to raise_error(RuntimeError, 'The index is read-only')
+      expect { index.resize_index(max_elements + 1) }.to raise_error(RuntimeError, 'The index is read-only')
+      expect { index.reorder! }.to raise_error(RuntimeError, 'The index is read-only')
+      expect(index.current_count).to eq(3)
+    end
+
+    it 'allows modifications again when unset', :aggregate_failures do
+      index.set_read_only(false)
+      expect(index.read_only?).to be(false)
+      index.add_point([1, 2, 2], 3)
+      expect(index.search_knn([1, 2, 3], 3)).to match([[2, 1, 3], [0.0, 1.0, 1.0]])
+    end
+
+    it 'raises ArgumentError when given non-boolean value' do
+      expect { index.set_read_only(1) }.to raise_error(ArgumentError)
+    end
+  end
+
+  describe '#reorder!' do
+    let(:filename) { File.expand_path("#{__dir__}/bruteforce.ann") }
+    let(:loaded_index) { described_class.new(space: space, dim: dim) }
+
+    before do
+      index.add_point([1, 2, 3], 0)
+      index.add_point([1, 1, 3], 1)
+      index.add_point([2, 2, 4], 2)
+      index.mark_deleted(1)
+      index.reorder!
+    end
+
+    it 'keeps items, deletion marks, and search results', :aggregate_failures do
+      expect(index.get_ids).to contain_exactly(0, 1, 2)
+      expect(index.get_point(2)).to match([2, 2, 4])
+      expect(index.search_knn([1, 1, 3], 2)).to match([[0, 2], [1.0, 3.0]])
+      index.unmark_deleted(1)
+      index.add_point([2, 2, 1], 3)
+      expect(index.search_knn([1, 1, 3], 4)[0]).to match([1, 0, 2, 3])
+    end
+
+    it 'saves and loads index in the new order' do
+      index.save_index(filename)
+      loaded_index.load_index(filename)
+      expect(loaded_index.search_knn([1, 1, 3], 2)).to match([[0, 2], [1.0, 3.0]])
+    end
+  end
+
   describe '#search_knn' do
     before do
       index.add_point([1, 2, 3], 0)
@@ -161,6 +334,66 @@ RSpec.describe Hnswlib::HierarchicalNSW do
           expect(index.search_knn([1, 2, 3], 4, filter: filter)[0]).to match([1, 3])
         end
       end
+
+      context 'when given label filter' do
+        let(:filter) { Hnswlib::LabelFilter.new([1, 3]) }
+
+        it 'returns filtered serch results' do
+          expect(index.search_knn([1, 2, 3], 4, filter: filter)[0]).to match([1, 3])
+        end
+      end
+
+      context 'when given label filter with deny option' do
+        let(:filter) { Hnswlib::LabelFilter.new([1, 3], deny: true) }
+
+        it 'returns filtered serch results' do
+          expect(index.search_knn([1, 2, 3], 4, filter: filter)[0]).to match([0, 2])
+        end
+      end
+
+      context 'when given packed option' do
+        let(:result) { index.search_knn([1, 2, 2.5], 2, packed: true) }
+
+        it 'returns packed search results', :aggregate_failures do
+          expect(result[0].unpack('Q*')).to match([0, 1])
+          expect(result[1].unpack('f*')).to match([0.25, 1.25])
+        end
+      end
+
+      context 'when given output buffers' do
+        let(:out) { [+'', +''] }
+
+        it 'fills the given buffers with packed search results', :aggregate_failures do
+          expect(index.search_knn([1, 2, 2.5], 2, out: out)).to match(out)
+          expect(out[0].unpack('Q*')).to match([0, 1])
+          expect(out[1].unpack('f*')).to match([0.25, 1.25])
+        end
+      end
+
+      context 'when called from multiple threads' do
+        let(:results) { Array.new(4) { Thread.new { index.search_knn([1, 2, 2.5], 2) } }.map(&:value) }
+
+        it 'returns the same search results in each thread' do
+          expect(results).to all(match([[0, 1], [0.25, 1.25]]))
+        end
+      end
+
+      context 'when the filter function raises an error' do
+        let(:filter) { proc { raise ArgumentError, 'filter error' } }
+
+        it 'raises the error and leaves the index changeable', :aggregate_failures do
+          expect { index.search_knn([1, 2, 3], 4, filter: filter) }.to raise_error(ArgumentError, 'filter error')
+          expect { index.resize_index(100) }.not_to raise_error
+        end
+      end
+
+      context 'when the index is changed during the search' do
+        let(:filter) { proc { index.resize_index(100) } }
+
+        it 'raises RuntimeError' do
+          expect { index.search_knn([1, 2, 3], 4, filter: filter) }.to raise_error(RuntimeError, /another thread/)
+        end
+      end
     end
 
     context "when space is 'ip'" do
@@ -178,10 +411,76 @@ RSpec.describe Hnswlib::HierarchicalNSW do
       let(:result) { index.search_knn([1, 2, 2.5], 2) }
 
       it 'searches nearest neighbors based on cosine distance', :aggregate_failures do
+        expect(index.search_knn([1, 2, 2.5].pack('f*'), 2)[0]).to match([0, 2])
         expect(result[0]).to match([0, 2])
         expect(result[1]).to be_within(1e-6).of([0.00397616, 0.026271])
       end
     end
+
+    context "when space is 'l2_fp16'" do
+      let(:space) { 'l2_fp16' }
+
+      it 'searches nearest neighbors on vectors stored in half precision', :aggregate_failures do
+        expect(index.space).to be_a(Hnswlib::L2SpaceFp16)
+        expect(index.search_knn([1, 2, 2.5], 2)).to match([[0, 1], [0.25, 1.25]])
+        expect(index.search_knn_batch([[1, 2, 2.5]], 2)[0].unpack('Q*')).to match([0, 1])
+      end
+    end
+
+    context "when space is 'cosine_bf16'" do
+      let(:space) { 'cosine_bf16' }
+      let(:result) { index.search_knn([1, 2, 2.5], 2) }
+
+      it 'searches nearest neighbors on vectors stored in bfloat16', :aggregate_failures do
+        expect(index.space).to be_a(Hnswlib::CosineSpaceBf16)
+        expect(result[0]).to match([0, 2])
+        expect(result[1]).to be_within(1e-2).of([0.00397616, 0.026271])
+      end
+    end
+
+    context "when space is 'hamming'" do
+      let(:space) { 'hamming' }
+
+      it 'searches nearest neighbors based on the number of differing bits', :aggregate_failures do
+        expect(index.space).to be_a(Hnswlib::HammingSpace)
+        expect(index.search_knn([1, -1, 1], 4)[1]).to match([1.0, 1.0, 1.0, 1.0])
+        expect(index.search_knn([0, 0, 0], 1)[1]).to match([3.0])
+      end
+    end
+  end
+
+  describe '#search_knn_batch' do
+    let(:queries) { [[1, 2, 2.5], [2, 2, 3.5]] }
+    let(:result) { index.search_knn_batch(queries, 2, num_threads: 2) }
+
+    before do
+      index.add_point([1, 2, 3], 0)
+      index.add_point([1, 1, 3], 1)
+      index.add_point([2, 2, 4], 2)
+      index.add_point([2, 2, 1], 3)
+    end
+
+    it 'searches nearest neighbors of each query', :aggregate_failures do
+      expect(result[0].unpack('Q*')).to match([0, 1, 2, 0])
+      expect(result[1].unpack('f*')).to match([0.25, 1.25, 0.25, 1.25])
+    end
+
+    context 'when given packed float32 string' do
+      let(:result) { index.search_knn_batch(queries.flatten.pack('f*'), 2) }
+
+      it 'searches nearest neighbors of each query', :aggregate_failures do
+        expect(result[0].unpack('Q*')).to match([0, 1, 2, 0])
+        expect(result[1].unpack('f*')).to match([0.25, 1.25, 0.25, 1.25])
+      end
+    end
+
+    context 'when the number of neighbors exceeds the number of elements' do
+      it 'raises RuntimeError' do
+        expect do
+          index.search_knn_batch(queries, 5)
+        end.to raise_error(RuntimeError, /Cannot return the results in a contiguous 2D array/)
+      end
+    end
   end
 
   describe '#init_index' do
@@ -216,6 +515,223 @@ RSpec.describe Hnswlib::HierarchicalNSW do
       expect(loaded_index.current_count).to eq(3)
       expect(loaded_index.search_knn([1, 2, 3], 2)).to match([[2, 1], [0.0, 1.0]])
     end
+
+    context 'when label_index is true' do
+      let(:labels_filename) { "#{filename}.labels" }
+
+      before { index.mark_deleted(2) }
+
+      after { File.delete(labels_filename) if File.exist?(labels_filename) }
+
+      it 'restores labels and deleted items from the separate file', :aggregate_failures do
+        index.save_index(filename)
+        index_size = File.size(filename)
+        index.save_index(filename, label_index: true)
+        expect(File.size(filename)).to eq(index_size)
+        loaded_index.load_index(filename, allow_replace_deleted: true, label_index: true)
+        expect(loaded_index.get_ids).to contain_exactly(0, 1, 2)
+        expect(loaded_index.search_knn([1, 2, 3], 2)).to match([[1, 0], [1.0, 4.0]])
+        expect(loaded_index.get_point(0)).to match([1, 2, 5])
+        loaded_index.add_point([1, 2, 2], 3, replace_deleted: true)
+        expect(loaded_index.current_count).to eq(3)
+        expect(loaded_index.search_knn([1, 2, 2], 1)).to match([[3], [0.0]])
+      end
+
+      it 'raises RuntimeError when the label index is corrupted' do
+        index.save_index(filename, label_index: true)
+        # The header of magic number, fingerprint of the index file, number of items, and number of deleted items
+        # is followed by the deleted ID.
+        File.binwrite(labels_filename, [99].pack('L'), 48)
+        expect { loaded_index.load_index(filename, label_index: true) }.to raise_error(RuntimeError, /corrupted/)
+      end
+
+      it 'removes the label index when the index is saved without it', :aggregate_failures do
+        index.save_index(filename, label_index: true)
+        index.reorder!
+        index.mark_deleted(1)
+        index.save_index(filename)
+        expect(File.exist?(labels_filename)).to be(false)
+        loaded_index.load_index(filename, label_index: true)
+        expect(loaded_index.get_point(0)).to match([1, 2, 5])
+        expect { loaded_index.get_point(1) }.to raise_error(RuntimeError, /Label not found/)
+        expect(loaded_index.search_knn([1, 2, 4], 1)).to match([[0], [1.0]])
+      end
+
+      it 'reads the labels from the index when the label index was saved with another index', :aggregate_failures do
+        index.save_index(filename, label_index: true)
+        stale_labels = File.binread(labels_filename)
+        index.unmark_deleted(2)
+        index.add_point([1, 2, 2], 3)
+        index.save_index(filename)
+        File.binwrite(labels_filename, stale_labels)
+        loaded_index.load_index(filename, label_index: true)
+        expect(loaded_index.get_ids).to contain_exactly(0, 1, 2, 3)
+        expect(loaded_index.search_knn([1, 2, 3], 1)).to match([[2], [0.0]])
+      end
+    end
+
+    context 'when split_layout is true' do
+      before do
+        index.init_index(max_elements: max_elements, split_layout: true)
+        index.add_point([1, 2, 5], 0)
+        index.add_point([1, 2, 4], 1)
+        index.add_point([1, 2, 3], 2)
+      end
+
+      it 'saves and loads index in the same format as the interleaved layout', :aggregate_failures do
+        expect(index.search_knn([1, 2, 3], 2)).to match([[2, 1], [0.0, 1.0]])
+        index.save_index(filename)
+        loaded_index.load_index(filename)
+        expect(loaded_index.search_knn([1, 2, 3], 2)).to match([[2, 1], [0.0, 1.0]])
+        loaded_index.load_index(filename, split_layout: true)
+        loaded_index.resize_index(max_elements + 1)
+        loaded_index.add_point([1, 2, 2], 3)
+        expect(loaded_index.get_point(1)).to match([1, 2, 4])
+        expect(loaded_index.search_knn([1, 2, 3], 3)).to match([[2, 1, 3], [0.0, 1.0, 1.0]])
+      end
+    end
+
+    context 'when huge_pages is true' do
+      before do
+        index.init_index(max_elements: max_elements, huge_pages: true)
+        index.add_point([1, 2, 5], 0)
+        index.add_point([1, 2, 4], 1)
+        index.add_point([1, 2, 3], 2)
+      end
+
+      it 'saves, loads, and resizes index', :aggregate_failures do
+        expect(index.search_knn([1, 2, 3], 2)).to match([[2, 1], [0.0, 1.0]])
+        index.save_index(filename)
+        loaded_index.load_index(filename, huge_pages: true)
+        loaded_index.resize_index(max_elements + 1)
+        loaded_index.add_point([1, 2, 2], 3)
+        expect(loaded_index.get_point(1)).to match([1, 2, 4])
+        expect(loaded_index.search_knn([1, 2, 3], 3)).to match([[2, 1, 3], [0.0, 1.0, 1.0]])
+        loaded_index.load_index(filename, split_layout: true, huge_pages: true)
+        expect(loaded_index.search_knn([1, 2, 3], 2)).to match([[2, 1], [0.0, 1.0]])
+      end
+    end
+
+    context 'when mmap is true' do
+      it 'maps index and keeps it updatable', :aggregate_failures do
+        index.save_index(filename)
+        loaded_index.load_index(filename, mmap: true)
+        expect(loaded_index.search_knn([1, 2, 3], 2)).to match([[2, 1], [0.0, 1.0]])
+        loaded_index.add_point([1, 2, 2], 3)
+        loaded_index.mark_deleted(0)
+        loaded_index.save_index(filename)
+        loaded_index.resize_index(max_elements + 1)
+        expect(loaded_index.search_knn([1, 2, 3], 3)).to match([[2, 1, 3], [0.0, 1.0, 1.0]])
+        index.load_index(filename, mmap: true)
+        expect(index.current_count).to eq(4)
+        expect(index.search_knn([1, 2, 3], 3)).to match([[2, 1, 3], [0.0, 1.0, 1.0]])
+      end
+
+      it 'raises ArgumentError when given with split_layout' do
+        index.save_index(filename)
+        expect { loaded_index.load_index(filename, mmap: true, split_layout: true) }.to raise_error(ArgumentError)
+      end
+    end
+  end
+
+  describe "'l2_sq8' space" do
+    let(:space) { 'l2_sq8' }
+    let(:items) { [[0, 0, 0], [1, 2, 5], [1, 2, 4], [1, 2, 3]] }
+    let(:filename) { File.expand_path("#{__dir__}/bruteforce.ann") }
+    let(:loaded_index) { described_class.new(space: space, dim: dim) }
+
+    it 'stores items quantized with the range of values learned by the space', :aggregate_failures do
+      expect { index.add_point([1, 2, 3], 0) }.to raise_error(RuntimeError, /has not been trained yet/)
+      expect { index.add_items(items, [0, 1, 2, 3]) }.to raise_error(RuntimeError, /has not been trained yet/)
+      index.space.train(items)
+      index.add_items(items, [0, 1, 2, 3])
+      expect(index.search_knn([1, 2, 3], 2)[0]).to match([3, 2])
+      expect(index.get_point(1)).to match([be_within(1e-2).of(1), be_within(1e-2).of(2), be_within(1e-2).of(5)])
+    end
+
+    it 'saves and loads the learned range with index', :aggregate_failures do
+      index.space.train(items)
+      index.add_items(items, [0, 1, 2, 3])
+      index.save_index(filename)
+      loaded_index.load_index(filename)
+      expect(loaded_index.space.trained?).to be(true)
+      expect(loaded_index.search_knn([1, 2, 3], 2)).to match(index.search_knn([1, 2, 3], 2))
+      expect do
+        described_class.new(space: 'l2', dim: dim).load_index(filename)
+      end.to raise_error(RuntimeError, /corrupted/)
+    end
+
+    context 'when re-ranking is enabled' do
+      before do
+        index.init_index(max_elements: max_elements, ef_construction: ef_construction, m: em, rerank: true)
+        index.space.train(items)
+        index.add_items(items, [0, 1, 2, 3])
+      end
+
+      it 'returns the exact distances of full precision vectors', :aggregate_failures do
+        labels, distances = index.search_knn([1, 2, 3.2], 2)
+        expect(labels).to match([3, 2])
+        expect(distances).to match([be_within(1e-5).of(0.04), be_within(1e-5).of(0.64)])
+      end
+
+      it 'saves and loads full precision vectors with index', :aggregate_failures do
+        index.save_index(filename)
+        [true, :mmap].each do |rerank|
+          loaded_index.load_index(filename, rerank: rerank)
+          expect(loaded_index.search_knn([1, 2, 3.2], 2)).to match(index.search_knn([1, 2, 3.2], 2))
+        end
+        expect { loaded_index.load_index(filename, rerank: 'yes') }.to raise_error(ArgumentError)
+      ensure
+        File.delete("#{filename}.rerank") if File.exist?("#{filename}.rerank")
+      end
+
+      it 'saves full precision vectors mapped from the file to the same file', :aggregate_failures do
+        index.save_index(filename)
+        loaded_index.load_index(filename, rerank: :mmap)
+        loaded_index.save_index(filename)
+        expect(File.exist?("#{filename}.rerank.tmp")).to be(false)
+        expect(loaded_index.search_knn([1, 2, 3.2], 2)).to match(index.search_knn([1, 2, 3.2], 2))
+        loaded_index.load_index(filename, rerank: :mmap)
+        expect(loaded_index.search_knn([1, 2, 3.2], 2)).to match(index.search_knn([1, 2, 3.2], 2))
+      ensure
+        File.delete("#{filename}.rerank") if File.exist?("#{filename}.rerank")
+      end
+
+      it 'raises ArgumentError for a space storing full precision vectors' do
+        expect { described_class.new(space: 'l2', dim: dim).init_index(max_elements: 1, rerank: true) }
+          .to raise_error(ArgumentError)
+      end
+    end
+  end
+
+  describe "'l2_pq' space" do
+    let(:space) { 'l2_pq3' }
+    let(:items) { [[0, 0, 0], [1, 2, 5], [1, 2, 4], [1, 2, 3]] }
+    let(:filename) { File.expand_path("#{__dir__}/bruteforce.ann") }
+
+    it 'stores items quantized with the centroids learned by the space', :aggregate_failures do
+      expect { index.add_items(items, [0, 1, 2, 3]) }.to raise_error(RuntimeError, /has not been trained yet/)
+      index.space.train(items)
+      index.add_items(items, [0, 1, 2, 3])
+      expect(index.space).to be_a(Hnswlib::L2SpacePQ)
+      expect(index.search_knn([1, 2, 3.2], 2)).to match([[3, 2], [be_within(1e-5).of(0.04), be_within(1e-5).of(0.64)]])
+      expect(index.get_point(1)).to match([1, 2, 5])
+    end
+
+    it 'saves and loads the centroids with index' do
+      index.space.train(items)
+      index.add_items(items, [0, 1, 2, 3])
+      index.save_index(filename)
+      loaded_index = described_class.new(space: space, dim: dim)
+      loaded_index.load_index(filename)
+      expect(loaded_index.search_knn([1, 2, 3.2], 2)).to match(index.search_knn([1, 2, 3.2], 2))
+    end
+
+    context 'when the number of dimensions is not divisible by the number of sub-vectors' do
+      it 'raises ArgumentError' do
+        expect { described_class.new(space: 'l2_pq2', dim: dim) }.to raise_error(ArgumentError)
+      end
+    end
   end
 
   describe '#max_elements' do
@@ -290,6 +806,21 @@ RSpec.describe Hnswlib::HierarchicalNSW do
         expect { index.add_point([1, 4, 2], 4, replace_deleted: true) }.not_to raise_error
         expect(index.get_point(4)).to match([1, 4, 2])
       end
+
+      it 'reuses the slots of deleted points for many new labels', :aggregate_failures do
+        labels = [1, 2, 3, 4]
+        index.add_point([1, 4, 2], 4, replace_deleted: true)
+        (5...200).each do |label|
+          replaced = labels.delete_at(label % labels.size)
+          index.mark_deleted(replaced)
+          index.add_point([1, label, 2], label, replace_deleted: true)
+          labels << label
+        end
+        expect(index.current_count).to eq(4)
+        expect(index.get_ids).to contain_exactly(*labels)
+        expect(labels.map { |label| index.get_point(label) }).to eq(labels.map { |label| [1, label, 2] })
+        expect { index.get_point(0) }.to raise_error(RuntimeError, /Label not found/)
+      end
     end
   end
 end
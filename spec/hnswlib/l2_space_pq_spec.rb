@@ -0,0 +1,65 @@
+# frozen_string_literal: true
+
+RSpec.describe Hnswlib::L2SpacePQ do
+  let(:dim) { 4 }
+  let(:n_subvectors) { 2 }
+  let(:space) { described_class.new(dim, n_subvectors) }
+
+  describe '#initialize' do
+    context 'when the number of dimensions is not divisible by the number of sub-vectors' do
+      it 'raises ArgumentError' do
+        expect { described_class.new(dim, 3) }.to raise_error(ArgumentError, /divisible/)
+      end
+    end
+  end
+
+  describe '#train' do
+    it 'learns the centroids of each sub-vector', :aggregate_failures do
+      expect(space.trained?).to be(false)
+      expect(space.train([[0, 0, 1, 1], [1, 1, 0, 0]])).to be(space)
+      expect(space.trained?).to be(true)
+    end
+
+    it 'accepts packed float32 string' do
+      space.train([0, 0, 1, 1, 1, 1, 0, 0].pack('f*'))
+      expect(space.trained?).to be(true)
+    end
+
+    context 'when given an array with a length different from the number of dimensions' do
+      it 'raises ArgumentError' do
+        expect { space.train([[1, 2]]) }.to raise_error(ArgumentError, /Array size does not match to space dimensionality/)
+      end
+    end
+
+    context 'when the space has already been trained' do
+      it 'raises RuntimeError and keeps the learned centroids', :aggregate_failures do
+        space.train([[0, 0, 1, 1], [1, 1, 0, 0]])
+        expect { space.train([[5, 5, 5, 5], [9, 9, 9, 9]]) }.to raise_error(RuntimeError, /already been trained/)
+        expect(space.distance([0, 0, 1, 1], [1, 1, 0, 0])).to be_within(1e-4).of(4)
+      end
+    end
+  end
+
+  describe '#distance' do
+    before { space.train(Array.new(512) { |n| [n % 2, n % 2, n % 3, n % 3] }) }
+
+    it 'calculates squared Euclidean distance between query and quantized array', :aggregate_failures do
+      expect(space.distance([0, 0, 0, 0], [1, 1, 2, 2])).to be_within(1e-4).of(10)
+      expect(space.distance([0.5, 0.5, 0, 0], [1, 1, 2, 2])).to be_within(1e-4).of(8.5)
+    end
+
+    context 'when the space has not been trained' do
+      it 'raises RuntimeError' do
+        expect { described_class.new(dim, n_subvectors).distance([1, 2, 3, 4], [3, 4, 5, 6]) }
+          .to raise_error(RuntimeError, /has not been trained/)
+      end
+    end
+  end
+
+  describe '#dim and #n_subvectors' do
+    it 'returns the number of dimensions and sub-vectors', :aggregate_failures do
+      expect(space.dim).to eq(dim)
+      expect(space.n_subvectors).to eq(n_subvectors)
+    end
+  end
+end
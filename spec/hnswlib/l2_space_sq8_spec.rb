@@ -0,0 +1,82 @@
+# frozen_string_literal: true
+
+RSpec.describe Hnswlib::L2SpaceSQ8 do
+  let(:dim) { 3 }
+  let(:space) { described_class.new(dim) }
+
+  describe '#initialize' do
+    context 'when given a non-integer number of dimensions' do
+      it 'raises TypeError and leaves the object to be freed by GC', :aggregate_failures do
+        expect { described_class.new('x') }.to raise_error(TypeError)
+        expect { described_class.new(dim: dim) }.to raise_error(TypeError)
+        expect { GC.start }.not_to raise_error
+      end
+    end
+  end
+
+  describe '#train' do
+    it 'learns the range of each dimension', :aggregate_failures do
+      expect(space.trained?).to be(false)
+      expect(space.train([[0, 0, 0], [1, 2, 3]])).to be(space)
+      expect(space.trained?).to be(true)
+    end
+
+    it 'accepts packed float32 string' do
+      space.train([0, 0, 0, 1, 2, 3].pack('f*'))
+      expect(space.trained?).to be(true)
+    end
+
+    context 'when given an array with a length different from the number of dimensions' do
+      it 'raises ArgumentError' do
+        expect { space.train([[1, 2]]) }.to raise_error(ArgumentError, /Array size does not match to space dimensionality/)
+      end
+    end
+
+    context 'when given fewer than two samples' do
+      it 'raises ArgumentError', :aggregate_failures do
+        expect { space.train([]) }.to raise_error(ArgumentError, /at least two vectors/)
+        expect { space.train([[1, 2, 3]]) }.to raise_error(ArgumentError, /at least two vectors/)
+        expect(space.trained?).to be(false)
+      end
+    end
+
+    context 'when given a non-numeric element' do
+      it 'raises TypeError and leaves the space untrained', :aggregate_failures do
+        expect { space.train([[0, 0, 0], [1, 'a', 3]]) }.to raise_error(TypeError)
+        expect(space.trained?).to be(false)
+        expect { space.train([[0, 0, 0], [1, 2, 3]]) }.not_to raise_error
+      end
+    end
+
+    context 'when the space has already been trained' do
+      it 'raises RuntimeError and keeps the learned range', :aggregate_failures do
+        space.train([[0, 0, 0], [3, 4, 5]])
+        expect { space.train([[0, 0, 0], [30, 40, 50]]) }.to raise_error(RuntimeError, /already been trained/)
+        expect(space.distance([0, 0, 0], [3, 4, 5])).to be_within(1e-4).of(50)
+      end
+    end
+  end
+
+  describe '#distance' do
+    before { space.train([[0, 0, 0], [3, 4, 5]]) }
+
+    it 'calculates squared Euclidean distance between quantized arrays', :aggregate_failures do
+      expect(space.distance([0, 0, 0], [3, 4, 5])).to be_within(1e-4).of(50)
+      expect(space.distance([1, 2, 3], [3, 4, 5])).to be_within(0.1).of(12)
+    end
+
+    context 'when the space has not been trained' do
+      it 'raises RuntimeError' do
+        expect do
+          described_class.new(dim).distance([1, 2, 3], [3, 4, 5])
+        end.to raise_error(RuntimeError, /has not been trained/)
+      end
+    end
+  end
+
+  describe '#dim' do
+    it 'returns the number of dimensions' do
+      expect(space.dim).to eq(dim)
+    end
+  end
+end
@@ -0,0 +1,47 @@
+# frozen_string_literal: true
+
+require 'set'
+
+RSpec.describe Hnswlib::LabelFilter do
+  let(:filter) { described_class.new([1, 3, 3, 5]) }
+
+  describe '#size' do
+    it 'returns the number of distinct labels' do
+      expect(filter.size).to eq(3)
+    end
+
+    context 'when given sparse labels' do
+      let(:filter) { described_class.new(Set[2, 1_000_000]) }
+
+      it 'returns the number of distinct labels' do
+        expect(filter.size).to eq(2)
+      end
+    end
+  end
+
+  describe '#deny?' do
+    it 'returns false by default' do
+      expect(filter.deny?).to be(false)
+    end
+
+    context 'when deny option is given' do
+      let(:filter) { described_class.new([1, 3, 5], deny: true) }
+
+      it 'returns true' do
+        expect(filter.deny?).to be(true)
+      end
+    end
+  end
+
+  context 'when given non-array object' do
+    it 'raises ArgumentError' do
+      expect { described_class.new(1) }.to raise_error(ArgumentError, /Expect labels to be Ruby Array or Set/)
+    end
+  end
+
+  context 'when given non-integer label' do
+    it 'raises ArgumentError' do
+      expect { described_class.new(['1']) }.to raise_error(ArgumentError, /Expect each label to be Ruby Integer/)
+    end
+  end
+end
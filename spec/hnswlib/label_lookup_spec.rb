@@ -0,0 +1,8 @@
+# frozen_string_literal: true
+
+# The label lookup table is internal to the extension, so it is tested by a native program built with the headers.
+RSpec.describe 'LabelLookupTable' do # rubocop:disable RSpec/DescribeClass
+  it 'finds labels after many erasures, keeps the largest label, and loads saved slots', :aggregate_failures do
+    run_native_test('label_lookup_test')
+  end
+end
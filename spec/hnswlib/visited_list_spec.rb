@@ -0,0 +1,8 @@
+# frozen_string_literal: true
+
+# The visited lists are internal to the extension, so they are tested by a native program built with the headers.
+RSpec.describe 'VisitedList' do # rubocop:disable RSpec/DescribeClass
+  it 'marks visited items with tags and bitmaps, and reuses the lists of exited threads', :aggregate_failures do
+    run_native_test('visited_list_test', defines: ['HNSWLIB_VISITED_BITMAP_MIN_ELEMENTS=64'])
+  end
+end
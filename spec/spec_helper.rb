@@ -1,6 +1,34 @@
 # frozen_string_literal: true
 
 require 'hnswlib'
+require 'open3'
+require 'rbconfig'
+require 'shellwords'
+require 'tmpdir'
+
+# Builds a test program of spec/cpp with the headers of the extension and runs it, for the internal parts of
+# the extension that cannot be reached from Ruby. The example is skipped if the C++ compiler is not available.
+module NativeTestHelper
+  SRC_DIR = File.expand_path('../ext/hnswlib/src', __dir__)
+  CPP_DIR = File.expand_path('cpp', __dir__)
+
+  def run_native_test(name, defines: [])
+    Dir.mktmpdir do |dir|
+      exe = File.join(dir, "#{name}#{RbConfig::CONFIG['EXEEXT']}")
+      cxx = Shellwords.split(RbConfig::CONFIG['CXX'])
+      flags = %w[-std=c++14 -O1 -pthread] + defines.map { |define| "-D#{define}" }
+      flags += %W[-I#{SRC_DIR} #{File.join(CPP_DIR, "#{name}.cpp")} -o #{exe}]
+      begin
+        compile_output, compile_status = Open3.capture2e(*cxx, *flags)
+      rescue Errno::ENOENT
+        skip 'C++ compiler is not available.'
+      end
+      expect(compile_status.success?).to be(true), compile_output
+      test_output, test_status = Open3.capture2e(exe)
+      expect(test_status.success?).to be(true), test_output
+    end
+  end
+end
 
 RSpec.configure do |config|
   # Enable flags like --only-failures and --next-failure
@@ -12,6 +40,8 @@ RSpec.configure do |config|
   config.expect_with :rspec do |c|
     c.syntax = :expect
   end
+
+  config.include NativeTestHelper
 end
 
 module RSpec